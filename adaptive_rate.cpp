@@ -0,0 +1,229 @@
+#include "adaptive_rate.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <zfp.h>
+#include <glm/gtx/string_cast.hpp>
+#include "bcmc_file.h"
+#include "compress.h"
+#include "large_buffer.h"
+#include "parallel.h"
+#include "profiler.h"
+
+namespace {
+
+// The blocks of a region, clipped to the volume
+struct Region {
+    glm::uvec3 first_block = glm::uvec3(0);
+    glm::uvec3 num_blocks = glm::uvec3(0);
+
+    size_t size() const
+    {
+        return size_t(num_blocks.x) * num_blocks.y * num_blocks.z;
+    }
+
+    // Get the coordinates of the i'th block of the region, x fastest
+    glm::uvec3 block(size_t i) const
+    {
+        return first_block + glm::uvec3(i % num_blocks.x,
+                                        (i / num_blocks.x) % num_blocks.y,
+                                        i / (size_t(num_blocks.x) * num_blocks.y));
+    }
+};
+
+Region get_region(size_t r,
+                  const glm::uvec3 &region_grid,
+                  const glm::uvec3 &block_dims,
+                  uint32_t region_blocks)
+{
+    const glm::uvec3 coords(r % region_grid.x,
+                            (r / region_grid.x) % region_grid.y,
+                            r / (size_t(region_grid.x) * region_grid.y));
+    Region region;
+    region.first_block = coords * region_blocks;
+    region.num_blocks =
+        glm::min(glm::uvec3(region_blocks), block_dims - region.first_block);
+    return region;
+}
+
+}
+
+bool parse_adaptive_rates(const std::string &list, std::vector<int> &rates)
+{
+    rates.clear();
+    std::stringstream ss(list);
+    std::string rate;
+    while (std::getline(ss, rate, ',')) {
+        const int used_rate = fixed_compression_rate(std::stoi(rate));
+        if (used_rate < 0) {
+            return false;
+        }
+        rates.push_back(used_rate);
+    }
+    std::sort(rates.begin(), rates.end());
+    rates.erase(std::unique(rates.begin(), rates.end()), rates.end());
+    if (rates.empty()) {
+        std::cout << "-adaptive-rates requires at least one rate\n";
+        return false;
+    }
+    return true;
+}
+
+bool compress_adaptive_volume(const float *data,
+                              const glm::uvec3 &dims,
+                              const AdaptiveRateOptions &options,
+                              const std::string &out_base,
+                              std::string &out_name,
+                              const glm::uvec3 &logical_dims)
+{
+    using namespace std::chrono;
+    PROFILE_ZONE("compress_adaptive_volume");
+    if (options.rates.empty() || options.region_blocks == 0) {
+        std::cout << "Adaptive rate compression requires rates and a non-zero region size\n";
+        return false;
+    }
+    const std::vector<int> &rates = options.rates;
+    const uint32_t region_blocks = options.region_blocks;
+    const size_t num_voxels = size_t(dims.x) * size_t(dims.y) * size_t(dims.z);
+    const glm::uvec3 block_dims = (dims + glm::uvec3(3)) / glm::uvec3(4);
+    const uint32_t file_dims[3] = {dims.x, dims.y, dims.z};
+    uint32_t grid[3];
+    bcmc_region_grid(file_dims, region_blocks, grid);
+    const glm::uvec3 region_grid(grid[0], grid[1], grid[2]);
+    const size_t num_regions = size_t(region_grid.x) * region_grid.y * region_grid.z;
+
+    // The error tolerance is relative to the value range of the volume
+    auto start = steady_clock::now();
+    const glm::vec2 value_range = compute_volume_range(data, num_voxels);
+    const float tolerance = options.tolerance * (value_range.y - value_range.x);
+    std::cout << "Adaptive rate compression of " << glm::to_string(dims) << " volume in "
+              << num_regions << " regions of " << region_blocks << "^3 blocks, max error "
+              << tolerance << "\n";
+
+    // Pick the lowest rate at which all blocks of the region are within the tolerance
+    std::vector<uint8_t> region_class(num_regions, 0);
+    parallel_for(0, num_regions, [&](const size_t begin, const size_t end) {
+        PROFILE_ZONE("select region rates");
+        uint64_t scratch[MAX_COMPRESSED_BLOCK_WORDS];
+        bitstream *stream = stream_open(scratch, sizeof(scratch));
+        zfp_stream *zfp = zfp_stream_open(stream);
+        for (size_t r = begin; r < end; ++r) {
+            const Region region = get_region(r, region_grid, block_dims, region_blocks);
+            size_t c = 0;
+            for (; c + 1 < rates.size(); ++c) {
+                zfp_stream_set_rate(zfp, rates[c], zfp_type_float, 3, 0);
+                bool within_tolerance = true;
+                for (size_t i = 0; i < region.size() && within_tolerance; ++i) {
+                    TrialError error;
+                    trial_compress_block(zfp, data, dims, region.block(i), error);
+                    within_tolerance = error.max_error <= tolerance;
+                }
+                if (within_tolerance) {
+                    break;
+                }
+            }
+            region_class[r] = c;
+        }
+        zfp_stream_close(zfp);
+        stream_close(stream);
+    });
+    auto selected = steady_clock::now();
+
+    // Lay out the blocks of each rate class in region order and give each non-empty class a
+    // stream
+    std::vector<size_t> class_blocks(rates.size(), 0);
+    std::vector<size_t> class_regions(rates.size(), 0);
+    std::vector<BCMCRegionEntry> regions(num_regions);
+    for (size_t r = 0; r < num_regions; ++r) {
+        const size_t c = region_class[r];
+        regions[r].first_block = class_blocks[c];
+        class_blocks[c] += get_region(r, region_grid, block_dims, region_blocks).size();
+        class_regions[c]++;
+    }
+    std::vector<uint32_t> class_stream(rates.size(), 0);
+    uint32_t num_streams = 0;
+    for (size_t c = 0; c < rates.size(); ++c) {
+        if (class_blocks[c] != 0) {
+            class_stream[c] = num_streams++;
+        }
+    }
+    for (size_t r = 0; r < num_regions; ++r) {
+        regions[r].stream = class_stream[region_class[r]];
+    }
+
+    out_name = out_base + ".crate";
+    for (size_t c = 0; c < rates.size(); ++c) {
+        out_name += (c == 0 ? "" : "-") + std::to_string(rates[c]);
+    }
+    out_name += ".bcmc";
+    BCMCFileWriter writer;
+    if (!writer.open(out_name, file_dims, num_streams, 1, {"value"}, region_blocks) ||
+        !writer.set_regions(regions)) {
+        return false;
+    }
+    if (logical_dims != glm::uvec3(0) && logical_dims != dims) {
+        const uint32_t file_logical_dims[3] = {logical_dims.x, logical_dims.y, logical_dims.z};
+        if (!writer.set_logical_dims(file_logical_dims)) {
+            return false;
+        }
+    }
+
+    // Compress each rate class to its own stream. Blocks are a whole number of 64 bit words at
+    // any rate, so workers write their regions' blocks directly to their place in the stream
+    size_t total_bytes = 0;
+    for (size_t c = 0; c < rates.size(); ++c) {
+        if (class_blocks[c] == 0) {
+            continue;
+        }
+        PROFILE_ZONE("compress rate class");
+        const size_t block_bits = size_t(rates[c]) * 64;
+        LargeVector<uint8_t> compressed;
+        compressed.resize(class_blocks[c] * block_bits / 8);
+        parallel_for(0, num_regions, [&](const size_t begin, const size_t end) {
+            bitstream *stream = stream_open(compressed.data(), compressed.size());
+            zfp_stream *zfp = zfp_stream_open(stream);
+            zfp_stream_set_rate(zfp, rates[c], zfp_type_float, 3, 0);
+            for (size_t r = begin; r < end; ++r) {
+                if (region_class[r] != c) {
+                    continue;
+                }
+                const Region region = get_region(r, region_grid, block_dims, region_blocks);
+                stream_wseek(stream, regions[r].first_block * block_bits);
+                for (size_t i = 0; i < region.size(); ++i) {
+                    encode_volume_block(zfp, data, dims, region.block(i));
+                }
+            }
+            zfp_stream_close(zfp);
+            stream_close(stream);
+        });
+
+        // Every rate's stream holds part of timestep 0, indexed to the first stream
+        BCMCStreamEntry entry;
+        entry.rate = rates[c];
+        entry.first_timestep = 0;
+        entry.num_timesteps = 1;
+        if (!writer.add_stream(entry, compressed.data(), compressed.size())) {
+            return false;
+        }
+        total_bytes += compressed.size();
+        std::cout << "Rate " << rates[c] << ": " << class_regions[c] << " regions, "
+                  << class_blocks[c] << " blocks, " << compressed.size() << "B\n";
+    }
+    if (!writer.finish()) {
+        std::cout << "Failed to write adaptive rate volume " << out_name << "\n";
+        return false;
+    }
+    auto end = steady_clock::now();
+
+    const size_t num_blocks = size_t(block_dims.x) * block_dims.y * block_dims.z;
+    std::cout << "Total compressed size: " << total_bytes << "B, "
+              << double(total_bytes) * 8.0 / (num_blocks * 64) << " bits per value ("
+              << num_blocks * size_t(rates.back()) * 8 << "B at rate " << rates.back()
+              << ")\n"
+              << "Rate selection took "
+              << duration_cast<milliseconds>(selected - start).count()
+              << "ms, compression took "
+              << duration_cast<milliseconds>(end - selected).count() << "ms\n";
+    return true;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+struct AdaptiveRateOptions {
+    // The rates regions can be compressed at, e.g. 2, 4, 8 and 16 bits per value
+    std::vector<int> rates;
+    // Size of the regions along each axis in ZFP blocks
+    uint32_t region_blocks = 4;
+    // The largest error allowed in a region, relative to the value range of the volume
+    double tolerance = 0.01;
+};
+
+// Parse a comma separated list of rates, e.g. 2,4,8,16. Returns false if a rate is invalid
+bool parse_adaptive_rates(const std::string &list, std::vector<int> &rates);
+
+// Compress a float volume with a rate picked per region of blocks. Each region is trial
+// compressed at increasing rates in parallel and given the lowest rate at which the largest
+// error over its voxels is within the tolerance, or the highest rate if none is. The blocks
+// of each rate class are written as their own fixed rate stream to a BCMC file at
+// <out_base>.crate<r0>-<r1>-...bcmc, along with a region table giving each region's stream
+// and first block so any block can still be addressed in constant time. For padded volumes,
+// logical_dims gives the dims of the data within dims and is recorded in the file header.
+bool compress_adaptive_volume(const float *data,
+                              const glm::uvec3 &dims,
+                              const AdaptiveRateOptions &options,
+                              const std::string &out_base,
+                              std::string &out_name,
+                              const glm::uvec3 &logical_dims = glm::uvec3(0));
@@ -0,0 +1,235 @@
+#include "bcmc_file.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+uint64_t align_up(uint64_t x, uint64_t align)
+{
+    return ((x + align - 1) / align) * align;
+}
+
+size_t num_regions(const BCMCHeader &header)
+{
+    if (header.region_blocks == 0) {
+        return 0;
+    }
+    uint32_t grid[3];
+    bcmc_region_grid(header.dims, header.region_blocks, grid);
+    return size_t(grid[0]) * grid[1] * grid[2];
+}
+
+size_t tables_size(const BCMCHeader &header)
+{
+    return sizeof(BCMCHeader) + header.num_streams * sizeof(BCMCStreamEntry) +
+           size_t(header.num_timesteps) * header.num_channels * sizeof(BCMCTimestepEntry) +
+           header.num_channels * sizeof(BCMCChannelEntry) +
+           num_regions(header) * sizeof(BCMCRegionEntry);
+}
+
+}
+
+void bcmc_region_grid(const uint32_t dims[3], uint32_t region_blocks, uint32_t grid[3])
+{
+    const uint32_t region_voxels = 4 * region_blocks;
+    for (size_t i = 0; i < 3; ++i) {
+        grid[i] = (dims[i] + region_voxels - 1) / region_voxels;
+    }
+}
+
+void BCMCFileInfo::region_block_location(const uint32_t block[3],
+                                         uint32_t &stream,
+                                         uint64_t &index_in_stream) const
+{
+    const uint32_t rb = header.region_blocks;
+    uint32_t grid[3];
+    bcmc_region_grid(header.dims, rb, grid);
+    uint32_t region[3];
+    uint32_t local[3];
+    uint32_t extent[3];
+    for (size_t i = 0; i < 3; ++i) {
+        region[i] = block[i] / rb;
+        local[i] = block[i] - region[i] * rb;
+        // Regions at the edge of the volume are clipped to the blocks inside it
+        const uint32_t volume_blocks = (header.dims[i] + 3) / 4;
+        extent[i] = std::min(rb, volume_blocks - region[i] * rb);
+    }
+    const BCMCRegionEntry &r =
+        regions[region[0] + size_t(grid[0]) * (region[1] + size_t(grid[1]) * region[2])];
+    stream = r.stream;
+    index_in_stream = r.first_block + local[0] +
+                      uint64_t(extent[0]) * (local[1] + uint64_t(extent[1]) * local[2]);
+}
+
+bool parse_bcmc_file(const uint8_t *data, size_t size, BCMCFileInfo &info)
+{
+    if (size < sizeof(BCMCHeader)) {
+        std::cerr << "File is too small to be a BCMC file\n";
+        return false;
+    }
+    std::memcpy(&info.header, data, sizeof(BCMCHeader));
+    if (std::memcmp(info.header.magic, "BCMC", 4) != 0) {
+        std::cerr << "File is not a BCMC file\n";
+        return false;
+    }
+    if (info.header.version != BCMC_FILE_VERSION) {
+        std::cerr << "Unsupported BCMC file version " << info.header.version << "\n";
+        return false;
+    }
+    if (info.header.num_channels == 0 || size < tables_size(info.header)) {
+        std::cerr << "BCMC file is truncated\n";
+        return false;
+    }
+    for (int i = 0; i < 3; ++i) {
+        if (info.header.logical_dims[i] > info.header.dims[i]) {
+            std::cerr << "BCMC file has logical dims larger than its dims\n";
+            return false;
+        }
+    }
+
+    info.streams.resize(info.header.num_streams);
+    const uint8_t *p = data + sizeof(BCMCHeader);
+    std::memcpy(info.streams.data(), p, info.streams.size() * sizeof(BCMCStreamEntry));
+    p += info.streams.size() * sizeof(BCMCStreamEntry);
+
+    info.timesteps.resize(size_t(info.header.num_timesteps) * info.header.num_channels);
+    std::memcpy(info.timesteps.data(), p, info.timesteps.size() * sizeof(BCMCTimestepEntry));
+    p += info.timesteps.size() * sizeof(BCMCTimestepEntry);
+
+    info.channels.resize(info.header.num_channels);
+    std::memcpy(info.channels.data(), p, info.channels.size() * sizeof(BCMCChannelEntry));
+    p += info.channels.size() * sizeof(BCMCChannelEntry);
+    for (auto &c : info.channels) {
+        c.name[sizeof(c.name) - 1] = '\0';
+    }
+
+    info.regions.resize(num_regions(info.header));
+    std::memcpy(info.regions.data(), p, info.regions.size() * sizeof(BCMCRegionEntry));
+    for (const auto &r : info.regions) {
+        if (r.stream >= info.streams.size()) {
+            std::cerr << "BCMC file has an invalid region table\n";
+            return false;
+        }
+    }
+
+    for (const auto &s : info.streams) {
+        if (s.offset + s.size > size || s.channel >= info.header.num_channels) {
+            std::cerr << "BCMC file is truncated\n";
+            return false;
+        }
+    }
+    for (const auto &t : info.timesteps) {
+        if (t.stream >= info.streams.size()) {
+            std::cerr << "BCMC file has an invalid timestep index\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool BCMCFileWriter::open(const std::string &file_name,
+                          const uint32_t dims[3],
+                          uint32_t num_streams,
+                          uint32_t num_timesteps,
+                          const std::vector<std::string> &channel_names,
+                          uint32_t region_blocks)
+{
+    file.open(file_name.c_str(), std::ios::binary);
+    if (!file) {
+        std::cerr << "Failed to open output file " << file_name << "\n";
+        return false;
+    }
+    info = BCMCFileInfo();
+    std::memcpy(info.header.dims, dims, sizeof(info.header.dims));
+    info.header.num_streams = num_streams;
+    info.header.num_timesteps = num_timesteps;
+    info.header.num_channels = channel_names.size();
+    info.header.region_blocks = region_blocks;
+    info.streams.resize(num_streams);
+    info.timesteps.resize(size_t(num_timesteps) * channel_names.size());
+    info.channels.resize(channel_names.size());
+    for (size_t i = 0; i < channel_names.size(); ++i) {
+        std::strncpy(info.channels[i].name,
+                     channel_names[i].c_str(),
+                     sizeof(info.channels[i].name) - 1);
+    }
+    info.regions.resize(num_regions(info.header));
+    next_stream = 0;
+    write_offset = align_up(tables_size(info.header), BCMC_STREAM_ALIGNMENT);
+    return true;
+}
+
+bool BCMCFileWriter::set_regions(const std::vector<BCMCRegionEntry> &regions)
+{
+    if (regions.size() != info.regions.size()) {
+        std::cerr << "Expected " << info.regions.size() << " regions but got "
+                  << regions.size() << "\n";
+        return false;
+    }
+    info.regions = regions;
+    return true;
+}
+
+bool BCMCFileWriter::set_logical_dims(const uint32_t logical_dims[3])
+{
+    for (int i = 0; i < 3; ++i) {
+        if (logical_dims[i] == 0 || logical_dims[i] > info.header.dims[i]) {
+            std::cerr << "Logical dims must be non-zero and within the volume dims\n";
+            return false;
+        }
+    }
+    std::memcpy(info.header.logical_dims, logical_dims, sizeof(info.header.logical_dims));
+    return true;
+}
+
+bool BCMCFileWriter::add_stream(BCMCStreamEntry entry, const uint8_t *data, size_t size)
+{
+    if (next_stream >= info.streams.size()) {
+        std::cerr << "Too many streams added to BCMC file\n";
+        return false;
+    }
+    if (entry.first_timestep + entry.num_timesteps > info.header.num_timesteps ||
+        entry.channel >= info.header.num_channels) {
+        std::cerr << "Stream timesteps or channel are out of range of the BCMC file\n";
+        return false;
+    }
+    entry.offset = write_offset;
+    entry.size = size;
+    const bool region_stream = info.header.region_blocks != 0 && next_stream > 0;
+    for (uint32_t i = 0; i < entry.num_timesteps && !region_stream; ++i) {
+        BCMCTimestepEntry &t =
+            info.timesteps[size_t(entry.first_timestep + i) * info.header.num_channels +
+                           entry.channel];
+        t.stream = next_stream;
+        t.w = i;
+    }
+    info.streams[next_stream++] = entry;
+
+    file.seekp(entry.offset);
+    file.write(reinterpret_cast<const char *>(data), size);
+    write_offset = align_up(entry.offset + size, BCMC_STREAM_ALIGNMENT);
+    return bool(file);
+}
+
+bool BCMCFileWriter::finish()
+{
+    if (next_stream != info.streams.size()) {
+        std::cerr << "BCMC file is missing streams, expected " << info.streams.size()
+                  << " but got " << next_stream << "\n";
+        return false;
+    }
+    file.seekp(0);
+    file.write(reinterpret_cast<const char *>(&info.header), sizeof(BCMCHeader));
+    file.write(reinterpret_cast<const char *>(info.streams.data()),
+               info.streams.size() * sizeof(BCMCStreamEntry));
+    file.write(reinterpret_cast<const char *>(info.timesteps.data()),
+               info.timesteps.size() * sizeof(BCMCTimestepEntry));
+    file.write(reinterpret_cast<const char *>(info.channels.data()),
+               info.channels.size() * sizeof(BCMCChannelEntry));
+    file.write(reinterpret_cast<const char *>(info.regions.data()),
+               info.regions.size() * sizeof(BCMCRegionEntry));
+    const bool success = bool(file);
+    file.close();
+    return success;
+}
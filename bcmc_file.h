@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Container for outputs made of more than one ZFP stream, e.g. time series, multi-component
+// or adaptive rate volumes. The file starts with a BCMCHeader, followed by the stream table,
+// the timestep index, the channel table and, for adaptive rate volumes, the region table.
+// Each stream is a fixed rate ZFP stream starting at a page aligned offset, so blocks within
+// it can be addressed directly and the stream can be mmap'd or served on its own.
+constexpr uint32_t BCMC_FILE_VERSION = 1;
+constexpr size_t BCMC_STREAM_ALIGNMENT = 4096;
+
+struct BCMCHeader {
+    char magic[4] = {'B', 'C', 'M', 'C'};
+    uint32_t version = BCMC_FILE_VERSION;
+    // Dimensions of a single timestep of the volume
+    uint32_t dims[3] = {0, 0, 0};
+    uint32_t num_timesteps = 1;
+    uint32_t num_streams = 0;
+    uint32_t num_channels = 1;
+    // Size in ZFP blocks along each axis of the regions of an adaptive rate volume, or 0 if
+    // the file has no region table
+    uint32_t region_blocks = 0;
+    // Dimensions of the volume's data when dims was padded, e.g. up to whole ZFP blocks, or 0
+    // if the volume isn't padded
+    uint32_t logical_dims[3] = {0, 0, 0};
+    uint32_t reserved[4] = {0};
+};
+
+struct BCMCStreamEntry {
+    // Byte offset of the stream from the start of the file and its size in bytes
+    uint64_t offset = 0;
+    uint64_t size = 0;
+    // Bits per value of the fixed rate stream
+    uint32_t rate = 0;
+    // 3 for a 3D stream, 4 for a 4D stream of several timesteps along w
+    uint32_t zfp_dims = 3;
+    // The range of timesteps stored in the stream
+    uint32_t first_timestep = 0;
+    uint32_t num_timesteps = 1;
+    // The channel of the volume stored in the stream
+    uint32_t channel = 0;
+    uint32_t reserved[3] = {0};
+};
+
+// Index entry to seek to a timestep: the stream containing it and its w index in the stream.
+// The index has an entry per channel for each timestep, indexed by timestep * num_channels +
+// channel
+struct BCMCTimestepEntry {
+    uint32_t stream = 0;
+    uint32_t w = 0;
+};
+
+struct BCMCChannelEntry {
+    // Null terminated channel name, e.g. x, y, z or magnitude
+    char name[32] = {0};
+};
+
+// Adaptive rate volumes are split into regions of region_blocks^3 ZFP blocks, each compressed
+// at the rate of one of the streams. The region table has an entry per region, x fastest,
+// giving the stream holding the region's blocks and the index of its first block in the
+// stream. The blocks of a region follow in x fastest order, clipped to the volume.
+struct BCMCRegionEntry {
+    uint32_t stream = 0;
+    uint32_t first_block = 0;
+};
+
+static_assert(sizeof(BCMCHeader) == 64, "BCMCHeader layout changed");
+static_assert(sizeof(BCMCStreamEntry) == 48, "BCMCStreamEntry layout changed");
+static_assert(sizeof(BCMCTimestepEntry) == 8, "BCMCTimestepEntry layout changed");
+static_assert(sizeof(BCMCChannelEntry) == 32, "BCMCChannelEntry layout changed");
+static_assert(sizeof(BCMCRegionEntry) == 8, "BCMCRegionEntry layout changed");
+
+// Get the number of regions along each axis of an adaptive rate volume
+void bcmc_region_grid(const uint32_t dims[3], uint32_t region_blocks, uint32_t grid[3]);
+
+struct BCMCFileInfo {
+    BCMCHeader header;
+    std::vector<BCMCStreamEntry> streams;
+    std::vector<BCMCTimestepEntry> timesteps;
+    std::vector<BCMCChannelEntry> channels;
+    std::vector<BCMCRegionEntry> regions;
+
+    // Get the stream and w offset of the timestep of the channel
+    const BCMCTimestepEntry &timestep_entry(uint32_t timestep, uint32_t channel = 0) const
+    {
+        return timesteps[size_t(timestep) * header.num_channels + channel];
+    }
+
+    // Find the stream and index in the stream of a ZFP block of an adaptive rate volume,
+    // given the block's coordinates in the grid of blocks
+    void region_block_location(const uint32_t block[3],
+                               uint32_t &stream,
+                               uint64_t &index_in_stream) const;
+};
+
+// Parse the header and tables of a BCMC file from its contents, e.g. a mapped file
+bool parse_bcmc_file(const uint8_t *data, size_t size, BCMCFileInfo &info);
+
+// Writes a BCMC file, streaming the ZFP streams out as they're added. The header and tables
+// are written once all streams have been added.
+class BCMCFileWriter {
+    std::ofstream file;
+    BCMCFileInfo info;
+    size_t next_stream = 0;
+    uint64_t write_offset = 0;
+
+public:
+    // Open the output file with room for the header and tables of the given number of streams,
+    // timesteps and channels. Adaptive rate volumes pass their region size in blocks to make
+    // room for the region table, which is filled in with set_regions
+    bool open(const std::string &file_name,
+              const uint32_t dims[3],
+              uint32_t num_streams,
+              uint32_t num_timesteps,
+              const std::vector<std::string> &channel_names = {"value"},
+              uint32_t region_blocks = 0);
+
+    // Set the region table of an adaptive rate volume
+    bool set_regions(const std::vector<BCMCRegionEntry> &regions);
+
+    // Record the dims of the data of a padded volume, which must fit in the file's dims
+    bool set_logical_dims(const uint32_t logical_dims[3]);
+
+    // Append the next stream, filling in its offset and size in the stream table. The timestep
+    // index entries for the timesteps stored in the stream are filled in from the entry. The
+    // streams of an adaptive rate volume each hold part of the same timestep, which the index
+    // points at the first stream of, the region table locates the blocks of the others.
+    bool add_stream(BCMCStreamEntry entry, const uint8_t *data, size_t size);
+
+    // Write the header and tables and close the file
+    bool finish();
+};
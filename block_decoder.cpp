@@ -0,0 +1,43 @@
+#include "block_decoder.h"
+#include <regex>
+#include <zfp.h>
+
+bool parse_compressed_volume_name(const std::string &file_name, CompressedVolumeInfo &info)
+{
+    const std::regex match_filename(".*_(\\d+)x(\\d+)x(\\d+)_.+\\.crate(\\d+)\\.zfp");
+    std::smatch matches;
+    if (!std::regex_match(file_name, matches, match_filename)) {
+        return false;
+    }
+    info.dims = glm::uvec3(
+        std::stoi(matches[1]), std::stoi(matches[2]), std::stoi(matches[3]));
+    info.rate = std::stoi(matches[4]);
+    info.logical_dims = info.dims;
+    const std::regex match_logical("\\.logical(\\d+)x(\\d+)x(\\d+)\\.");
+    if (std::regex_search(file_name, matches, match_logical)) {
+        info.logical_dims = glm::uvec3(
+            std::stoi(matches[1]), std::stoi(matches[2]), std::stoi(matches[3]));
+    }
+    return true;
+}
+
+BlockDecoder::BlockDecoder(const uint8_t *data, size_t size, int rate)
+    : block_bits(uint64_t(rate) * ZFP_BLOCK_VOXELS)
+{
+    // The stream is only read from, but bitstream takes a non-const buffer
+    stream = stream_open(const_cast<uint8_t *>(data), size);
+    zfp = zfp_stream_open(stream);
+    zfp_stream_set_rate(zfp, rate, zfp_type_float, 3, 0);
+}
+
+BlockDecoder::~BlockDecoder()
+{
+    zfp_stream_close(zfp);
+    stream_close(stream);
+}
+
+void BlockDecoder::decode(size_t block_index, float *block)
+{
+    stream_rseek(stream, block_index * block_bits);
+    zfp_decode_block_float_3(zfp, block);
+}
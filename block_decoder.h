@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <zfp.h>
+#include <glm/glm.hpp>
+
+constexpr size_t ZFP_BLOCK_VOXELS = 64;
+
+// The volume dimensions and rate of a fixed rate .zfp stream written by the tool, parsed from
+// its file name: <name>_<X>x<Y>x<Z>_<data type>.raw.crate<N>.zfp or the equivalent .gen name.
+// Padded volumes have the padded dims in the name, followed by .logical<X>x<Y>x<Z> before the
+// rate
+struct CompressedVolumeInfo {
+    glm::uvec3 dims = glm::uvec3(0);
+    // The dims of the volume's data, dims minus any padding
+    glm::uvec3 logical_dims = glm::uvec3(0);
+    int rate = -1;
+
+    // The number of 4^3 ZFP blocks along each axis
+    glm::uvec3 block_dims() const
+    {
+        return (dims + glm::uvec3(3)) / glm::uvec3(4);
+    }
+
+    size_t num_blocks() const
+    {
+        const glm::uvec3 b = block_dims();
+        return size_t(b.x) * size_t(b.y) * size_t(b.z);
+    }
+
+    // Size of the stream up to the end of the last block, each block takes rate * 64 bits
+    size_t stream_bytes() const
+    {
+        return num_blocks() * size_t(rate) * ZFP_BLOCK_VOXELS / 8;
+    }
+};
+
+bool parse_compressed_volume_name(const std::string &file_name, CompressedVolumeInfo &info);
+
+// Decodes individual blocks of a fixed rate 3D ZFP stream by seeking directly to them. Blocks
+// are indexed in the order ZFP writes them, x fastest over the grid of blocks. A decoder
+// holds its own stream state, so each thread should use its own decoder.
+class BlockDecoder {
+    zfp_stream *zfp = nullptr;
+    bitstream *stream = nullptr;
+    uint64_t block_bits = 0;
+
+public:
+    BlockDecoder(const uint8_t *data, size_t size, int rate);
+    ~BlockDecoder();
+
+    BlockDecoder(const BlockDecoder &) = delete;
+    BlockDecoder &operator=(const BlockDecoder &) = delete;
+
+    // Decode the 4^3 block, x fastest, into block. Voxels of partial blocks at the edge of
+    // the volume outside it hold the padding ZFP encoded
+    void decode(size_t block_index, float *block);
+};
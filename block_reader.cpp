@@ -0,0 +1,204 @@
+#include "block_reader.h"
+#include <algorithm>
+#include <iostream>
+#include <glm/gtx/string_cast.hpp>
+
+namespace {
+
+constexpr size_t NUM_CACHE_SHARDS = 16;
+
+// Each cached block is charged its decoded size plus an estimate of the list and map nodes
+// and shared_ptr control block holding it
+constexpr size_t CACHED_BLOCK_BYTES = sizeof(DecodedBlock) + 128;
+
+}
+
+BlockReader::BlockReader(size_t cache_bytes)
+    : shard_budget_bytes(cache_bytes / NUM_CACHE_SHARDS)
+{
+    for (size_t i = 0; i < NUM_CACHE_SHARDS; ++i) {
+        shards.emplace_back(new CacheShard());
+    }
+}
+
+bool BlockReader::open(const std::string &file_name, const CompressedVolumeInfo &info)
+{
+    clear_cache();
+    volume_info = info;
+    if (volume_info.dims == glm::uvec3(0) || volume_info.rate <= 0) {
+        if (!parse_compressed_volume_name(file_name, volume_info)) {
+            std::cerr << "Could not find the dimensions and rate of " << file_name
+                      << " from its name, expected '<name>_<X>x<Y>x<Z>_<data "
+                         "type>.raw.crate<N>.zfp'\n";
+            return false;
+        }
+    }
+    if (!file.open(file_name)) {
+        return false;
+    }
+    if (file.size() < volume_info.stream_bytes()) {
+        std::cerr << "Stream " << file_name << " is too small: expected "
+                  << volume_info.stream_bytes() << "b for a "
+                  << glm::to_string(volume_info.dims) << " volume at rate " << volume_info.rate
+                  << " but the file is " << file.size() << "b\n";
+        file.close();
+        return false;
+    }
+    return true;
+}
+
+void BlockReader::set_cache_budget(size_t bytes)
+{
+    shard_budget_bytes = bytes / NUM_CACHE_SHARDS;
+    for (auto &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        evict(*shard, shard_budget_bytes);
+    }
+}
+
+void BlockReader::clear_cache()
+{
+    for (auto &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->lru.clear();
+        shard->blocks.clear();
+    }
+}
+
+BlockCacheStats BlockReader::cache_stats() const
+{
+    BlockCacheStats stats;
+    for (const auto &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        stats.hits += shard->hits;
+        stats.misses += shard->misses;
+        stats.evictions += shard->evictions;
+        stats.cached_blocks += shard->blocks.size();
+    }
+    stats.cached_bytes = stats.cached_blocks * CACHED_BLOCK_BYTES;
+    return stats;
+}
+
+void BlockReader::evict(CacheShard &shard, size_t budget)
+{
+    while (!shard.lru.empty() && shard.blocks.size() * CACHED_BLOCK_BYTES > budget) {
+        shard.blocks.erase(shard.lru.back());
+        shard.lru.pop_back();
+        shard.evictions++;
+    }
+}
+
+std::shared_ptr<const DecodedBlock> BlockReader::get_block(
+    size_t block_index, std::unique_ptr<BlockDecoder> &decoder)
+{
+    CacheShard &shard = *shards[block_index % NUM_CACHE_SHARDS];
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto fnd = shard.blocks.find(block_index);
+        if (fnd != shard.blocks.end()) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, fnd->second.second);
+            shard.hits++;
+            return fnd->second.first;
+        }
+        shard.misses++;
+    }
+
+    // Decode outside the lock so other readers of the shard aren't blocked. If another
+    // thread decodes the same block meanwhile, the first one inserted is kept
+    if (!decoder) {
+        decoder.reset(new BlockDecoder(file.data(), file.size(), volume_info.rate));
+    }
+    std::shared_ptr<DecodedBlock> decoded = std::make_shared<DecodedBlock>();
+    decoder->decode(block_index, decoded->data());
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto fnd = shard.blocks.find(block_index);
+    if (fnd != shard.blocks.end()) {
+        return fnd->second.first;
+    }
+    shard.lru.push_front(block_index);
+    shard.blocks[block_index] = std::make_pair(decoded, shard.lru.begin());
+    // Keep the new block even if the budget is smaller than a single block, it's returned to
+    // the caller anyway
+    evict(shard, std::max(shard_budget_bytes.load(), CACHED_BLOCK_BYTES));
+    return decoded;
+}
+
+std::shared_ptr<const DecodedBlock> BlockReader::block(size_t block_index)
+{
+    if (block_index >= volume_info.num_blocks()) {
+        return nullptr;
+    }
+    std::unique_ptr<BlockDecoder> decoder;
+    return get_block(block_index, decoder);
+}
+
+bool BlockReader::value(const glm::uvec3 &voxel, float &out)
+{
+    if (glm::any(glm::greaterThanEqual(voxel, volume_info.dims))) {
+        return false;
+    }
+    const glm::uvec3 block_dims = volume_info.block_dims();
+    const glm::uvec3 b = voxel / glm::uvec3(4);
+    const glm::uvec3 l = voxel - b * glm::uvec3(4);
+    std::unique_ptr<BlockDecoder> decoder;
+    const auto block =
+        get_block(b.x + size_t(block_dims.x) * (b.y + size_t(block_dims.y) * b.z), decoder);
+    out = (*block)[l.x + 4 * (l.y + 4 * l.z)];
+    return true;
+}
+
+bool BlockReader::slice(uint32_t axis, uint32_t index, std::vector<float> &out)
+{
+    if (axis > 2 || index >= volume_info.dims[axis]) {
+        return false;
+    }
+    glm::uvec3 begin(0);
+    glm::uvec3 size = volume_info.dims;
+    begin[axis] = index;
+    size[axis] = 1;
+    return subvolume(begin, size, out);
+}
+
+bool BlockReader::subvolume(const glm::uvec3 &begin,
+                            const glm::uvec3 &size,
+                            std::vector<float> &out)
+{
+    const glm::uvec3 end = begin + size;
+    if (glm::any(glm::greaterThanEqual(begin, volume_info.dims)) ||
+        glm::any(glm::lessThan(volume_info.dims, end))) {
+        return false;
+    }
+    out.resize(size_t(size.x) * size_t(size.y) * size_t(size.z));
+    if (out.empty()) {
+        return true;
+    }
+
+    const glm::uvec3 block_dims = volume_info.block_dims();
+    const glm::uvec3 first_block = begin / glm::uvec3(4);
+    const glm::uvec3 last_block = (end - glm::uvec3(1)) / glm::uvec3(4);
+    std::unique_ptr<BlockDecoder> decoder;
+    for (uint32_t bz = first_block.z; bz <= last_block.z; ++bz) {
+        for (uint32_t by = first_block.y; by <= last_block.y; ++by) {
+            for (uint32_t bx = first_block.x; bx <= last_block.x; ++bx) {
+                const auto block = get_block(
+                    bx + size_t(block_dims.x) * (by + size_t(block_dims.y) * bz), decoder);
+                // The part of the block inside the region
+                const glm::uvec3 block_origin = glm::uvec3(bx, by, bz) * glm::uvec3(4);
+                const glm::uvec3 lo = glm::max(begin, block_origin);
+                const glm::uvec3 hi = glm::min(end, block_origin + glm::uvec3(4));
+                for (uint32_t z = lo.z; z < hi.z; ++z) {
+                    for (uint32_t y = lo.y; y < hi.y; ++y) {
+                        for (uint32_t x = lo.x; x < hi.x; ++x) {
+                            const glm::uvec3 l = glm::uvec3(x, y, z) - block_origin;
+                            const glm::uvec3 o = glm::uvec3(x, y, z) - begin;
+                            out[o.x + size_t(size.x) * (o.y + size_t(size.y) * o.z)] =
+                                (*block)[l.x + 4 * (l.y + 4 * l.z)];
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
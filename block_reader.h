@@ -0,0 +1,97 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+#include "block_decoder.h"
+#include "mapped_file.h"
+
+using DecodedBlock = std::array<float, ZFP_BLOCK_VOXELS>;
+
+struct BlockCacheStats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+    // Number and size of the blocks currently cached
+    size_t cached_blocks = 0;
+    size_t cached_bytes = 0;
+};
+
+// Random access reader for fixed rate .zfp volumes written by the tool. The stream is mmap'd
+// and individual blocks are decoded on demand, with decoded blocks kept in an LRU cache
+// limited to a byte budget. Queries can be made from multiple threads at once: the cache is
+// split into shards which are locked independently and blocks are decoded outside the locks.
+class BlockReader {
+    struct CacheShard {
+        std::mutex mutex;
+        // Most recently used blocks at the front
+        std::list<size_t> lru;
+        std::unordered_map<size_t,
+                           std::pair<std::shared_ptr<const DecodedBlock>,
+                                     std::list<size_t>::iterator>>
+            blocks;
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t evictions = 0;
+    };
+
+    MappedFile file;
+    CompressedVolumeInfo volume_info;
+    std::atomic<size_t> shard_budget_bytes;
+    std::vector<std::unique_ptr<CacheShard>> shards;
+
+    std::shared_ptr<const DecodedBlock> get_block(
+        size_t block_index, std::unique_ptr<BlockDecoder> &decoder);
+
+    void evict(CacheShard &shard, size_t budget);
+
+public:
+    // Default cache budget of 256MB of decoded blocks
+    static constexpr size_t DEFAULT_CACHE_BYTES = size_t(256) << 20;
+
+    explicit BlockReader(size_t cache_bytes = DEFAULT_CACHE_BYTES);
+
+    BlockReader(const BlockReader &) = delete;
+    BlockReader &operator=(const BlockReader &) = delete;
+
+    // Open a .zfp volume, taking its dimensions and rate from the file name unless info
+    // specifies them
+    bool open(const std::string &file_name,
+              const CompressedVolumeInfo &info = CompressedVolumeInfo());
+
+    const CompressedVolumeInfo &info() const
+    {
+        return volume_info;
+    }
+
+    // Change the cache budget, evicting blocks if the cache is over the new budget
+    void set_cache_budget(size_t bytes);
+
+    // Drop all cached blocks
+    void clear_cache();
+
+    BlockCacheStats cache_stats() const;
+
+    // Get the decoded block, x fastest. Returns null if the index is out of range
+    std::shared_ptr<const DecodedBlock> block(size_t block_index);
+
+    // Read the value of a voxel. Returns false if it is outside the volume
+    bool value(const glm::uvec3 &voxel, float &out);
+
+    // Read the axis aligned slice at index along axis (0, 1 or 2) into out, resizing it to the
+    // size of the slice. The slice is stored with the lower of the other two axes fastest,
+    // e.g. x then y for a z slice. Returns false if the slice is outside the volume
+    bool slice(uint32_t axis, uint32_t index, std::vector<float> &out);
+
+    // Read the subvolume of the given size starting at begin into out, x fastest, resizing it
+    // to the size of the subvolume. Returns false if the region is outside the volume
+    bool subvolume(const glm::uvec3 &begin, const glm::uvec3 &size, std::vector<float> &out);
+};
@@ -0,0 +1,332 @@
+#include "checkpoint.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include "compress.h"
+#include "content_hash.h"
+#include "profiler.h"
+
+namespace {
+
+constexpr uint32_t CHECKPOINT_VERSION = 1;
+
+struct CheckpointJournal {
+    char magic[4] = {'B', 'C', 'K', 'P'};
+    uint32_t version = CHECKPOINT_VERSION;
+    uint32_t dims[3] = {0, 0, 0};
+    uint32_t rate = 0;
+    // Number of block layers along z per slab and the number of slabs written so far
+    uint32_t slab_block_layers = 0;
+    uint32_t completed_slabs = 0;
+    uint64_t input_hash = 0;
+};
+
+static_assert(sizeof(CheckpointJournal) == 40, "CheckpointJournal layout changed");
+
+bool read_journal(const std::string &file_name, CheckpointJournal &journal)
+{
+    std::ifstream file(file_name.c_str(), std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    file.read(reinterpret_cast<char *>(&journal), sizeof(journal));
+    return file && std::memcmp(journal.magic, "BCKP", 4) == 0 &&
+           journal.version == CHECKPOINT_VERSION;
+}
+
+// Write the journal to a temporary file and rename it over the old one, so a run killed while
+// writing the journal leaves the previous one intact
+bool write_journal(const std::string &file_name, const CheckpointJournal &journal)
+{
+    const std::string tmp_name = file_name + ".tmp";
+    {
+        std::ofstream file(tmp_name.c_str(), std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char *>(&journal), sizeof(journal));
+        if (!file.flush()) {
+            std::cout << "Failed to write checkpoint " << tmp_name << "\n";
+            return false;
+        }
+    }
+    if (std::rename(tmp_name.c_str(), file_name.c_str()) != 0) {
+        std::cout << "Failed to replace checkpoint " << file_name << "\n";
+        return false;
+    }
+    return true;
+}
+
+}
+
+uint32_t checkpoint_slab_slices(const glm::uvec3 &dims, const CheckpointOptions &options)
+{
+    const size_t layer_bytes = size_t(dims.x) * dims.y * 4 * sizeof(float);
+    const size_t block_layers = (dims.z + 3) / 4;
+    return 4 * uint32_t(std::max(size_t(1),
+                                 std::min(block_layers, options.slab_bytes / layer_bytes)));
+}
+
+bool SlabStreamWriter::open(const std::string &name,
+                            const glm::uvec3 &volume_dims,
+                            int rate,
+                            const CheckpointOptions &writer_options,
+                            size_t resume_offset)
+{
+    out_name = name;
+    dims = volume_dims;
+    compression_rate = rate;
+    options = writer_options;
+    const glm::uvec3 block_dims = (dims + glm::uvec3(3)) / glm::uvec3(4);
+    layer_stream_bytes = size_t(block_dims.x) * block_dims.y * size_t(compression_rate) * 8;
+    stream_bytes = layer_stream_bytes * block_dims.z;
+
+    if (resume_offset > 0) {
+        out_file.open(out_name.c_str(), std::ios::binary | std::ios::in | std::ios::out);
+        if (!out_file || !out_file.seekg(0, std::ios::end) ||
+            size_t(out_file.tellg()) < resume_offset) {
+            std::cout << "Output " << out_name << " is missing the slabs written by the "
+                      << "earlier run\n";
+            return false;
+        }
+        if (options.direct_io) {
+            out_file.close();
+            return direct_file.open(out_name, resume_offset, false);
+        }
+        if (options.mmap_output) {
+            out_file.close();
+            return mapped_file.open(out_name, stream_bytes, false);
+        }
+        return true;
+    }
+    bool opened = false;
+    if (options.direct_io) {
+        opened = direct_file.open(out_name, 0, true);
+    } else if (options.mmap_output) {
+        opened = mapped_file.open(out_name, stream_bytes, true);
+    } else {
+        out_file.open(out_name.c_str(),
+                      std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
+        opened = bool(out_file);
+    }
+    if (!opened) {
+        std::cout << "Failed to open output " << out_name << "\n";
+    }
+    return opened;
+}
+
+bool SlabStreamWriter::write_slab(const float *slices,
+                                  uint32_t z_begin,
+                                  uint32_t z_end,
+                                  size_t &slab_bytes)
+{
+    if (z_begin % 4 != 0 || (z_end % 4 != 0 && z_end != dims.z) || z_begin >= z_end) {
+        std::cout << "Slab z [" << z_begin << ", " << z_end << ") doesn't hold whole block "
+                  << "layers\n";
+        return false;
+    }
+    const glm::uvec3 slab_dims(dims.x, dims.y, z_end - z_begin);
+    const size_t slab_offset = (z_begin / 4) * layer_stream_bytes;
+    slab_bytes = 0;
+    bool compressed_slab = false;
+    if (options.mmap_output) {
+        slab_bytes = std::min(fixed_rate_stream_bytes(slab_dims, compression_rate),
+                              stream_bytes - slab_offset);
+        compressed_slab = compress_volume_into(slices,
+                                               slab_dims,
+                                               compression_rate,
+                                               mapped_file.data() + slab_offset,
+                                               slab_bytes);
+    } else {
+        compressed_slab = compress_volume(slices, slab_dims, compression_rate, compressed);
+        slab_bytes = compressed.size();
+    }
+    if (!compressed_slab) {
+        std::cout << "Failed to compress slab z [" << z_begin << ", " << z_end << ")\n";
+        return false;
+    }
+    // Flushing hands the slab to the OS, so it survives the process being killed. Direct
+    // writes are on disk once flushed, the slabs follow each other so they're appended.
+    // Mapped slabs are already in the page cache, writing them back just starts early
+    bool written = true;
+    if (options.mmap_output) {
+        mapped_file.write_back(slab_offset, slab_bytes);
+    } else if (options.direct_io) {
+        written =
+            direct_file.write(compressed.data(), compressed.size()) && direct_file.flush();
+    } else {
+        out_file.seekp(slab_offset);
+        out_file.write(reinterpret_cast<const char *>(compressed.data()), compressed.size());
+        written = bool(out_file.flush());
+    }
+    if (!written) {
+        std::cout << "Failed to write slab z [" << z_begin << ", " << z_end << ") to "
+                  << out_name << "\n";
+    }
+    return written;
+}
+
+bool SlabStreamWriter::close()
+{
+    out_file.close();
+    if (!mapped_file.close()) {
+        std::cout << "Failed to write " << out_name << "\n";
+        return false;
+    }
+    if (options.direct_io) {
+        if (!direct_file.close()) {
+            std::cout << "Failed to write " << out_name << "\n";
+            return false;
+        }
+        const double ms = direct_file.total_write_ms();
+        std::cout << "Wrote " << direct_file.total_bytes() << "b "
+                  << (direct_file.is_direct() ? "with O_DIRECT" : "dropping cached pages")
+                  << " in " << ms << "ms, "
+                  << (ms > 0.0 ? direct_file.total_bytes() / (ms * 1e6) : 0.0) << "GB/s\n";
+    }
+    return true;
+}
+
+size_t SlabStreamWriter::buffer_bytes(const glm::uvec3 &dims,
+                                      int compression_rate,
+                                      uint32_t slab_slices,
+                                      const CheckpointOptions &options)
+{
+    if (options.mmap_output) {
+        return 0;
+    }
+    // The slab's stream buffer is sized by zfp_stream_maximum_size, which adds a header
+    const glm::uvec3 slab_dims(dims.x, dims.y, std::min(slab_slices, dims.z));
+    size_t bytes = fixed_rate_stream_bytes(slab_dims, compression_rate) + 64;
+    if (options.direct_io) {
+        bytes += DIRECT_IO_STAGING_BYTES + DIRECT_IO_ALIGNMENT;
+    }
+    return bytes;
+}
+
+bool compress_volume_checkpointed(const float *data,
+                                  const glm::uvec3 &dims,
+                                  int compression_rate,
+                                  const std::string &out_name,
+                                  const CheckpointOptions &options,
+                                  size_t &compressed_bytes)
+{
+    using namespace std::chrono;
+    PROFILE_ZONE("compress_volume_checkpointed");
+    const std::string journal_name = out_name + ".ckpt";
+    const size_t slice_voxels = size_t(dims.x) * dims.y;
+    const size_t num_voxels = slice_voxels * dims.z;
+
+    CheckpointJournal journal;
+    journal.dims[0] = dims.x;
+    journal.dims[1] = dims.y;
+    journal.dims[2] = dims.z;
+    journal.rate = compression_rate;
+    journal.slab_block_layers = checkpoint_slab_slices(dims, options) / 4;
+    journal.input_hash = parallel_content_hash(reinterpret_cast<const uint8_t *>(data),
+                                               num_voxels * sizeof(float));
+
+    CheckpointJournal previous;
+    if (options.resume && read_journal(journal_name, previous)) {
+        if (std::memcmp(previous.dims, journal.dims, sizeof(journal.dims)) != 0 ||
+            previous.rate != journal.rate || previous.input_hash != journal.input_hash ||
+            previous.slab_block_layers == 0) {
+            std::cout << "Checkpoint " << journal_name
+                      << " is for a different input or rate, remove it or run without "
+                         "-resume\n";
+            return false;
+        }
+        journal.slab_block_layers = previous.slab_block_layers;
+        journal.completed_slabs = previous.completed_slabs;
+    } else if (options.resume) {
+        std::cout << "No checkpoint found at " << journal_name << ", starting from the "
+                  << "beginning\n";
+    }
+
+    const uint32_t slab_slices = journal.slab_block_layers * 4;
+    const size_t num_slabs = (dims.z + slab_slices - 1) / slab_slices;
+    const size_t resume_offset =
+        fixed_rate_stream_bytes(glm::uvec3(dims.x, dims.y, slab_slices), compression_rate) *
+        journal.completed_slabs;
+    SlabStreamWriter writer;
+    if (journal.completed_slabs > 0) {
+        if (!writer.open(out_name, dims, compression_rate, options, resume_offset)) {
+            return false;
+        }
+        std::cout << "Resuming after slab " << journal.completed_slabs << " of " << num_slabs
+                  << "\n";
+    } else if (!writer.open(out_name, dims, compression_rate, options) ||
+               !write_journal(journal_name, journal)) {
+        std::cout << "Failed to open output " << out_name << "\n";
+        return false;
+    }
+
+    for (size_t s = journal.completed_slabs; s < num_slabs; ++s) {
+        PROFILE_ZONE("compress slab");
+        auto start = steady_clock::now();
+        const uint32_t z_begin = s * slab_slices;
+        const uint32_t z_end = std::min(dims.z, z_begin + slab_slices);
+        size_t slab_bytes = 0;
+        if (!writer.write_slab(data + z_begin * slice_voxels, z_begin, z_end, slab_bytes)) {
+            return false;
+        }
+        journal.completed_slabs = s + 1;
+        if (!write_journal(journal_name, journal)) {
+            return false;
+        }
+        auto end = steady_clock::now();
+        std::cout << "Slab " << s + 1 << "/" << num_slabs << " (z " << z_begin << "-"
+                  << z_end - 1 << "): " << slab_bytes << "B in "
+                  << duration_cast<milliseconds>(end - start).count() << "ms\n";
+    }
+    if (!writer.close()) {
+        return false;
+    }
+    std::remove(journal_name.c_str());
+    compressed_bytes = writer.stream_size();
+    return true;
+}
+
+bool compress_raw_volume_streamed(const std::string &raw_file_name,
+                                  const RawVolumeInfo &info,
+                                  const NormalizeOptions &normalize,
+                                  int compression_rate,
+                                  const std::string &out_name,
+                                  const CheckpointOptions &options,
+                                  size_t &compressed_bytes)
+{
+    using namespace std::chrono;
+    PROFILE_ZONE("compress_raw_volume_streamed");
+    const glm::uvec3 dims = info.dims;
+    SlabStreamWriter writer;
+    if (!writer.open(out_name, dims, compression_rate, options)) {
+        return false;
+    }
+    // Streamed slabs hold exactly this many slices, a whole number of block layers, apart
+    // from HDF5 slabs which are rounded up to whole layers of chunks as well
+    const uint32_t slab_slices = checkpoint_slab_slices(dims, options);
+    const size_t slab_bytes = size_t(dims.x) * dims.y * slab_slices * sizeof(float);
+    auto start = steady_clock::now();
+    const bool success = stream_raw_volume(
+        raw_file_name,
+        info,
+        normalize,
+        slab_bytes,
+        [&](const float *slices, uint32_t z_begin, uint32_t z_end) {
+            size_t written = 0;
+            if (!writer.write_slab(slices, z_begin, z_end, written)) {
+                return false;
+            }
+            auto end = steady_clock::now();
+            std::cout << "Slab z " << z_begin << "-" << z_end - 1 << ": " << written
+                      << "B in " << duration_cast<milliseconds>(end - start).count()
+                      << "ms\n";
+            start = end;
+            return true;
+        });
+    if (!success || !writer.close()) {
+        return false;
+    }
+    compressed_bytes = writer.stream_size();
+    return true;
+}
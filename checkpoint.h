@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <glm/glm.hpp>
+#include "direct_io.h"
+#include "large_buffer.h"
+#include "mapped_file.h"
+#include "raw_volume.h"
+
+struct CheckpointOptions {
+    // Continue from the checkpoint journal of an earlier run, if there is one
+    bool resume = false;
+    // Approximate size of the input compressed and written between checkpoints
+    size_t slab_bytes = size_t(256) << 20;
+    // Write the stream with O_DIRECT, bypassing the page cache (-direct-io)
+    bool direct_io = false;
+    // Compress each slab straight into a mapping of the preallocated output (-mmap-output)
+    bool mmap_output = false;
+};
+
+// Compress a float volume to a fixed rate ZFP stream written to out_name in slabs of whole
+// block layers along z. Blocks are stored z slowest, so each slab is a contiguous range of the
+// stream and is written as soon as it's compressed. After each slab a small journal,
+// <out_name>.ckpt, records the slabs completed along with the dims, rate and a hash of the
+// input. With resume set, a run with a matching journal continues after the last completed
+// slab, so a killed run repeats at most one slab of compression. The journal is removed once
+// the stream is complete. Returns false on failure, otherwise sets compressed_bytes to the
+// size of the stream. With direct_io the slabs are written through a DirectFileWriter, with
+// mmap_output they're compressed into a MappedOutputFile of the stream's exact size.
+bool compress_volume_checkpointed(const float *data,
+                                  const glm::uvec3 &dims,
+                                  int compression_rate,
+                                  const std::string &out_name,
+                                  const CheckpointOptions &options,
+                                  size_t &compressed_bytes);
+
+// Compress a raw volume streamed from its input in float slabs of about slab_bytes (see
+// stream_raw_volume), compressing each slab of block layers as it's converted, so only one
+// slab is held as floats. The stream matches the one compress_volume_checkpointed writes for
+// the loaded volume, but no journal is kept since the input isn't hashed up front. Returns
+// false on failure, otherwise sets compressed_bytes to the size of the stream.
+bool compress_raw_volume_streamed(const std::string &raw_file_name,
+                                  const RawVolumeInfo &info,
+                                  const NormalizeOptions &normalize,
+                                  int compression_rate,
+                                  const std::string &out_name,
+                                  const CheckpointOptions &options,
+                                  size_t &compressed_bytes);
+
+// Number of z slices compressed per slab for slabs of about options.slab_bytes of the float
+// volume, a whole number of block layers
+uint32_t checkpoint_slab_slices(const glm::uvec3 &dims, const CheckpointOptions &options);
+
+// Writes the fixed rate ZFP stream of a volume slab by slab, for compress_volume_checkpointed
+// and for volumes streamed from their input (see stream_raw_volume) that are never held in
+// full. Each slab is whole layers of blocks along z, compressed and written at its place in
+// the stream. Slabs must be written in order when writing through a DirectFileWriter.
+class SlabStreamWriter {
+    std::string out_name;
+    glm::uvec3 dims = glm::uvec3(0);
+    int compression_rate = 0;
+    CheckpointOptions options;
+    size_t layer_stream_bytes = 0;
+    size_t stream_bytes = 0;
+    std::fstream out_file;
+    DirectFileWriter direct_file;
+    MappedOutputFile mapped_file;
+    LargeVector<uint8_t> compressed;
+
+public:
+    // Open the output for the stream of a volume of the given dims. The first resume_offset
+    // bytes of an existing output were written by an earlier run and are kept, otherwise the
+    // output is truncated.
+    bool open(const std::string &out_name,
+              const glm::uvec3 &dims,
+              int compression_rate,
+              const CheckpointOptions &options,
+              size_t resume_offset = 0);
+
+    // Compress the z slices [z_begin, z_end) of the volume and write them to the stream.
+    // z_begin must start a block layer, as must z_end unless it's the end of the volume. Sets
+    // slab_bytes to the size of the slab's part of the stream
+    bool write_slab(const float *slices, uint32_t z_begin, uint32_t z_end, size_t &slab_bytes);
+
+    // Finish the stream, reporting the bandwidth of direct writes
+    bool close();
+
+    size_t stream_size() const
+    {
+        return stream_bytes;
+    }
+
+    // Upper bound on the memory held while writing slabs of slab_slices z slices, for
+    // planning memory use (see memory_plan.h)
+    static size_t buffer_bytes(const glm::uvec3 &dims,
+                               int compression_rate,
+                               uint32_t slab_slices,
+                               const CheckpointOptions &options);
+};
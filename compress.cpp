@@ -0,0 +1,161 @@
+#include "compress.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include "parallel.h"
+#include "profiler.h"
+
+int fixed_compression_rate(int compression_rate, uint32_t zfp_dims)
+{
+    zfp_stream *zfp = zfp_stream_open(nullptr);
+    const double used_compression_rate =
+        zfp_stream_set_rate(zfp, compression_rate, zfp_type_float, zfp_dims, 0);
+    zfp_stream_close(zfp);
+    if (std::floor(used_compression_rate) != used_compression_rate) {
+        std::cout << "Error: non-integer compression rate " << used_compression_rate << "\n";
+        return -1;
+    }
+    return int(used_compression_rate);
+}
+
+namespace {
+
+// Compress the volume into the buffer, returning the size of the stream or 0 on failure
+size_t compress_to_buffer(const float *data,
+                          const glm::uvec3 &dims,
+                          int compression_rate,
+                          uint8_t *buffer,
+                          size_t buffer_bytes)
+{
+    zfp_stream *zfp = zfp_stream_open(nullptr);
+    zfp_stream_set_rate(zfp, compression_rate, zfp_type_float, 3, 0);
+    zfp_field *field = zfp_field_3d(
+        const_cast<float *>(data), zfp_type_float, dims.x, dims.y, dims.z);
+
+    bitstream *stream = stream_open(buffer, buffer_bytes);
+    zfp_stream_set_bit_stream(zfp, stream);
+    zfp_stream_rewind(zfp);
+
+    const size_t total_bytes = zfp_compress(zfp, field);
+
+    zfp_field_free(field);
+    stream_close(stream);
+    zfp_stream_close(zfp);
+    return total_bytes;
+}
+
+}
+
+size_t fixed_rate_stream_bytes(const glm::uvec3 &dims, int compression_rate)
+{
+    const glm::uvec3 block_dims = (dims + glm::uvec3(3)) / glm::uvec3(4);
+    return size_t(block_dims.x) * block_dims.y * block_dims.z * size_t(compression_rate) * 8;
+}
+
+bool compress_volume(const float *data,
+                     const glm::uvec3 &dims,
+                     int compression_rate,
+                     LargeVector<uint8_t> &compressed)
+{
+    PROFILE_ZONE("compress_volume");
+    zfp_stream *zfp = zfp_stream_open(nullptr);
+    zfp_stream_set_rate(zfp, compression_rate, zfp_type_float, 3, 0);
+    zfp_field *field = zfp_field_3d(
+        const_cast<float *>(data), zfp_type_float, dims.x, dims.y, dims.z);
+    compressed.resize(zfp_stream_maximum_size(zfp, field));
+    zfp_field_free(field);
+    zfp_stream_close(zfp);
+
+    const size_t total_bytes =
+        compress_to_buffer(data, dims, compression_rate, compressed.data(), compressed.size());
+    compressed.resize(total_bytes);
+    return total_bytes != 0;
+}
+
+bool compress_volume_into(const float *data,
+                          const glm::uvec3 &dims,
+                          int compression_rate,
+                          uint8_t *out,
+                          size_t out_bytes)
+{
+    PROFILE_ZONE("compress_volume_into");
+    const size_t stream_bytes = fixed_rate_stream_bytes(dims, compression_rate);
+    if (out_bytes < stream_bytes) {
+        std::cout << "Error: output buffer of " << out_bytes << "B can't hold the "
+                  << stream_bytes << "B stream\n";
+        return false;
+    }
+    return compress_to_buffer(data, dims, compression_rate, out, stream_bytes) ==
+           stream_bytes;
+}
+
+glm::vec2 compute_volume_range(const float *data, size_t num_voxels)
+{
+    PROFILE_ZONE("compute_volume_range");
+    std::vector<glm::vec2> chunk_ranges(worker_thread_count(), glm::vec2(data[0]));
+    parallel_for(0, chunk_ranges.size(), [&](const size_t begin, const size_t end) {
+        for (size_t c = begin; c < end; ++c) {
+            size_t voxel_begin, voxel_end;
+            partition_range(0, num_voxels, c, chunk_ranges.size(), voxel_begin, voxel_end);
+            glm::vec2 range = chunk_ranges[c];
+            for (size_t i = voxel_begin; i < voxel_end; ++i) {
+                range.x = std::min(range.x, data[i]);
+                range.y = std::max(range.y, data[i]);
+            }
+            chunk_ranges[c] = range;
+        }
+    });
+    glm::vec2 range = chunk_ranges[0];
+    for (const auto &r : chunk_ranges) {
+        range.x = std::min(range.x, r.x);
+        range.y = std::max(range.y, r.y);
+    }
+    return range;
+}
+
+void encode_volume_block(zfp_stream *zfp,
+                         const float *data,
+                         const glm::uvec3 &dims,
+                         const glm::uvec3 &block)
+{
+    const glm::uvec3 origin = block * glm::uvec3(4);
+    const glm::uvec3 extent = glm::min(glm::uvec3(4), dims - origin);
+    const ptrdiff_t sy = dims.x;
+    const ptrdiff_t sz = ptrdiff_t(dims.x) * dims.y;
+    const float *p = data + origin.x + sy * origin.y + sz * origin.z;
+    if (extent == glm::uvec3(4)) {
+        zfp_encode_block_strided_float_3(zfp, p, 1, sy, sz);
+    } else {
+        zfp_encode_partial_block_strided_float_3(
+            zfp, p, extent.x, extent.y, extent.z, 1, sy, sz);
+    }
+}
+
+void trial_compress_block(zfp_stream *zfp,
+                          const float *data,
+                          const glm::uvec3 &dims,
+                          const glm::uvec3 &block,
+                          TrialError &error)
+{
+    zfp_stream_rewind(zfp);
+    encode_volume_block(zfp, data, dims, block);
+    zfp_stream_rewind(zfp);
+    float decoded[64];
+    zfp_decode_block_float_3(zfp, decoded);
+
+    const glm::uvec3 origin = block * glm::uvec3(4);
+    const glm::uvec3 extent = glm::min(glm::uvec3(4), dims - origin);
+    for (uint32_t z = 0; z < extent.z; ++z) {
+        for (uint32_t y = 0; y < extent.y; ++y) {
+            const size_t row_y = origin.y + y + size_t(dims.y) * (origin.z + z);
+            const float *row = data + origin.x + size_t(dims.x) * row_y;
+            for (uint32_t x = 0; x < extent.x; ++x) {
+                const float e = std::abs(decoded[x + 4 * (y + 4 * z)] - row[x]);
+                error.max_error = std::max(error.max_error, e);
+                error.sum_squared_error += double(e) * e;
+            }
+        }
+    }
+    error.num_values += size_t(extent.x) * extent.y * extent.z;
+}
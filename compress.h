@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <zfp.h>
+#include <glm/glm.hpp>
+#include "large_buffer.h"
+
+// Size in 64 bit words of a compressed 3D block at the highest rate, 32 bits per value
+constexpr size_t MAX_COMPRESSED_BLOCK_WORDS = 32;
+
+// Get the rate ZFP will use for a requested fixed rate on float data of the given
+// dimensionality. Returns -1 and prints an error if it is not an integer number of bits per
+// value, which BCMC requires to address blocks directly.
+int fixed_compression_rate(int compression_rate, uint32_t zfp_dims = 3);
+
+// Compress a float volume to a fixed rate ZFP stream, resizing compressed to the compressed
+// size. Returns false on failure.
+bool compress_volume(const float *data,
+                     const glm::uvec3 &dims,
+                     int compression_rate,
+                     LargeVector<uint8_t> &compressed);
+
+// Size of the fixed rate ZFP stream of a float volume, compression_rate * 64 bits per block
+size_t fixed_rate_stream_bytes(const glm::uvec3 &dims, int compression_rate);
+
+// Compress a float volume to a fixed rate ZFP stream written straight into out, e.g. a mapping
+// of the output file. out must be 8 byte aligned and hold fixed_rate_stream_bytes, no more
+// than that is written. Returns false on failure.
+bool compress_volume_into(const float *data,
+                          const glm::uvec3 &dims,
+                          int compression_rate,
+                          uint8_t *out,
+                          size_t out_bytes);
+
+// Find the min and max value of the volume with a parallel reduction
+glm::vec2 compute_volume_range(const float *data, size_t num_voxels);
+
+// Encode the ZFP block at the given block coordinates of the volume at the current position of
+// zfp's bit stream, padding blocks on the edge of the volume
+void encode_volume_block(zfp_stream *zfp,
+                         const float *data,
+                         const glm::uvec3 &dims,
+                         const glm::uvec3 &block);
+
+// The error of blocks compressed by trial_compress_block, over their voxels inside the volume
+struct TrialError {
+    float max_error = 0.f;
+    double sum_squared_error = 0.0;
+    size_t num_values = 0;
+};
+
+// Compress the block at the rate set on zfp into the start of zfp's bit stream, which must
+// have room for one block, decode it and add its error to error
+void trial_compress_block(zfp_stream *zfp,
+                          const float *data,
+                          const glm::uvec3 &dims,
+                          const glm::uvec3 &block,
+                          TrialError &error);
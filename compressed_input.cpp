@@ -0,0 +1,473 @@
+#include "compressed_input.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "large_buffer.h"
+#include "mapped_file.h"
+#include "parallel.h"
+#include "profiler.h"
+#include "string_util.h"
+
+#ifdef BCMC_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef BCMC_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+
+// Size of the slabs the decoder thread hands off to the conversion workers, and the number of
+// slab buffers in flight between them
+constexpr size_t SLAB_BYTES = size_t(64) << 20;
+constexpr size_t NUM_SLAB_BUFFERS = 3;
+
+// Streaming decoder producing the decompressed bytes of an input
+class ByteDecoder {
+public:
+    bool failed = false;
+
+    virtual ~ByteDecoder() {}
+
+    // Decode up to bytes into dst and return the number of bytes written. Fewer than the
+    // requested bytes are only returned at the end of the stream or on failure.
+    virtual size_t read(uint8_t *dst, size_t bytes) = 0;
+};
+
+#ifdef BCMC_HAVE_ZLIB
+class GzipDecoder : public ByteDecoder {
+    // zlib counts are 32 bit, so large inputs and outputs are passed through in chunks
+    static constexpr size_t MAX_CHUNK = size_t(1) << 30;
+
+    z_stream zs;
+    const uint8_t *input;
+    size_t input_size;
+    size_t input_offset = 0;
+    bool done = false;
+
+public:
+    GzipDecoder(const uint8_t *input, size_t input_size) : input(input), input_size(input_size)
+    {
+        std::memset(&zs, 0, sizeof(zs));
+        // 15 + 32: max window size and automatic gzip/zlib header detection
+        if (inflateInit2(&zs, 15 + 32) != Z_OK) {
+            failed = true;
+        }
+    }
+
+    ~GzipDecoder()
+    {
+        inflateEnd(&zs);
+    }
+
+    size_t read(uint8_t *dst, size_t bytes) override
+    {
+        size_t written = 0;
+        while (written < bytes && !done && !failed) {
+            if (zs.avail_in == 0) {
+                if (input_offset == input_size) {
+                    // Truncated stream
+                    done = true;
+                    break;
+                }
+                const size_t chunk = std::min(MAX_CHUNK, input_size - input_offset);
+                zs.next_in = const_cast<Bytef *>(input + input_offset);
+                zs.avail_in = static_cast<uInt>(chunk);
+                input_offset += chunk;
+            }
+            const size_t out_chunk = std::min(MAX_CHUNK, bytes - written);
+            zs.next_out = dst + written;
+            zs.avail_out = static_cast<uInt>(out_chunk);
+            const int ret = inflate(&zs, Z_NO_FLUSH);
+            written += out_chunk - zs.avail_out;
+            if (ret == Z_STREAM_END) {
+                // Multi-member gzip files (e.g. from pigz or cat) continue with another
+                // member. Anything else after the stream, like the zero padding of tar or
+                // block sized transfers, is ignored as gzip -d does
+                const uint8_t *rest = zs.next_in;
+                const uint8_t *end = input + input_size;
+                if (end - rest >= 2 && rest[0] == 0x1f && rest[1] == 0x8b) {
+                    inflateReset(&zs);
+                } else {
+                    if (std::find_if(rest, end, [](uint8_t b) { return b != 0; }) != end) {
+                        std::cerr << "Ignoring " << end - rest
+                                  << " bytes of trailing garbage after the gzip data\n";
+                    }
+                    done = true;
+                }
+            } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                std::cerr << "gzip decompression error: " << (zs.msg ? zs.msg : "unknown")
+                          << "\n";
+                failed = true;
+            }
+        }
+        return written;
+    }
+};
+#endif
+
+#ifdef BCMC_HAVE_ZSTD
+class ZstdDecoder : public ByteDecoder {
+    ZSTD_DCtx *dctx;
+    ZSTD_inBuffer in;
+
+public:
+    ZstdDecoder(const uint8_t *input, size_t input_size) : dctx(ZSTD_createDCtx())
+    {
+        in.src = input;
+        in.size = input_size;
+        in.pos = 0;
+    }
+
+    ~ZstdDecoder()
+    {
+        ZSTD_freeDCtx(dctx);
+    }
+
+    size_t read(uint8_t *dst, size_t bytes) override
+    {
+        ZSTD_outBuffer out = {dst, bytes, 0};
+        while (out.pos < out.size && !failed) {
+            const size_t prev_pos = out.pos;
+            const size_t ret = ZSTD_decompressStream(dctx, &out, &in);
+            if (ZSTD_isError(ret)) {
+                std::cerr << "zstd decompression error: " << ZSTD_getErrorName(ret) << "\n";
+                failed = true;
+            }
+            // Stop once the input is consumed and the decoder has no more buffered output
+            if (in.pos == in.size && out.pos == prev_pos) {
+                break;
+            }
+        }
+        return out.pos;
+    }
+};
+
+struct ZstdFrame {
+    size_t src_offset = 0;
+    size_t src_size = 0;
+    size_t dst_offset = 0;
+    size_t dst_size = 0;
+};
+
+// Find the frames in a zstd input. Returns false if the frames can't be decoded independently
+// into the output: the content size of a frame is unknown or a frame is smaller than a voxel
+bool find_zstd_frames(const uint8_t *data,
+                      size_t size,
+                      size_t voxel_size,
+                      std::vector<ZstdFrame> &frames)
+{
+    size_t src_offset = 0;
+    size_t dst_offset = 0;
+    while (src_offset < size) {
+        ZstdFrame frame;
+        frame.src_offset = src_offset;
+        frame.src_size = ZSTD_findFrameCompressedSize(data + src_offset, size - src_offset);
+        if (ZSTD_isError(frame.src_size)) {
+            return false;
+        }
+        const unsigned long long content_size =
+            ZSTD_getFrameContentSize(data + src_offset, size - src_offset);
+        if (content_size == ZSTD_CONTENTSIZE_UNKNOWN ||
+            content_size == ZSTD_CONTENTSIZE_ERROR) {
+            return false;
+        }
+        frame.dst_offset = dst_offset;
+        frame.dst_size = content_size;
+        src_offset += frame.src_size;
+        dst_offset += frame.dst_size;
+        // Skippable frames have no content
+        if (frame.dst_size == 0) {
+            continue;
+        }
+        if (frame.dst_size < voxel_size) {
+            return false;
+        }
+        frames.push_back(frame);
+    }
+    return true;
+}
+
+// Decode the frames in parallel, each worker passing the voxels fully contained in a frame to
+// fn directly from its decode buffer. Voxels straddling two frames are assembled from the
+// bytes saved by each side and passed to fn at the end.
+bool decode_zstd_frames_parallel(const uint8_t *data,
+                                 const std::vector<ZstdFrame> &frames,
+                                 const VoxelType &voxel_type,
+                                 size_t num_voxels,
+                                 const VoxelRunFn &fn)
+{
+    const size_t voxel_size = dtype_size(voxel_type.dtype);
+    const size_t total_bytes = num_voxels * voxel_size;
+    // Straddling voxel bytes for the boundary at the start of each frame
+    std::vector<uint8_t> boundary_voxels(frames.size() * voxel_size, 0);
+
+    std::atomic<size_t> next_frame(0);
+    std::atomic<bool> failed(false);
+    parallel_for(0, worker_thread_count(), [&](const size_t, const size_t) {
+        ZSTD_DCtx *dctx = ZSTD_createDCtx();
+        std::vector<uint8_t> buffer;
+        for (size_t i = next_frame++; i < frames.size() && !failed; i = next_frame++) {
+            const ZstdFrame &frame = frames[i];
+            if (frame.dst_offset >= total_bytes) {
+                continue;
+            }
+            PROFILE_ZONE("decode zstd frame");
+            buffer.resize(frame.dst_size);
+            const size_t ret = ZSTD_decompressDCtx(
+                dctx, buffer.data(), buffer.size(), data + frame.src_offset, frame.src_size);
+            if (ZSTD_isError(ret) || ret != frame.dst_size) {
+                std::cerr << "zstd decompression error in frame " << i << ": "
+                          << (ZSTD_isError(ret) ? ZSTD_getErrorName(ret) : "size mismatch")
+                          << "\n";
+                failed = true;
+                break;
+            }
+
+            const size_t frame_end = std::min(frame.dst_offset + frame.dst_size, total_bytes);
+            const size_t first_voxel = (frame.dst_offset + voxel_size - 1) / voxel_size;
+            const size_t end_voxel = frame_end / voxel_size;
+            if (end_voxel > first_voxel) {
+                fn(buffer.data() + first_voxel * voxel_size - frame.dst_offset,
+                   first_voxel,
+                   end_voxel - first_voxel,
+                   false);
+            }
+
+            // Save our part of the voxels straddling the start and end of the frame
+            const size_t head = first_voxel * voxel_size - frame.dst_offset;
+            if (head != 0) {
+                std::memcpy(boundary_voxels.data() + i * voxel_size + (voxel_size - head),
+                            buffer.data(),
+                            head);
+            }
+            const size_t tail = frame_end - end_voxel * voxel_size;
+            if (tail != 0 && i + 1 < frames.size()) {
+                std::memcpy(boundary_voxels.data() + (i + 1) * voxel_size,
+                            buffer.data() + end_voxel * voxel_size - frame.dst_offset,
+                            tail);
+            }
+        }
+        ZSTD_freeDCtx(dctx);
+    });
+    if (failed) {
+        return false;
+    }
+
+    const ZstdFrame &last = frames.back();
+    if (last.dst_offset + last.dst_size < total_bytes) {
+        std::cerr << "Compressed raw volume is too small: expected " << total_bytes
+                  << "b of voxel data but it decompressed to "
+                  << last.dst_offset + last.dst_size << "b\n";
+        return false;
+    }
+    for (size_t i = 1; i < frames.size(); ++i) {
+        const size_t voxel = frames[i].dst_offset / voxel_size;
+        if (frames[i].dst_offset % voxel_size != 0 && voxel < num_voxels) {
+            fn(boundary_voxels.data() + i * voxel_size, voxel, 1, false);
+        }
+    }
+    return true;
+}
+#endif
+
+#if defined(BCMC_HAVE_ZLIB) || defined(BCMC_HAVE_ZSTD)
+// Run the decoder on its own thread, filling a ring of slab buffers which are passed to fn as
+// they complete
+bool stream_slabs(ByteDecoder &decoder,
+                  const VoxelType &voxel_type,
+                  size_t num_voxels,
+                  const VoxelRunFn &fn)
+{
+    const size_t voxel_size = dtype_size(voxel_type.dtype);
+    const size_t slab_voxels = std::max(SLAB_BYTES / voxel_size, size_t(1));
+
+    struct Slab {
+        LargeVector<uint8_t> data;
+        size_t voxel_offset = 0;
+        size_t bytes = 0;
+    };
+    std::vector<Slab> slabs(NUM_SLAB_BUFFERS);
+    std::deque<size_t> free_slabs;
+    std::deque<size_t> filled_slabs;
+    for (size_t i = 0; i < slabs.size(); ++i) {
+        slabs[i].data.resize(std::min(slab_voxels, num_voxels) * voxel_size);
+        free_slabs.push_back(i);
+    }
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool decode_done = false;
+
+    std::thread decode_thread([&]() {
+        profiler_set_thread_name("decoder");
+        for (size_t offset = 0; offset < num_voxels;) {
+            size_t slab_id = 0;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&]() { return !free_slabs.empty(); });
+                slab_id = free_slabs.front();
+                free_slabs.pop_front();
+            }
+            Slab &slab = slabs[slab_id];
+            const size_t expected = std::min(slab_voxels, num_voxels - offset) * voxel_size;
+            slab.voxel_offset = offset;
+            {
+                PROFILE_ZONE("decode slab");
+                slab.bytes = decoder.read(slab.data.data(), expected);
+            }
+            offset += slab.bytes / voxel_size;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                filled_slabs.push_back(slab_id);
+            }
+            cv.notify_all();
+            if (slab.bytes != expected) {
+                break;
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            decode_done = true;
+        }
+        cv.notify_all();
+    });
+
+    size_t voxels_decoded = 0;
+    while (true) {
+        size_t slab_id = 0;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&]() { return !filled_slabs.empty() || decode_done; });
+            if (filled_slabs.empty()) {
+                break;
+            }
+            slab_id = filled_slabs.front();
+            filled_slabs.pop_front();
+        }
+        Slab &slab = slabs[slab_id];
+        const size_t n = slab.bytes / voxel_size;
+        {
+            PROFILE_ZONE("process slab");
+            fn(slab.data.data(), slab.voxel_offset, n, true);
+        }
+        voxels_decoded += n;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            free_slabs.push_back(slab_id);
+        }
+        cv.notify_all();
+    }
+    decode_thread.join();
+
+    if (decoder.failed) {
+        return false;
+    }
+    if (voxels_decoded != num_voxels) {
+        std::cerr << "Compressed raw volume is too small: expected " << num_voxels
+                  << " voxels but it decompressed to " << voxels_decoded << " voxels\n";
+        return false;
+    }
+    return true;
+}
+#endif
+
+}
+
+InputCompression detect_input_compression(const std::string &file_name)
+{
+    if (ends_with(file_name, ".gz")) {
+        return InputCompression::GZIP;
+    }
+    if (ends_with(file_name, ".zst")) {
+        return InputCompression::ZSTD;
+    }
+    return InputCompression::NONE;
+}
+
+const char *input_compression_name(InputCompression compression)
+{
+    switch (compression) {
+    case InputCompression::GZIP:
+        return "gzip";
+    case InputCompression::ZSTD:
+        return "zstd";
+    default:
+        break;
+    }
+    return "none";
+}
+
+size_t compressed_input_buffer_bytes(InputCompression compression,
+                                     size_t raw_bytes,
+                                     size_t num_threads)
+{
+    if (compression == InputCompression::NONE) {
+        return 0;
+    }
+    const size_t slab_bytes = std::min(SLAB_BYTES, raw_bytes);
+    size_t bytes = NUM_SLAB_BUFFERS * slab_bytes;
+    if (compression == InputCompression::ZSTD) {
+        // Frame parallel decoding gives each worker a buffer for its frame
+        bytes += num_threads * slab_bytes;
+    }
+    return bytes;
+}
+
+bool decode_compressed_raw_volume(const std::string &file_name,
+                                  InputCompression compression,
+                                  const VoxelType &voxel_type,
+                                  size_t num_voxels,
+                                  const VoxelRunFn &fn,
+                                  bool in_order,
+                                  size_t data_offset)
+{
+    MappedFile file;
+    if (!file.open(file_name)) {
+        return false;
+    }
+    if (data_offset > file.size()) {
+        std::cerr << "Input " << file_name << " is too small, its data starts at offset "
+                  << data_offset << "\n";
+        return false;
+    }
+    file.will_need(data_offset, file.size() - data_offset);
+
+    if (compression == InputCompression::GZIP) {
+#ifdef BCMC_HAVE_ZLIB
+        GzipDecoder decoder(file.data() + data_offset, file.size() - data_offset);
+        return stream_slabs(decoder, voxel_type, num_voxels, fn);
+#else
+        std::cerr << "gzip compressed inputs are not supported, rebuild with zlib\n";
+        return false;
+#endif
+    }
+    if (compression == InputCompression::ZSTD) {
+#ifdef BCMC_HAVE_ZSTD
+        const uint8_t *data = file.data() + data_offset;
+        const size_t size = file.size() - data_offset;
+        std::vector<ZstdFrame> frames;
+        if (!in_order && find_zstd_frames(data, size, dtype_size(voxel_type.dtype), frames) &&
+            frames.size() > 1) {
+            std::cout << "Decoding " << frames.size() << " zstd frames in parallel\n";
+            return decode_zstd_frames_parallel(data, frames, voxel_type, num_voxels, fn);
+        }
+        ZstdDecoder decoder(data, size);
+        return stream_slabs(decoder, voxel_type, num_voxels, fn);
+#else
+        (void)voxel_type;
+        (void)num_voxels;
+        (void)fn;
+        (void)in_order;
+        std::cerr << "zstd compressed inputs are not supported, rebuild with zstd\n";
+        return false;
+#endif
+    }
+    std::cerr << "Input " << file_name << " is not compressed\n";
+    return false;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include "dtype.h"
+
+enum class InputCompression { NONE, GZIP, ZSTD };
+
+// Detect gzip (.gz) or zstd (.zst) compressed inputs from the file extension
+InputCompression detect_input_compression(const std::string &file_name);
+
+const char *input_compression_name(InputCompression compression);
+
+// Upper bound on the memory held by the decoder of a compressed input of raw_bytes bytes once
+// decompressed, with num_threads worker threads, for planning memory use (see memory_plan.h).
+// Assumes the frames of zstd inputs are no larger than the decoder's slabs
+size_t compressed_input_buffer_bytes(InputCompression compression,
+                                     size_t raw_bytes,
+                                     size_t num_threads);
+
+// Called with runs of whole voxels decoded from a compressed input, starting at first_voxel.
+// When parallel is true this is the only call running and the callback may split the work
+// across the worker threads, otherwise it is being called concurrently from the workers.
+using VoxelRunFn =
+    std::function<void(const uint8_t *voxels, size_t first_voxel, size_t n, bool parallel)>;
+
+// Decompress the first num_voxels of a gzip or zstd compressed raw volume, passing the decoded
+// voxels to fn. The input is decoded in slabs which are handed to fn while the next slab is
+// decompressed. Zstd inputs made of multiple frames with known sizes are decoded
+// frame-parallel instead, unless in_order is set, which guarantees fn sees the runs in order
+// with parallel true. The compressed data starts data_offset bytes into the file, e.g. after
+// a volume header.
+bool decode_compressed_raw_volume(const std::string &file_name,
+                                  InputCompression compression,
+                                  const VoxelType &voxel_type,
+                                  size_t num_voxels,
+                                  const VoxelRunFn &fn,
+                                  bool in_order = false,
+                                  size_t data_offset = 0);
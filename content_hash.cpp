@@ -0,0 +1,42 @@
+#include "content_hash.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include "parallel.h"
+#include "profiler.h"
+
+namespace {
+
+constexpr size_t HASH_CHUNK_BYTES = size_t(16) << 20;
+
+}
+
+uint64_t fnv1a(const uint8_t *data, size_t size, uint64_t hash)
+{
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ull;
+    }
+    for (; i < size; ++i) {
+        hash = (hash ^ data[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+uint64_t parallel_content_hash(const uint8_t *data, size_t size)
+{
+    PROFILE_ZONE("parallel_content_hash");
+    const size_t num_chunks = (size + HASH_CHUNK_BYTES - 1) / HASH_CHUNK_BYTES;
+    std::vector<uint64_t> chunk_hashes(num_chunks);
+    parallel_for(0, num_chunks, [&](const size_t begin, const size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const size_t offset = i * HASH_CHUNK_BYTES;
+            chunk_hashes[i] = fnv1a(data + offset, std::min(HASH_CHUNK_BYTES, size - offset));
+        }
+    });
+    return fnv1a(reinterpret_cast<const uint8_t *>(chunk_hashes.data()),
+                 chunk_hashes.size() * sizeof(uint64_t),
+                 size);
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+constexpr uint64_t FNV1A_OFFSET_BASIS = 0xcbf29ce484222325ull;
+
+// FNV-1a hash of the data, 8 bytes at a time. This only needs to detect changed files, not
+// resist attacks
+uint64_t fnv1a(const uint8_t *data, size_t size, uint64_t hash = FNV1A_OFFSET_BASIS);
+
+// Hash the data in fixed size chunks across the worker threads, then hash the chunk hashes
+// seeded with the size. The result is independent of the thread count
+uint64_t parallel_content_hash(const uint8_t *data, size_t size);
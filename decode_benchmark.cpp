@@ -0,0 +1,172 @@
+#include "decode_benchmark.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <glm/gtx/string_cast.hpp>
+#include "block_decoder.h"
+#include "mapped_file.h"
+#include "parallel.h"
+#include "profiler.h"
+
+namespace {
+
+// Find the blocks whose decoded value range contains the isovalue, i.e. the blocks BCMC
+// would mark active
+std::vector<size_t> select_active_blocks(const MappedFile &file,
+                                         const CompressedVolumeInfo &info,
+                                         float isovalue)
+{
+    PROFILE_ZONE("select active blocks");
+    std::vector<uint8_t> active(info.num_blocks(), 0);
+    parallel_for(0, info.num_blocks(), [&](const size_t begin, const size_t end) {
+        BlockDecoder decoder(file.data(), file.size(), info.rate);
+        float block[ZFP_BLOCK_VOXELS];
+        for (size_t i = begin; i < end; ++i) {
+            decoder.decode(i, block);
+            const auto range = std::minmax_element(block, block + ZFP_BLOCK_VOXELS);
+            active[i] = *range.first <= isovalue && isovalue <= *range.second;
+        }
+    });
+    std::vector<size_t> blocks;
+    for (size_t i = 0; i < active.size(); ++i) {
+        if (active[i]) {
+            blocks.push_back(i);
+        }
+    }
+    return blocks;
+}
+
+// Pick a random subset of the blocks, with a fixed seed so runs are comparable
+std::vector<size_t> select_random_blocks(const CompressedVolumeInfo &info, double fraction)
+{
+    std::vector<size_t> blocks(info.num_blocks());
+    std::iota(blocks.begin(), blocks.end(), size_t(0));
+    std::mt19937_64 rng(0x42434d43);
+    std::shuffle(blocks.begin(), blocks.end(), rng);
+    const double clamped = std::min(std::max(fraction, 0.0), 1.0);
+    blocks.resize(std::max(size_t(1), size_t(std::ceil(clamped * blocks.size()))));
+    // BCMC decodes the compacted list of blocks it needs in block order
+    std::sort(blocks.begin(), blocks.end());
+    return blocks;
+}
+
+// Decode the blocks across the worker threads, returning the time taken in seconds
+double decode_blocks(const MappedFile &file,
+                     const CompressedVolumeInfo &info,
+                     const std::vector<size_t> &blocks,
+                     double &checksum)
+{
+    PROFILE_ZONE("decode blocks");
+    using namespace std::chrono;
+    std::mutex checksum_mutex;
+    checksum = 0.0;
+    auto start = steady_clock::now();
+    parallel_for(0, blocks.size(), [&](const size_t begin, const size_t end) {
+        BlockDecoder decoder(file.data(), file.size(), info.rate);
+        float block[ZFP_BLOCK_VOXELS];
+        // Accumulate a checksum so the decoding can't be optimized away
+        double sum = 0.0;
+        for (size_t i = begin; i < end; ++i) {
+            decoder.decode(blocks[i], block);
+            sum += block[0];
+        }
+        std::lock_guard<std::mutex> lock(checksum_mutex);
+        checksum += sum;
+    });
+    auto end = steady_clock::now();
+    return duration_cast<duration<double>>(end - start).count();
+}
+
+bool benchmark_file(const std::string &file_name, const DecodeBenchmarkOptions &options)
+{
+    CompressedVolumeInfo info;
+    if (!parse_compressed_volume_name(file_name, info)) {
+        if (options.dims == glm::uvec3(0) || options.rate <= 0) {
+            std::cerr << "Could not find the dimensions and rate of " << file_name
+                      << " from its name, expected '<name>_<X>x<Y>x<Z>_<data "
+                         "type>.raw.crate<N>.zfp'. Pass -dims and -crate instead\n";
+            return false;
+        }
+    }
+    if (options.dims != glm::uvec3(0)) {
+        info.dims = options.dims;
+    }
+    if (options.rate > 0) {
+        info.rate = options.rate;
+    }
+
+    MappedFile file;
+    if (!file.open(file_name)) {
+        return false;
+    }
+    if (file.size() < info.stream_bytes()) {
+        std::cerr << "Stream " << file_name << " is too small: expected "
+                  << info.stream_bytes() << "b for a " << glm::to_string(info.dims)
+                  << " volume at rate " << info.rate << " but the file is " << file.size()
+                  << "b\n";
+        return false;
+    }
+    file.will_need(0, file.size());
+
+    const std::vector<size_t> blocks = options.use_isovalue
+                                           ? select_active_blocks(file, info, options.isovalue)
+                                           : select_random_blocks(info, options.fraction);
+    std::cout << file_name << ": " << glm::to_string(info.dims) << ", rate " << info.rate
+              << ", decoding " << blocks.size() << "/" << info.num_blocks() << " blocks";
+    if (options.use_isovalue) {
+        std::cout << " active at isovalue " << options.isovalue;
+    }
+    std::cout << "\n";
+    if (blocks.empty()) {
+        return true;
+    }
+
+    // Sweep powers of two up to the worker thread count
+    const size_t max_threads = worker_thread_count();
+    std::vector<size_t> thread_counts;
+    for (size_t n = 1; n < max_threads; n *= 2) {
+        thread_counts.push_back(n);
+    }
+    thread_counts.push_back(max_threads);
+
+    const double decoded_bytes = double(blocks.size()) * ZFP_BLOCK_VOXELS * sizeof(float);
+    const double compressed_bytes = double(blocks.size()) * info.rate * ZFP_BLOCK_VOXELS / 8;
+    for (const size_t threads : thread_counts) {
+        set_worker_thread_count(threads);
+        double checksum = 0.0;
+        double best = decode_blocks(file, info, blocks, checksum);
+        for (size_t i = 1; i < options.iterations; ++i) {
+            best = std::min(best, decode_blocks(file, info, blocks, checksum));
+        }
+        std::cout << "  rate " << info.rate << ", " << std::setw(3) << threads
+                  << " threads: " << std::fixed << std::setprecision(3) << best * 1000.0
+                  << "ms, " << std::setprecision(2) << blocks.size() / best / 1e6
+                  << "M blocks/s, " << decoded_bytes / best / 1e9 << " GB/s decoded, "
+                  << compressed_bytes / best / 1e9 << " GB/s compressed (checksum "
+                  << std::defaultfloat << std::setprecision(6) << checksum << ")\n";
+    }
+    set_worker_thread_count(max_threads);
+    return true;
+}
+
+}
+
+bool run_decode_benchmark(const std::vector<std::string> &zfp_files,
+                          const DecodeBenchmarkOptions &options)
+{
+    if (zfp_files.empty()) {
+        std::cerr << "No .zfp files given to benchmark\n";
+        return false;
+    }
+    for (const auto &f : zfp_files) {
+        if (!benchmark_file(f, options)) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+struct DecodeBenchmarkOptions {
+    // Fraction of the blocks to decode, picked at random
+    double fraction = 0.1;
+    // Decode the blocks whose value range contains the isovalue instead of a random subset
+    bool use_isovalue = false;
+    float isovalue = 0.f;
+    // Timed runs per thread count, the fastest is reported
+    size_t iterations = 5;
+    // Dimensions and rate for streams whose file name doesn't follow the output naming
+    glm::uvec3 dims = glm::uvec3(0);
+    int rate = -1;
+};
+
+// Benchmark decoding subsets of blocks from fixed rate .zfp streams the way BCMC accesses
+// them, seeking to each block instead of decompressing the whole stream. The blocks are
+// decoded at increasing thread counts up to the worker thread count and the throughput of
+// each stream is reported in blocks/s and GB/s.
+bool run_decode_benchmark(const std::vector<std::string> &zfp_files,
+                          const DecodeBenchmarkOptions &options);
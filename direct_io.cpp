@@ -0,0 +1,190 @@
+#include "direct_io.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include "profiler.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define BCMC_HAVE_POSIX_IO 1
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+size_t align_down(size_t x)
+{
+    return x / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+}
+
+size_t align_up(size_t x)
+{
+    return align_down(x + DIRECT_IO_ALIGNMENT - 1);
+}
+
+}
+
+int open_direct(const std::string &file_name, int flags, bool &direct)
+{
+#ifdef BCMC_HAVE_POSIX_IO
+    direct = false;
+    int fd = -1;
+#ifdef O_DIRECT
+    fd = ::open(file_name.c_str(), flags | O_DIRECT, 0644);
+    if (fd >= 0) {
+        direct = true;
+        return fd;
+    }
+    if (errno != EINVAL) {
+        std::cerr << "Failed to open " << file_name << ": " << std::strerror(errno) << "\n";
+        return -1;
+    }
+    std::cout << file_name << " doesn't support O_DIRECT, using buffered I/O and dropping "
+              << "its cached pages instead\n";
+#endif
+    fd = ::open(file_name.c_str(), flags, 0644);
+    if (fd < 0) {
+        std::cerr << "Failed to open " << file_name << ": " << std::strerror(errno) << "\n";
+        return -1;
+    }
+#if !defined(O_DIRECT) && defined(F_NOCACHE)
+    direct = fcntl(fd, F_NOCACHE, 1) == 0;
+#endif
+    return fd;
+#else
+    std::cerr << "Direct I/O is not supported on this platform\n";
+    direct = false;
+    return -1;
+#endif
+}
+
+void drop_cached_pages(int fd, size_t offset, size_t bytes)
+{
+#if defined(BCMC_HAVE_POSIX_IO) && defined(POSIX_FADV_DONTNEED)
+    // Dirty pages can't be dropped until they're written back
+    fdatasync(fd);
+    posix_fadvise(fd, offset, bytes, POSIX_FADV_DONTNEED);
+#endif
+}
+
+DirectFileWriter::~DirectFileWriter()
+{
+    close();
+}
+
+bool DirectFileWriter::open(const std::string &name, size_t offset, bool truncate)
+{
+    close();
+#ifdef BCMC_HAVE_POSIX_IO
+    file_name = name;
+    fd = open_direct(name, O_RDWR | O_CREAT | (truncate ? O_TRUNC : 0), direct);
+    if (fd < 0) {
+        return false;
+    }
+    if (storage.empty()) {
+        storage.resize(DIRECT_IO_STAGING_BYTES + DIRECT_IO_ALIGNMENT);
+        const uintptr_t address = reinterpret_cast<uintptr_t>(storage.data());
+        staging = storage.data() + (align_up(address) - address);
+    }
+    staging_offset = align_down(offset);
+    staged = offset - staging_offset;
+    bytes_written = 0;
+    write_ms = 0.0;
+    if (staged > 0) {
+        const ssize_t n = pread(fd, staging, DIRECT_IO_ALIGNMENT, staging_offset);
+        if (n < ssize_t(staged)) {
+            std::cerr << "Failed to read back the page before offset " << offset << " of "
+                      << name << "\n";
+            // Closed directly, as close would write out and truncate to the partial page
+            staged = 0;
+            ::close(fd);
+            fd = -1;
+            return false;
+        }
+    }
+    return true;
+#else
+    std::cerr << "Direct I/O is not supported on this platform\n";
+    return false;
+#endif
+}
+
+bool DirectFileWriter::write_staged(size_t bytes)
+{
+#ifdef BCMC_HAVE_POSIX_IO
+    PROFILE_ZONE("direct write");
+    using namespace std::chrono;
+    auto start = steady_clock::now();
+    size_t written = 0;
+    while (written < bytes) {
+        const ssize_t n =
+            pwrite(fd, staging + written, bytes - written, staging_offset + written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            std::cerr << "Failed to write " << file_name << ": " << std::strerror(errno)
+                      << "\n";
+            return false;
+        }
+        written += n;
+    }
+    if (!direct) {
+        drop_cached_pages(fd, staging_offset, bytes);
+    }
+    write_ms += duration_cast<microseconds>(steady_clock::now() - start).count() / 1000.0;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool DirectFileWriter::write(const uint8_t *data, size_t bytes)
+{
+    bytes_written += bytes;
+    while (bytes > 0) {
+        const size_t take = std::min(bytes, DIRECT_IO_STAGING_BYTES - staged);
+        std::memcpy(staging + staged, data, take);
+        staged += take;
+        data += take;
+        bytes -= take;
+        // Write the whole pages and move the partial one left over to the front
+        const size_t whole = align_down(staged);
+        if (whole == 0) {
+            continue;
+        }
+        if (!write_staged(whole)) {
+            return false;
+        }
+        std::memmove(staging, staging + whole, staged - whole);
+        staging_offset += whole;
+        staged -= whole;
+    }
+    return true;
+}
+
+bool DirectFileWriter::flush()
+{
+    if (staged == 0) {
+        return true;
+    }
+    // The partial page is written padded with zeros, and written again once it's filled
+    std::memset(staging + staged, 0, align_up(staged) - staged);
+    return write_staged(align_up(staged));
+}
+
+bool DirectFileWriter::close()
+{
+    if (fd < 0) {
+        return true;
+    }
+    bool success = flush();
+#ifdef BCMC_HAVE_POSIX_IO
+    success = success && ftruncate(fd, staging_offset + staged) == 0;
+    ::close(fd);
+#endif
+    fd = -1;
+    return success;
+}
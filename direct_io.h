@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "large_buffer.h"
+
+// Offsets, lengths and buffers of direct I/O must be aligned to the logical block size of the
+// device, 4096 covers the drives we run on
+constexpr size_t DIRECT_IO_ALIGNMENT = 4096;
+
+// Size of the DirectFileWriter staging buffer, writes larger than this are written out in
+// pieces
+constexpr size_t DIRECT_IO_STAGING_BYTES = size_t(64) << 20;
+
+// Open a file bypassing the page cache, with O_DIRECT (or F_NOCACHE on macOS). If the file
+// system doesn't support it, e.g. tmpfs, the file is opened buffered and direct is set to
+// false, callers then drop the pages they've touched with drop_cached_pages. Returns -1 on
+// failure.
+int open_direct(const std::string &file_name, int flags, bool &direct);
+
+// Write back and evict the cached pages of a byte range of a buffered file, so a file read or
+// written without O_DIRECT still doesn't keep filling the page cache
+void drop_cached_pages(int fd, size_t offset, size_t bytes);
+
+// Sequential writer bypassing the page cache. Data is staged in an aligned buffer and written
+// in whole aligned pages, with the unaligned tail kept back for the next write. flush writes
+// the tail padded to a whole page so everything written so far is on disk, and close trims the
+// padding off the end of the file.
+class DirectFileWriter {
+    std::string file_name;
+    int fd = -1;
+    bool direct = false;
+    LargeVector<uint8_t> storage;
+    uint8_t *staging = nullptr;
+    // File offset of the start of the staging buffer, which is always aligned, and the bytes
+    // staged from there
+    size_t staging_offset = 0;
+    size_t staged = 0;
+    size_t bytes_written = 0;
+    double write_ms = 0.0;
+
+    bool write_staged(size_t bytes);
+
+public:
+    DirectFileWriter() = default;
+    ~DirectFileWriter();
+
+    DirectFileWriter(const DirectFileWriter &) = delete;
+    DirectFileWriter &operator=(const DirectFileWriter &) = delete;
+
+    // Open the file for writing from offset, truncating it if requested. When appending at an
+    // unaligned offset the partial page before it is read back so it's rewritten intact
+    bool open(const std::string &file_name, size_t offset, bool truncate);
+
+    bool write(const uint8_t *data, size_t bytes);
+
+    bool flush();
+
+    bool close();
+
+    bool is_direct() const
+    {
+        return direct;
+    }
+
+    // Bytes passed to write and the time spent writing them out, for reporting bandwidth
+    size_t total_bytes() const
+    {
+        return bytes_written;
+    }
+
+    double total_write_ms() const
+    {
+        return write_ms;
+    }
+};
@@ -0,0 +1,440 @@
+#include "dtype.h"
+#include <cstring>
+#include <mutex>
+#include <type_traits>
+#include "parallel.h"
+#include "profiler.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define BCMC_X86_SIMD 1
+#include <immintrin.h>
+#define BCMC_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace {
+
+template <DType D>
+struct DTypeTraits;
+
+template <>
+struct DTypeTraits<DType::UINT8> {
+    using type = uint8_t;
+};
+template <>
+struct DTypeTraits<DType::INT8> {
+    using type = int8_t;
+};
+template <>
+struct DTypeTraits<DType::UINT16> {
+    using type = uint16_t;
+};
+template <>
+struct DTypeTraits<DType::INT16> {
+    using type = int16_t;
+};
+template <>
+struct DTypeTraits<DType::UINT32> {
+    using type = uint32_t;
+};
+template <>
+struct DTypeTraits<DType::INT32> {
+    using type = int32_t;
+};
+template <>
+struct DTypeTraits<DType::FLOAT32> {
+    using type = float;
+};
+template <>
+struct DTypeTraits<DType::FLOAT64> {
+    using type = double;
+};
+
+template <typename T, bool SWAP>
+inline T load_scalar(const uint8_t *p)
+{
+    uint8_t bytes[sizeof(T)];
+    if (SWAP) {
+        for (size_t i = 0; i < sizeof(T); ++i) {
+            bytes[i] = p[sizeof(T) - 1 - i];
+        }
+    } else {
+        std::memcpy(bytes, p, sizeof(T));
+    }
+    T v;
+    std::memcpy(&v, bytes, sizeof(T));
+    return v;
+}
+
+template <bool NORMALIZE>
+inline float normalize_value(float v, float scale, float offset)
+{
+    if (NORMALIZE) {
+        // std::max returns its first argument for NaN, so NaN maps to 0 as in the AVX2 clamp
+        return std::min(std::max(0.f, v * scale + offset), 1.f);
+    }
+    return v;
+}
+
+template <DType D, bool SWAP, bool NORMALIZE>
+void convert_scalar(const uint8_t *src, float *dst, size_t n, float scale, float offset)
+{
+    using T = typename DTypeTraits<D>::type;
+    for (size_t i = 0; i < n; ++i) {
+        const float v = static_cast<float>(load_scalar<T, SWAP>(src + i * sizeof(T)));
+        dst[i] = normalize_value<NORMALIZE>(v, scale, offset);
+    }
+}
+
+template <DType D, bool SWAP>
+ValueRange range_scalar(const uint8_t *src, size_t n)
+{
+    using T = typename DTypeTraits<D>::type;
+    ValueRange range;
+    for (size_t i = 0; i < n; ++i) {
+        const float v = static_cast<float>(load_scalar<T, SWAP>(src + i * sizeof(T)));
+        // Written so NaNs compare false and are skipped
+        if (v < range.min) {
+            range.min = v;
+        }
+        if (v > range.max) {
+            range.max = v;
+        }
+    }
+    return range;
+}
+
+#ifdef BCMC_X86_SIMD
+
+template <DType D>
+struct DTypeTag {
+};
+
+// Shuffle mask reversing the bytes of each element of the given size, applied within each
+// 128 bit lane
+template <size_t ELEM_SIZE>
+BCMC_TARGET_AVX2 inline __m256i byte_swap_mask()
+{
+    alignas(32) int8_t mask[32];
+    for (int i = 0; i < 32; ++i) {
+        const int elem_start = (i / int(ELEM_SIZE)) * int(ELEM_SIZE);
+        mask[i] = int8_t((elem_start + int(ELEM_SIZE) - 1 - (i - elem_start)) % 16);
+    }
+    return _mm256_load_si256(reinterpret_cast<const __m256i *>(mask));
+}
+
+// Each load8 reads 8 voxels starting at p, byte swapping them in register if needed, and
+// widens or narrows them to 8 floats
+template <bool SWAP>
+BCMC_TARGET_AVX2 inline __m256 load8(DTypeTag<DType::UINT8>, const uint8_t *p, __m256i)
+{
+    const __m128i x = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p));
+    return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(x));
+}
+
+template <bool SWAP>
+BCMC_TARGET_AVX2 inline __m256 load8(DTypeTag<DType::INT8>, const uint8_t *p, __m256i)
+{
+    const __m128i x = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p));
+    return _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(x));
+}
+
+template <bool SWAP>
+BCMC_TARGET_AVX2 inline __m128i load16_bytes(const uint8_t *p, __m256i mask)
+{
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    if (SWAP) {
+        x = _mm_shuffle_epi8(x, _mm256_castsi256_si128(mask));
+    }
+    return x;
+}
+
+template <bool SWAP>
+BCMC_TARGET_AVX2 inline __m256i load32_bytes(const uint8_t *p, __m256i mask)
+{
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    if (SWAP) {
+        x = _mm256_shuffle_epi8(x, mask);
+    }
+    return x;
+}
+
+template <bool SWAP>
+BCMC_TARGET_AVX2 inline __m256 load8(DTypeTag<DType::UINT16>, const uint8_t *p, __m256i mask)
+{
+    return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(load16_bytes<SWAP>(p, mask)));
+}
+
+template <bool SWAP>
+BCMC_TARGET_AVX2 inline __m256 load8(DTypeTag<DType::INT16>, const uint8_t *p, __m256i mask)
+{
+    return _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(load16_bytes<SWAP>(p, mask)));
+}
+
+template <bool SWAP>
+BCMC_TARGET_AVX2 inline __m256 load8(DTypeTag<DType::UINT32>, const uint8_t *p, __m256i mask)
+{
+    // AVX2 only has a signed int -> float conversion, so convert the high and low 16 bits
+    // separately. Both halves and hi * 2^16 are exact, leaving a single rounding in the add
+    const __m256i x = load32_bytes<SWAP>(p, mask);
+    const __m256 hi = _mm256_cvtepi32_ps(_mm256_srli_epi32(x, 16));
+    const __m256 lo = _mm256_cvtepi32_ps(_mm256_and_si256(x, _mm256_set1_epi32(0xffff)));
+    return _mm256_add_ps(_mm256_mul_ps(hi, _mm256_set1_ps(65536.f)), lo);
+}
+
+template <bool SWAP>
+BCMC_TARGET_AVX2 inline __m256 load8(DTypeTag<DType::INT32>, const uint8_t *p, __m256i mask)
+{
+    return _mm256_cvtepi32_ps(load32_bytes<SWAP>(p, mask));
+}
+
+template <bool SWAP>
+BCMC_TARGET_AVX2 inline __m256 load8(DTypeTag<DType::FLOAT32>, const uint8_t *p, __m256i mask)
+{
+    return _mm256_castsi256_ps(load32_bytes<SWAP>(p, mask));
+}
+
+template <bool SWAP>
+BCMC_TARGET_AVX2 inline __m256 load8(DTypeTag<DType::FLOAT64>, const uint8_t *p, __m256i mask)
+{
+    const __m128 lo = _mm256_cvtpd_ps(_mm256_castsi256_pd(load32_bytes<SWAP>(p, mask)));
+    const __m128 hi = _mm256_cvtpd_ps(_mm256_castsi256_pd(load32_bytes<SWAP>(p + 32, mask)));
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+}
+
+template <DType D, bool SWAP, bool NORMALIZE>
+BCMC_TARGET_AVX2 void convert_avx2(
+    const uint8_t *src, float *dst, size_t n, float scale, float offset)
+{
+    using T = typename DTypeTraits<D>::type;
+    const __m256i mask = byte_swap_mask<sizeof(T)>();
+    const __m256 vscale = _mm256_set1_ps(scale);
+    const __m256 voffset = _mm256_set1_ps(offset);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = load8<SWAP>(DTypeTag<D>(), src + i * sizeof(T), mask);
+        if (NORMALIZE) {
+            v = _mm256_add_ps(_mm256_mul_ps(v, vscale), voffset);
+            v = _mm256_min_ps(_mm256_max_ps(v, zero), one);
+        }
+        _mm256_storeu_ps(dst + i, v);
+    }
+    convert_scalar<D, SWAP, NORMALIZE>(src + i * sizeof(T), dst + i, n - i, scale, offset);
+}
+
+template <DType D, bool SWAP>
+BCMC_TARGET_AVX2 ValueRange range_avx2(const uint8_t *src, size_t n)
+{
+    using T = typename DTypeTraits<D>::type;
+    const __m256i mask = byte_swap_mask<sizeof(T)>();
+    __m256 vmin = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+    __m256 vmax = _mm256_set1_ps(-std::numeric_limits<float>::infinity());
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256 v = load8<SWAP>(DTypeTag<D>(), src + i * sizeof(T), mask);
+        // min/max return the second operand if either is NaN, so NaNs in v are skipped
+        vmin = _mm256_min_ps(v, vmin);
+        vmax = _mm256_max_ps(v, vmax);
+    }
+    alignas(32) float mins[8];
+    alignas(32) float maxs[8];
+    _mm256_store_ps(mins, vmin);
+    _mm256_store_ps(maxs, vmax);
+    ValueRange range = range_scalar<D, SWAP>(src + i * sizeof(T), n - i);
+    for (size_t j = 0; j < 8; ++j) {
+        range.min = std::min(range.min, mins[j]);
+        range.max = std::max(range.max, maxs[j]);
+    }
+    return range;
+}
+
+bool cpu_has_avx2()
+{
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    return has_avx2;
+}
+
+#endif
+
+using ConvertFn = void (*)(const uint8_t *, float *, size_t, float, float);
+using RangeFn = ValueRange (*)(const uint8_t *, size_t);
+
+struct Kernels {
+    ConvertFn convert = nullptr;
+    RangeFn range = nullptr;
+};
+
+template <DType D, bool SWAP>
+Kernels select_kernels(bool normalize)
+{
+    Kernels kernels;
+#ifdef BCMC_X86_SIMD
+    if (cpu_has_avx2()) {
+        kernels.convert =
+            normalize ? &convert_avx2<D, SWAP, true> : &convert_avx2<D, SWAP, false>;
+        kernels.range = &range_avx2<D, SWAP>;
+        return kernels;
+    }
+#endif
+    kernels.convert =
+        normalize ? &convert_scalar<D, SWAP, true> : &convert_scalar<D, SWAP, false>;
+    kernels.range = &range_scalar<D, SWAP>;
+    return kernels;
+}
+
+template <DType D>
+Kernels select_kernels(bool swap, bool normalize)
+{
+    // Single byte types have nothing to swap
+    if (swap && dtype_size(D) > 1) {
+        return select_kernels<D, true>(normalize);
+    }
+    return select_kernels<D, false>(normalize);
+}
+
+Kernels select_kernels(const VoxelType &type, bool normalize)
+{
+    switch (type.dtype) {
+    case DType::UINT8:
+        return select_kernels<DType::UINT8>(type.big_endian, normalize);
+    case DType::INT8:
+        return select_kernels<DType::INT8>(type.big_endian, normalize);
+    case DType::UINT16:
+        return select_kernels<DType::UINT16>(type.big_endian, normalize);
+    case DType::INT16:
+        return select_kernels<DType::INT16>(type.big_endian, normalize);
+    case DType::UINT32:
+        return select_kernels<DType::UINT32>(type.big_endian, normalize);
+    case DType::INT32:
+        return select_kernels<DType::INT32>(type.big_endian, normalize);
+    case DType::FLOAT32:
+        return select_kernels<DType::FLOAT32>(type.big_endian, normalize);
+    case DType::FLOAT64:
+        return select_kernels<DType::FLOAT64>(type.big_endian, normalize);
+    }
+    return Kernels();
+}
+
+const char *DTYPE_NAMES[] = {
+    "uint8", "int8", "uint16", "int16", "uint32", "int32", "float32", "float64"};
+
+}
+
+bool parse_voxel_type(const std::string &name, VoxelType &type)
+{
+    std::string base = name;
+    type.big_endian = false;
+    if (base.size() > 2 && base.compare(base.size() - 2, 2, "be") == 0) {
+        type.big_endian = true;
+        base = base.substr(0, base.size() - 2);
+    } else if (base.size() > 2 && base.compare(base.size() - 2, 2, "le") == 0) {
+        base = base.substr(0, base.size() - 2);
+    }
+    for (size_t i = 0; i < sizeof(DTYPE_NAMES) / sizeof(DTYPE_NAMES[0]); ++i) {
+        if (base == DTYPE_NAMES[i]) {
+            type.dtype = static_cast<DType>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string voxel_type_name(const VoxelType &type)
+{
+    std::string name = DTYPE_NAMES[static_cast<size_t>(type.dtype)];
+    if (type.big_endian && dtype_size(type.dtype) > 1) {
+        name += "be";
+    }
+    return name;
+}
+
+size_t dtype_size(DType dtype)
+{
+    switch (dtype) {
+    case DType::UINT8:
+    case DType::INT8:
+        return 1;
+    case DType::UINT16:
+    case DType::INT16:
+        return 2;
+    case DType::UINT32:
+    case DType::INT32:
+    case DType::FLOAT32:
+        return 4;
+    case DType::FLOAT64:
+        return 8;
+    }
+    return 0;
+}
+
+const char *supported_voxel_type_names()
+{
+    return "uint8, int8, uint16, int16, uint32, int32, float32, float64 (append 'be' for big "
+           "endian data, e.g. uint16be)";
+}
+
+Normalization make_normalization(double min, double max)
+{
+    Normalization normalization;
+    normalization.enabled = true;
+    // A constant volume maps to 0
+    const double extent = max - min;
+    normalization.scale = extent > 0.0 ? float(1.0 / extent) : 0.f;
+    normalization.offset = float(-min * normalization.scale);
+    return normalization;
+}
+
+void convert_to_float_serial(const void *src,
+                             const VoxelType &type,
+                             float *dst,
+                             size_t n,
+                             const Normalization &normalization)
+{
+    select_kernels(type, normalization.enabled)
+        .convert(static_cast<const uint8_t *>(src),
+                 dst,
+                 n,
+                 normalization.scale,
+                 normalization.offset);
+}
+
+void convert_to_float(const void *src,
+                      const VoxelType &type,
+                      float *dst,
+                      size_t n,
+                      const Normalization &normalization)
+{
+    PROFILE_ZONE("convert_to_float");
+    const ConvertFn kernel = select_kernels(type, normalization.enabled).convert;
+    const uint8_t *bytes = static_cast<const uint8_t *>(src);
+    const size_t voxel_size = dtype_size(type.dtype);
+    parallel_for(0, n, [&](const size_t begin, const size_t end) {
+        kernel(bytes + begin * voxel_size,
+               dst + begin,
+               end - begin,
+               normalization.scale,
+               normalization.offset);
+    });
+}
+
+ValueRange compute_value_range_serial(const void *src, const VoxelType &type, size_t n)
+{
+    return select_kernels(type, false).range(static_cast<const uint8_t *>(src), n);
+}
+
+ValueRange compute_value_range(const void *src, const VoxelType &type, size_t n)
+{
+    const RangeFn kernel = select_kernels(type, false).range;
+    const uint8_t *bytes = static_cast<const uint8_t *>(src);
+    const size_t voxel_size = dtype_size(type.dtype);
+
+    std::mutex mutex;
+    ValueRange range;
+    parallel_for(0, n, [&](const size_t begin, const size_t end) {
+        const ValueRange local = kernel(bytes + begin * voxel_size, end - begin);
+        std::lock_guard<std::mutex> lock(mutex);
+        range.extend(local);
+    });
+    return range;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+
+enum class DType { UINT8, INT8, UINT16, INT16, UINT32, INT32, FLOAT32, FLOAT64 };
+
+// The voxel type of a raw volume, e.g. uint16 or big endian int16 (int16be)
+struct VoxelType {
+    DType dtype = DType::FLOAT32;
+    bool big_endian = false;
+};
+
+// Parse a raw volume type name: uint8, int8, uint16, int16, uint32, int32, float32 or float64,
+// optionally suffixed with be or le for big or little endian data (little endian is assumed
+// if no suffix is given). Returns false if the name is not a supported type.
+bool parse_voxel_type(const std::string &name, VoxelType &type);
+
+std::string voxel_type_name(const VoxelType &type);
+
+// Size in bytes of a single voxel of the type
+size_t dtype_size(DType dtype);
+
+// The list of supported type names for error messages
+const char *supported_voxel_type_names();
+
+// Linear transform folded into the conversion kernels to normalize values while loading:
+// v * scale + offset, clamped to [0, 1]
+struct Normalization {
+    bool enabled = false;
+    float scale = 1.f;
+    float offset = 0.f;
+};
+
+// Make the normalization mapping [min, max] to [0, 1]
+Normalization make_normalization(double min, double max);
+
+struct ValueRange {
+    float min = std::numeric_limits<float>::infinity();
+    float max = -std::numeric_limits<float>::infinity();
+
+    void extend(const ValueRange &other)
+    {
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+    }
+};
+
+// Convert n voxels of the given type to float, byte swapping big endian data and applying the
+// normalization if enabled. This is the single threaded kernel, used on chunks of the input by
+// convert_to_float and the streaming readers. Uses AVX2 when supported by the CPU.
+void convert_to_float_serial(const void *src,
+                             const VoxelType &type,
+                             float *dst,
+                             size_t n,
+                             const Normalization &normalization = Normalization());
+
+// Convert n voxels of the given type to float in parallel chunks across the worker threads
+void convert_to_float(const void *src,
+                      const VoxelType &type,
+                      float *dst,
+                      size_t n,
+                      const Normalization &normalization = Normalization());
+
+// Find the min and max value of n voxels of the given type, reading them in their native type.
+// NaNs are ignored.
+ValueRange compute_value_range_serial(const void *src, const VoxelType &type, size_t n);
+
+// Find the min and max value in parallel chunks across the worker threads
+ValueRange compute_value_range(const void *src, const VoxelType &type, size_t n);
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include "large_buffer.h"
+#include "parallel.h"
+#include "profiler.h"
+
+// A field kernel is a small functor giving the value of a generated field at a voxel:
+//
+//     struct MyField {
+//         float operator()(float x, float y, float z) const;
+//     };
+//
+// generate_field runs any kernel over the volume through one tiled, parallel loop. The kernel
+// is a template parameter, so its body is inlined into the innermost loop over x and the
+// compiler can vectorize it for the kernels which allow it, without a virtual call per voxel.
+
+// Tiles are a run of voxels along x over a few rows, so the rows of a tile share the
+// lookups of kernels that read tables (noise lattices, metaball cells)
+constexpr uint32_t FIELD_TILE_X = 64;
+constexpr uint32_t FIELD_TILE_Y = 4;
+constexpr uint32_t FIELD_TILE_Z = 4;
+
+// Evaluate a row of a tile into a local buffer. Writing to the stack rather than the volume
+// lets the compiler assume the stores don't alias the kernel's members, which would otherwise
+// block vectorizing the loop
+template <typename Field>
+inline void evaluate_field_row(
+    const Field &field, uint32_t x_begin, uint32_t count, float y, float z, float *row)
+{
+    for (uint32_t i = 0; i < count; ++i) {
+        row[i] = field(float(x_begin + i), y, z);
+    }
+}
+
+// Fill data, resized to the volume dims, with the field's value at each voxel
+template <typename Field>
+void generate_field(const Field &field, const glm::uvec3 &dims, VolumeBuffer &data)
+{
+    PROFILE_ZONE("generate_field");
+    data.resize(size_t(dims.x) * size_t(dims.y) * size_t(dims.z));
+    const glm::uvec3 tile_size(FIELD_TILE_X, FIELD_TILE_Y, FIELD_TILE_Z);
+    const glm::uvec3 tiles = (dims + tile_size - glm::uvec3(1)) / tile_size;
+    const size_t num_tiles = size_t(tiles.x) * tiles.y * tiles.z;
+    parallel_for(0, num_tiles, [&](const size_t begin, const size_t end) {
+        float row[FIELD_TILE_X];
+        for (size_t t = begin; t < end; ++t) {
+            const glm::uvec3 tile(t % tiles.x,
+                                  (t / tiles.x) % tiles.y,
+                                  t / (size_t(tiles.x) * tiles.y));
+            const glm::uvec3 origin = tile * tile_size;
+            const glm::uvec3 tile_end = glm::min(origin + tile_size, dims);
+            const uint32_t count = tile_end.x - origin.x;
+            for (uint32_t z = origin.z; z < tile_end.z; ++z) {
+                for (uint32_t y = origin.y; y < tile_end.y; ++y) {
+                    evaluate_field_row(field, origin.x, count, float(y), float(z), row);
+                    const size_t voxel = origin.x + dims.x * (y + dims.y * size_t(z));
+                    std::copy(row, row + count, &data[voxel]);
+                }
+            }
+        }
+    });
+}
@@ -0,0 +1,120 @@
+#include "generate_volume.h"
+#include <cmath>
+#include <iostream>
+#include <glm/gtx/string_cast.hpp>
+#include "field_kernels.h"
+
+namespace {
+
+// A plane field increasing along x, the voxel's normalized x coordinate
+struct PlaneXField {
+    float dim_x;
+
+    explicit PlaneXField(const glm::uvec3 &dims) : dim_x(dims.x) {}
+
+    float operator()(float x, float, float) const
+    {
+        return x / dim_x;
+    }
+};
+
+// A quarter sphere field, the distance from the origin of the volume
+struct QuarterSphereField {
+    float max_dist;
+
+    explicit QuarterSphereField(const glm::uvec3 &dims)
+        : max_dist(glm::length(glm::vec3(dims)))
+    {
+    }
+
+    float operator()(float x, float y, float z) const
+    {
+        return std::sqrt(x * x + y * y + z * z) / max_dist;
+    }
+};
+
+// A sphere field with the origin of the sphere in the middle of the volume
+struct SphereField {
+    glm::vec3 origin;
+    float max_dist;
+
+    explicit SphereField(const glm::uvec3 &dims)
+        : origin(dims.x / 2.f, dims.y / 2.f, dims.z / 2.f), max_dist(dims.x / 2.f)
+    {
+    }
+
+    float operator()(float x, float y, float z) const
+    {
+        const float dx = x - origin.x;
+        const float dy = y - origin.y;
+        const float dz = z - origin.z;
+        return std::sqrt(dx * dx + dy * dy + dz * dz) / max_dist;
+    }
+};
+
+// The wavelet test volume, borrowed from OpenVKL
+// https://github.com/openvkl/openvkl/blob/ec551ea08cbceab187326e2358fdc1ceeffaf1d6/testing/volume/procedural_functions.h#L39-L61
+struct WaveletField {
+    glm::vec3 dims;
+
+    explicit WaveletField(const glm::uvec3 &dims) : dims(dims) {}
+
+    float operator()(float x, float y, float z) const
+    {
+        // wavelet parameters
+        constexpr float M = 1.f;
+        constexpr float G = 1.f;
+        constexpr float XM = 1.f;
+        constexpr float YM = 1.f;
+        constexpr float ZM = 1.f;
+        constexpr float XF = 3.f;
+        constexpr float YF = 3.f;
+        constexpr float ZF = 3.f;
+        const float cx = 2.f * (x / dims.x) - 1.f;
+        const float cy = 2.f * (y / dims.y) - 1.f;
+        const float cz = 2.f * (z / dims.z) - 1.f;
+        return M * G *
+               (XM * std::sin(XF * cx) + YM * std::sin(YF * cy) + ZM * std::cos(ZF * cz));
+    }
+};
+
+template <typename Field>
+void generate(const glm::uvec3 &dims, const PaddingOptions &padding, VolumeBuffer &data)
+{
+    generate_padded_field(Field(dims), dims, padding, data);
+}
+
+struct FieldGenerator {
+    const char *name;
+    void (*generate)(const glm::uvec3 &dims,
+                     const PaddingOptions &padding,
+                     VolumeBuffer &data);
+};
+
+// Adding a field only takes writing its kernel and listing it here
+const FieldGenerator FIELD_GENERATORS[] = {
+    {"plane_x", generate<PlaneXField>},
+    {"quarter_sphere", generate<QuarterSphereField>},
+    {"sphere", generate<SphereField>},
+    {"wavelet", generate<WaveletField>},
+};
+
+}
+
+bool generate_volume(const std::string &gen_mode_name,
+                     const glm::uvec3 &gen_dims,
+                     VolumeBuffer &data,
+                     const PaddingOptions &padding)
+{
+    PROFILE_ZONE("generate_volume");
+    for (const auto &generator : FIELD_GENERATORS) {
+        if (gen_mode_name == generator.name) {
+            std::cout << "Generating " << gen_mode_name
+                      << " volume, size: " << glm::to_string(gen_dims) << "\n";
+            generator.generate(gen_dims, padding, data);
+            return true;
+        }
+    }
+    std::cout << "Unrecognized/unimplemented generation mode " << gen_mode_name << "\n";
+    return false;
+}
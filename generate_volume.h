@@ -0,0 +1,14 @@
+#pragma once
+
+#include <string>
+#include <glm/glm.hpp>
+#include "large_buffer.h"
+#include "padding.h"
+
+// Generate one of the analytic test volumes: plane_x, quarter_sphere, sphere or wavelet.
+// Returns false if the name isn't one of them. With padding, data holds the volume at the
+// padded dims of gen_dims
+bool generate_volume(const std::string &gen_mode_name,
+                     const glm::uvec3 &gen_dims,
+                     VolumeBuffer &data,
+                     const PaddingOptions &padding = PaddingOptions());
@@ -0,0 +1,603 @@
+#include "hdf5_input.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <glm/gtx/string_cast.hpp>
+#include "large_buffer.h"
+#include "mapped_file.h"
+#include "parallel.h"
+#include "profiler.h"
+#include "string_util.h"
+
+#ifdef BCMC_HAVE_HDF5
+#include <hdf5.h>
+#endif
+#ifdef BCMC_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace {
+
+// Split file.h5:/group/dataset into the file and dataset path, which is empty if not given
+bool split_hdf5_name(const std::string &name, std::string &file, std::string &dataset)
+{
+    for (const char *ext : {".h5", ".hdf5", ".hdf"}) {
+        size_t found = name.rfind(std::string(ext) + ":");
+        if (found != std::string::npos) {
+            file = name.substr(0, found + std::string(ext).size());
+            dataset = name.substr(file.size() + 1);
+            return true;
+        }
+        if (ends_with(name, ext)) {
+            file = name;
+            dataset.clear();
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while (b != 0) {
+        const uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+#ifdef BCMC_HAVE_HDF5
+
+// The HDF5 library is not thread safe, calls made from the workers hold this lock
+std::mutex &hdf5_mutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+// Closes an HDF5 handle with the matching close function when it goes out of scope
+class H5Handle {
+    hid_t id = -1;
+    herr_t (*close)(hid_t) = nullptr;
+
+public:
+    H5Handle(hid_t id, herr_t (*close)(hid_t)) : id(id), close(close) {}
+
+    ~H5Handle()
+    {
+        if (id >= 0) {
+            close(id);
+        }
+    }
+
+    H5Handle(const H5Handle &) = delete;
+    H5Handle &operator=(const H5Handle &) = delete;
+
+    hid_t get() const
+    {
+        return id;
+    }
+
+    bool valid() const
+    {
+        return id >= 0;
+    }
+};
+
+bool open_hdf5_file(const std::string &file_name, hid_t &file)
+{
+    // Failed lookups are expected while searching for datasets, errors are reported by the
+    // callers instead of the library's error stack dump
+    H5Eset_auto2(H5E_DEFAULT, nullptr, nullptr);
+    file = H5Fopen(file_name.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (file < 0) {
+        std::cerr << "Failed to open HDF5 file " << file_name << "\n";
+        return false;
+    }
+    return true;
+}
+
+int dataset_rank(hid_t dataset)
+{
+    H5Handle space(H5Dget_space(dataset), H5Sclose);
+    return space.valid() ? H5Sget_simple_extent_ndims(space.get()) : -1;
+}
+
+// Open the dataset at the path, or the first 3D or 4D dataset in the root group, setting path
+// to the dataset opened
+hid_t open_hdf5_dataset(hid_t file, std::string &path)
+{
+    if (!path.empty()) {
+        return H5Dopen2(file, path.c_str(), H5P_DEFAULT);
+    }
+    H5G_info_t group_info;
+    if (H5Gget_info(file, &group_info) < 0) {
+        return -1;
+    }
+    for (hsize_t i = 0; i < group_info.nlinks; ++i) {
+        const ssize_t length = H5Lget_name_by_idx(
+            file, "/", H5_INDEX_NAME, H5_ITER_INC, i, nullptr, 0, H5P_DEFAULT);
+        if (length <= 0) {
+            continue;
+        }
+        std::string name(length + 1, '\0');
+        H5Lget_name_by_idx(
+            file, "/", H5_INDEX_NAME, H5_ITER_INC, i, &name[0], name.size(), H5P_DEFAULT);
+        name.resize(length);
+        const hid_t dataset = H5Dopen2(file, name.c_str(), H5P_DEFAULT);
+        if (dataset < 0) {
+            continue;
+        }
+        const int rank = dataset_rank(dataset);
+        if (rank == 3 || rank == 4) {
+            path = "/" + name;
+            return dataset;
+        }
+        H5Dclose(dataset);
+    }
+    return -1;
+}
+
+bool parse_hdf5_type(hid_t type, VoxelType &voxel_type)
+{
+    const size_t size = H5Tget_size(type);
+    const H5T_class_t type_class = H5Tget_class(type);
+    if (type_class == H5T_FLOAT && (size == 4 || size == 8)) {
+        voxel_type.dtype = size == 4 ? DType::FLOAT32 : DType::FLOAT64;
+    } else if (type_class == H5T_INTEGER) {
+        const bool is_signed = H5Tget_sign(type) == H5T_SGN_2;
+        if (size == 1) {
+            voxel_type.dtype = is_signed ? DType::INT8 : DType::UINT8;
+        } else if (size == 2) {
+            voxel_type.dtype = is_signed ? DType::INT16 : DType::UINT16;
+        } else if (size == 4) {
+            voxel_type.dtype = is_signed ? DType::INT32 : DType::UINT32;
+        } else {
+            return false;
+        }
+    } else {
+        return false;
+    }
+    voxel_type.big_endian = H5Tget_order(type) == H5T_ORDER_BE;
+    return true;
+}
+
+// A filter of the dataset's pipeline, in the order they're applied when writing
+struct ChunkFilter {
+    H5Z_filter_t id;
+    unsigned element_size;
+};
+
+bool read_chunk_filters(hid_t dcpl, std::vector<ChunkFilter> &filters, std::string &names)
+{
+    bool supported = true;
+    const int num_filters = H5Pget_nfilters(dcpl);
+    for (int i = 0; i < num_filters; ++i) {
+        unsigned flags = 0;
+        unsigned config = 0;
+        size_t num_values = 8;
+        unsigned values[8] = {0};
+        char name[64] = {0};
+        const H5Z_filter_t id = H5Pget_filter2(
+            dcpl, i, &flags, &num_values, values, sizeof(name), name, &config);
+        filters.push_back(ChunkFilter{id, num_values > 0 ? values[0] : 0});
+        names += (names.empty() ? "" : ",") + std::string(name[0] ? name : "unknown");
+#ifdef BCMC_HAVE_ZLIB
+        supported &= id == H5Z_FILTER_DEFLATE || id == H5Z_FILTER_SHUFFLE ||
+                     id == H5Z_FILTER_FLETCHER32;
+#else
+        supported &= id == H5Z_FILTER_SHUFFLE || id == H5Z_FILTER_FLETCHER32;
+#endif
+    }
+    return supported;
+}
+
+// The scratch buffers a worker decodes chunks into, kept in a pool and reused across chunks
+// and slabs
+struct ChunkBuffers {
+    LargeVector<uint8_t> data[2];
+};
+
+class ChunkBufferPool {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ChunkBuffers>> free_buffers;
+    size_t chunk_bytes;
+
+public:
+    explicit ChunkBufferPool(size_t chunk_bytes) : chunk_bytes(chunk_bytes) {}
+
+    std::unique_ptr<ChunkBuffers> acquire()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!free_buffers.empty()) {
+                std::unique_ptr<ChunkBuffers> buffers = std::move(free_buffers.back());
+                free_buffers.pop_back();
+                return buffers;
+            }
+        }
+        std::unique_ptr<ChunkBuffers> buffers(new ChunkBuffers);
+        buffers->data[0].resize(chunk_bytes);
+        buffers->data[1].resize(chunk_bytes);
+        return buffers;
+    }
+
+    void release(std::unique_ptr<ChunkBuffers> buffers)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        free_buffers.push_back(std::move(buffers));
+    }
+
+    size_t size()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return free_buffers.size();
+    }
+};
+
+// Undo the filter pipeline on a chunk read from the mapped file, from the last filter applied
+// to the first, skipping those the chunk's filter mask says weren't applied. Returns the
+// decoded chunk, or null if it can't be decoded here and must be read through the library
+const uint8_t *decode_chunk(const uint8_t *stored,
+                            size_t stored_bytes,
+                            unsigned filter_mask,
+                            const std::vector<ChunkFilter> &filters,
+                            size_t voxel_size,
+                            size_t chunk_bytes,
+                            ChunkBuffers &buffers)
+{
+    const uint8_t *src = stored;
+    size_t bytes = stored_bytes;
+    int next_buffer = 0;
+    for (size_t i = filters.size(); i-- > 0;) {
+        if (filter_mask & (1u << i)) {
+            continue;
+        }
+        uint8_t *dst = buffers.data[next_buffer].data();
+        if (filters[i].id == H5Z_FILTER_FLETCHER32) {
+            // The checksum is appended to the chunk, and isn't verified here
+            if (bytes < 4) {
+                return nullptr;
+            }
+            bytes -= 4;
+            continue;
+        } else if (filters[i].id == H5Z_FILTER_SHUFFLE) {
+            // The bytes of each element are stored in planes, with any bytes past the last
+            // whole element left in place
+            const size_t element_size = filters[i].element_size ? filters[i].element_size
+                                                                : voxel_size;
+            const size_t n = bytes / element_size;
+            for (size_t b = 0; b < element_size; ++b) {
+                const uint8_t *plane = src + b * n;
+                for (size_t e = 0; e < n; ++e) {
+                    dst[e * element_size + b] = plane[e];
+                }
+            }
+            std::copy(src + n * element_size, src + bytes, dst + n * element_size);
+#ifdef BCMC_HAVE_ZLIB
+        } else if (filters[i].id == H5Z_FILTER_DEFLATE) {
+            uLongf inflated = chunk_bytes;
+            if (uncompress(dst, &inflated, src, bytes) != Z_OK) {
+                return nullptr;
+            }
+            bytes = inflated;
+#endif
+        } else {
+            return nullptr;
+        }
+        src = dst;
+        next_buffer = 1 - next_buffer;
+        if (bytes > chunk_bytes) {
+            return nullptr;
+        }
+    }
+    return bytes == chunk_bytes ? src : nullptr;
+}
+
+// A chunk overlapping the slab being read, at origin in the dataset. Chunks which aren't
+// allocated in the file have an undefined address
+struct SlabChunk {
+    glm::uvec3 origin;
+    haddr_t addr = HADDR_UNDEF;
+    hsize_t stored_bytes = 0;
+    unsigned filter_mask = 0;
+};
+
+#endif
+
+}
+
+bool is_hdf5_volume(const std::string &file_name)
+{
+    std::string file, dataset;
+    return split_hdf5_name(file_name, file, dataset);
+}
+
+bool parse_hdf5_volume(const std::string &file_name, RawVolumeInfo &info)
+{
+#ifdef BCMC_HAVE_HDF5
+    std::string path, dataset_path;
+    if (!split_hdf5_name(file_name, path, dataset_path)) {
+        std::cerr << file_name << " is not an HDF5 file\n";
+        return false;
+    }
+    hid_t file_id = -1;
+    if (!open_hdf5_file(path, file_id)) {
+        return false;
+    }
+    H5Handle file(file_id, H5Fclose);
+    H5Handle dataset(open_hdf5_dataset(file.get(), dataset_path), H5Dclose);
+    if (!dataset.valid()) {
+        std::cerr << "Failed to open "
+                  << (dataset_path.empty() ? "a 3D dataset in the root group"
+                                           : "dataset " + dataset_path)
+                  << " of " << path << "\n";
+        return false;
+    }
+
+    info = RawVolumeInfo();
+    H5Handle space(H5Dget_space(dataset.get()), H5Sclose);
+    const int rank = H5Sget_simple_extent_ndims(space.get());
+    if (rank != 3 && rank != 4) {
+        std::cerr << "HDF5 dataset " << dataset_path << " has " << rank
+                  << " dimensions, expected 3, or 4 with the components last\n";
+        return false;
+    }
+    hsize_t extent[4] = {0};
+    H5Sget_simple_extent_dims(space.get(), extent, nullptr);
+    // Datasets are stored in C order, with x varying fastest
+    info.dims = glm::uvec3(extent[2], extent[1], extent[0]);
+    info.num_components = rank == 4 ? uint32_t(extent[3]) : 1;
+
+    H5Handle type(H5Dget_type(dataset.get()), H5Tclose);
+    if (!parse_hdf5_type(type.get(), info.voxel_type)) {
+        std::cerr << "Unsupported HDF5 data type for dataset " << dataset_path
+                  << ", supported types are 8, 16 and 32 bit integers and 32 and 64 bit "
+                     "floats\n";
+        return false;
+    }
+
+    // Name the volume by the file and dataset, e.g. run_density for run.h5:/fields/density
+    const size_t slash = path.find_last_of("/\\");
+    const std::string stem = path.substr(slash == std::string::npos ? 0 : slash + 1,
+                                         path.find_last_of('.') - (slash + 1));
+    info.name = stem + "_" + dataset_path.substr(dataset_path.find_last_of('/') + 1);
+    std::replace_if(info.name.begin(),
+                    info.name.end(),
+                    [](char c) { return !std::isalnum(c) && c != '_'; },
+                    '_');
+    info.data_file = path;
+
+    H5Handle dcpl(H5Dget_create_plist(dataset.get()), H5Pclose);
+    const H5D_layout_t layout = H5Pget_layout(dcpl.get());
+    const haddr_t offset = H5Dget_offset(dataset.get());
+    if (layout == H5D_CONTIGUOUS && H5Pget_external_count(dcpl.get()) == 0 &&
+        offset != HADDR_UNDEF) {
+        // Contiguous datasets are read like a raw volume straight from the mapped file
+        info.data_offset = offset;
+        return true;
+    }
+    if (info.num_components != 1) {
+        std::cerr << "Multi-component HDF5 datasets must be stored contiguously\n";
+        return false;
+    }
+    info.hdf5_dataset = dataset_path;
+    if (layout == H5D_CHUNKED) {
+        hsize_t chunk[3] = {0};
+        H5Pget_chunk(dcpl.get(), 3, chunk);
+        info.hdf5_chunk_dims = glm::uvec3(chunk[2], chunk[1], chunk[0]);
+    } else {
+        // Compact, external or unallocated datasets are read through the library, in boxes of
+        // whole slices the size of a layer of ZFP blocks
+        info.hdf5_chunk_dims = glm::uvec3(info.dims.x, info.dims.y, 4);
+    }
+    return true;
+#else
+    (void)file_name;
+    (void)info;
+    std::cerr << "HDF5 inputs are not supported, rebuild with HDF5\n";
+    return false;
+#endif
+}
+
+void print_hdf5_volume(const std::string &file_name, const RawVolumeInfo &info)
+{
+    std::cout << file_name << ": " << glm::to_string(info.dims) << " "
+              << voxel_type_name(info.voxel_type);
+    if (info.num_components > 1) {
+        std::cout << "x" << info.num_components;
+    }
+    if (info.hdf5_dataset.empty()) {
+        std::cout << " volume, contiguous in " << info.data_file << " at offset "
+                  << info.data_offset << "\n";
+    } else {
+        std::cout << " volume, dataset " << info.hdf5_dataset << " read in "
+                  << glm::to_string(info.hdf5_chunk_dims) << " chunks\n";
+    }
+}
+
+uint32_t hdf5_slab_slices(const RawVolumeInfo &info, uint32_t min_slices)
+{
+    const uint32_t chunk_z = std::max(info.hdf5_chunk_dims.z, 1u);
+    const uint32_t step = chunk_z / gcd(chunk_z, 4) * 4;
+    const uint32_t slices = std::max(std::min(min_slices, info.dims.z), 1u);
+    return (slices + step - 1) / step * step;
+}
+
+size_t hdf5_buffer_bytes(const RawVolumeInfo &info, size_t num_threads)
+{
+    if (info.hdf5_dataset.empty()) {
+        return 0;
+    }
+    // Each worker holds a pair of chunk buffers from the pool
+    const glm::uvec3 chunk_dims = info.hdf5_chunk_dims;
+    const size_t chunk_bytes = size_t(chunk_dims.x) * chunk_dims.y * chunk_dims.z *
+                               dtype_size(info.voxel_type.dtype);
+    return num_threads * 2 * chunk_bytes;
+}
+
+bool read_hdf5_chunks(const RawVolumeInfo &info,
+                      uint32_t z_begin,
+                      uint32_t z_end,
+                      uint32_t slab_slices,
+                      const HDF5ChunkFn &fn,
+                      const HDF5SlabFn &slab_done)
+{
+#ifdef BCMC_HAVE_HDF5
+    PROFILE_ZONE("read_hdf5_chunks");
+    const glm::uvec3 dims = info.dims;
+    const glm::uvec3 chunk_dims = info.hdf5_chunk_dims;
+    z_end = std::min(z_end, dims.z);
+    if (chunk_dims.x == 0 || chunk_dims.y == 0 || chunk_dims.z == 0 || z_begin >= z_end) {
+        std::cerr << "No chunks of " << info.data_file << " to read\n";
+        return false;
+    }
+    hid_t file_id = -1;
+    if (!open_hdf5_file(info.data_file, file_id)) {
+        return false;
+    }
+    H5Handle file(file_id, H5Fclose);
+    H5Handle dataset(H5Dopen2(file.get(), info.hdf5_dataset.c_str(), H5P_DEFAULT), H5Dclose);
+    if (!dataset.valid()) {
+        std::cerr << "Failed to open dataset " << info.hdf5_dataset << " of "
+                  << info.data_file << "\n";
+        return false;
+    }
+    H5Handle type(H5Dget_type(dataset.get()), H5Tclose);
+    H5Handle file_space(H5Dget_space(dataset.get()), H5Sclose);
+    H5Handle dcpl(H5Dget_create_plist(dataset.get()), H5Pclose);
+    const bool chunked = H5Pget_layout(dcpl.get()) == H5D_CHUNKED;
+    std::vector<ChunkFilter> filters;
+    std::string filter_names;
+    const bool decode_filters =
+        chunked && read_chunk_filters(dcpl.get(), filters, filter_names);
+
+    // Chunks are decoded straight from the mapped file by the workers
+    MappedFile mapped;
+    if (decode_filters && !mapped.open(info.data_file)) {
+        return false;
+    }
+
+    const size_t voxel_size = dtype_size(info.voxel_type.dtype);
+    const size_t chunk_bytes = size_t(chunk_dims.x) * chunk_dims.y * chunk_dims.z * voxel_size;
+    const glm::uvec3 grid = (dims + chunk_dims - 1u) / chunk_dims;
+    const uint32_t step = hdf5_slab_slices(info, slab_slices);
+    ChunkBufferPool pool(chunk_bytes);
+    std::atomic<size_t> library_reads(0);
+    size_t num_chunks = 0;
+    std::vector<SlabChunk> chunks;
+    for (uint32_t slab = z_begin - z_begin % step; slab < z_end; slab += step) {
+        const uint32_t slab_begin = std::max(slab, z_begin);
+        const uint32_t slab_end = std::min(slab + step, z_end);
+        chunks.clear();
+        for (uint32_t cz = slab_begin / chunk_dims.z; cz * chunk_dims.z < slab_end; ++cz) {
+            for (uint32_t cy = 0; cy < grid.y; ++cy) {
+                for (uint32_t cx = 0; cx < grid.x; ++cx) {
+                    SlabChunk chunk;
+                    chunk.origin = glm::uvec3(cx, cy, cz) * chunk_dims;
+                    const hsize_t offset[3] = {chunk.origin.z, chunk.origin.y, chunk.origin.x};
+                    if (decode_filters &&
+                        H5Dget_chunk_info_by_coord(dataset.get(),
+                                                   offset,
+                                                   &chunk.filter_mask,
+                                                   &chunk.addr,
+                                                   &chunk.stored_bytes) < 0) {
+                        chunk.addr = HADDR_UNDEF;
+                    }
+                    if (chunk.addr != HADDR_UNDEF &&
+                        chunk.addr + chunk.stored_bytes > mapped.size()) {
+                        chunk.addr = HADDR_UNDEF;
+                    }
+                    chunks.push_back(chunk);
+                }
+            }
+        }
+        num_chunks += chunks.size();
+
+        std::atomic<bool> success(true);
+        parallel_for(0, chunks.size(), [&](const size_t begin, const size_t end) {
+            std::unique_ptr<ChunkBuffers> buffers = pool.acquire();
+            for (size_t i = begin; i < end && success; ++i) {
+                const SlabChunk &chunk = chunks[i];
+                HDF5ChunkBox box;
+                box.origin = glm::uvec3(chunk.origin.x,
+                                        chunk.origin.y,
+                                        std::max(chunk.origin.z, slab_begin));
+                box.size = glm::min(chunk.origin + chunk_dims, dims) - box.origin;
+                box.size.z = std::min(chunk.origin.z + chunk_dims.z, slab_end) - box.origin.z;
+
+                const uint8_t *voxels = nullptr;
+                if (chunk.addr != HADDR_UNDEF) {
+                    PROFILE_ZONE("decode chunk");
+                    voxels = decode_chunk(mapped.data() + chunk.addr,
+                                          chunk.stored_bytes,
+                                          chunk.filter_mask,
+                                          filters,
+                                          voxel_size,
+                                          chunk_bytes,
+                                          *buffers);
+                }
+                if (voxels) {
+                    box.row_pitch = chunk_dims.x;
+                    box.slice_pitch = size_t(chunk_dims.x) * chunk_dims.y;
+                    voxels += (box.origin.z - chunk.origin.z) * box.slice_pitch * voxel_size;
+                } else {
+                    // Unallocated chunks, which read as the fill value, and chunks with
+                    // filters decoded by the library are read one at a time
+                    PROFILE_ZONE("read chunk with HDF5");
+                    std::lock_guard<std::mutex> lock(hdf5_mutex());
+                    const hsize_t start[3] = {box.origin.z, box.origin.y, box.origin.x};
+                    const hsize_t count[3] = {box.size.z, box.size.y, box.size.x};
+                    H5Handle selection(H5Scopy(file_space.get()), H5Sclose);
+                    H5Handle memory(H5Screate_simple(3, count, nullptr), H5Sclose);
+                    H5Sselect_hyperslab(
+                        selection.get(), H5S_SELECT_SET, start, nullptr, count, nullptr);
+                    if (H5Dread(dataset.get(),
+                                type.get(),
+                                memory.get(),
+                                selection.get(),
+                                H5P_DEFAULT,
+                                buffers->data[0].data()) < 0) {
+                        std::cerr << "Failed to read chunk at "
+                                  << glm::to_string(chunk.origin) << " of "
+                                  << info.hdf5_dataset << "\n";
+                        success = false;
+                        break;
+                    }
+                    ++library_reads;
+                    voxels = buffers->data[0].data();
+                    box.row_pitch = box.size.x;
+                    box.slice_pitch = size_t(box.size.x) * box.size.y;
+                }
+                fn(voxels, box);
+            }
+            pool.release(std::move(buffers));
+        });
+        if (!success || (slab_done && !slab_done(slab_begin, slab_end))) {
+            return false;
+        }
+    }
+    std::cout << "Read " << num_chunks << " " << glm::to_string(chunk_dims) << " chunks"
+              << (filter_names.empty() ? "" : " (" + filter_names + ")") << " in slabs of "
+              << step << " slices with " << pool.size() << " chunk buffers";
+    if (library_reads > 0) {
+        std::cout << ", " << library_reads << " read through the HDF5 library";
+    }
+    std::cout << "\n";
+    return true;
+#else
+    (void)info;
+    (void)z_begin;
+    (void)z_end;
+    (void)slab_slices;
+    (void)fn;
+    (void)slab_done;
+    std::cerr << "HDF5 inputs are not supported, rebuild with HDF5\n";
+    return false;
+#endif
+}
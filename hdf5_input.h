@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <glm/glm.hpp>
+#include "raw_volume.h"
+
+// Check if the input is an HDF5 file by its extension (.h5, .hdf5 or .hdf), optionally
+// followed by the dataset to read, e.g. run.h5:/fields/density
+bool is_hdf5_volume(const std::string &file_name);
+
+// Read the info of a 3D dataset of an HDF5 file, or the first 3D dataset in the root group if
+// no dataset is given. Contiguous, unfiltered datasets are read like raw volumes at their
+// offset in the file. Chunked datasets set hdf5_dataset and hdf5_chunk_dims, and are read
+// with read_hdf5_chunks. Datasets with a fourth, fastest varying, dimension are read as
+// volumes with that many components per voxel.
+bool parse_hdf5_volume(const std::string &file_name, RawVolumeInfo &info);
+
+// Print the volume info read from an HDF5 dataset and how it's stored
+void print_hdf5_volume(const std::string &file_name, const RawVolumeInfo &info);
+
+// A box of voxels from one chunk of a dataset, clipped to the slices being read. The voxels
+// are x fastest, with the row and slice pitch of the chunk in voxels
+struct HDF5ChunkBox {
+    glm::uvec3 origin = glm::uvec3(0);
+    glm::uvec3 size = glm::uvec3(0);
+    size_t row_pitch = 0;
+    size_t slice_pitch = 0;
+};
+
+// Called from the worker threads with the voxels of each chunk box read, in the dataset's type
+using HDF5ChunkFn = std::function<void(const uint8_t *voxels, const HDF5ChunkBox &box)>;
+
+// Called once all chunks of the z slab [z_begin, z_end) have been passed to the chunk
+// callback. Return false to stop reading
+using HDF5SlabFn = std::function<bool(uint32_t z_begin, uint32_t z_end)>;
+
+// Get the number of z slices in the slabs read_hdf5_chunks reads at a time: at least
+// min_slices, rounded up to whole layers of both chunks and 4^3 ZFP blocks
+uint32_t hdf5_slab_slices(const RawVolumeInfo &info, uint32_t min_slices);
+
+// Upper bound on the memory held by the chunk buffers of read_hdf5_chunks with num_threads
+// worker threads, for planning memory use (see memory_plan.h)
+size_t hdf5_buffer_bytes(const RawVolumeInfo &info, size_t num_threads);
+
+// Read the chunks of a chunked dataset holding the z slices [z_begin, z_end), in order of
+// slabs of hdf5_slab_slices(info, slab_slices) slices. The chunks of each slab are read and
+// decompressed in parallel, straight from the mapped file, by workers which reuse chunk
+// buffers from a pool across slabs, and are handed to fn without being assembled first.
+// Deflate, shuffle and fletcher32 filtered chunks are decoded by the workers, chunks with
+// other filters or which aren't allocated are read through the HDF5 library one at a time.
+bool read_hdf5_chunks(const RawVolumeInfo &info,
+                      uint32_t z_begin,
+                      uint32_t z_end,
+                      uint32_t slab_slices,
+                      const HDF5ChunkFn &fn,
+                      const HDF5SlabFn &slab_done = HDF5SlabFn());
@@ -0,0 +1,744 @@
+#include "http_server.h"
+#include <iostream>
+
+#ifdef __linux__
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bcmc_file.h"
+#include "block_decoder.h"
+#include "content_hash.h"
+#include "mapped_file.h"
+#include "parallel.h"
+#include "profiler.h"
+#include "string_util.h"
+
+namespace {
+
+// Requests with larger headers than this are rejected
+constexpr size_t MAX_REQUEST_BYTES = 16 * 1024;
+constexpr int MAX_EPOLL_EVENTS = 256;
+
+struct ServedFile {
+    std::string path;
+    int fd = -1;
+    size_t size = 0;
+    std::string etag;
+    bool is_bcmc = false;
+    // Dims and rate of a .zfp stream, if they could be parsed from its name
+    CompressedVolumeInfo zfp_info;
+    BCMCFileInfo bcmc_info;
+};
+
+struct ByteRange {
+    size_t offset = 0;
+    size_t size = 0;
+};
+
+std::string compute_etag(const MappedFile &file)
+{
+    PROFILE_ZONE("compute etag");
+    std::ostringstream ss;
+    ss << "\"" << std::hex << parallel_content_hash(file.data(), file.size()) << "\"";
+    return ss.str();
+}
+
+std::string base_name(const std::string &path)
+{
+    const size_t slash = path.find_last_of('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+// Expand directories to the outputs they contain
+std::vector<std::string> expand_paths(const std::vector<std::string> &paths)
+{
+    std::vector<std::string> files;
+    for (const auto &p : paths) {
+        struct stat st;
+        if (stat(p.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+            files.push_back(p);
+            continue;
+        }
+        DIR *dir = opendir(p.c_str());
+        if (!dir) {
+            continue;
+        }
+        while (dirent *entry = readdir(dir)) {
+            const std::string name = entry->d_name;
+            if (ends_with(name, ".zfp") || ends_with(name, ".bcmc")) {
+                files.push_back(p + "/" + name);
+            }
+        }
+        closedir(dir);
+    }
+    return files;
+}
+
+bool load_served_file(const std::string &path, ServedFile &served)
+{
+    MappedFile file;
+    if (!file.open(path)) {
+        return false;
+    }
+    served.path = path;
+    served.size = file.size();
+    served.etag = compute_etag(file);
+    served.is_bcmc = ends_with(path, ".bcmc");
+    if (served.is_bcmc && !parse_bcmc_file(file.data(), file.size(), served.bcmc_info)) {
+        std::cerr << "Failed to read BCMC file " << path << "\n";
+        return false;
+    }
+    if (!served.is_bcmc) {
+        parse_compressed_volume_name(base_name(path), served.zfp_info);
+    }
+    served.fd = ::open(path.c_str(), O_RDONLY);
+    if (served.fd < 0) {
+        std::cerr << "Failed to open " << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool parse_size(const std::string &str, size_t &value)
+{
+    if (str.empty() || str.find_first_not_of("0123456789") != std::string::npos ||
+        str.size() > 18) {
+        return false;
+    }
+    value = std::stoull(str);
+    return true;
+}
+
+// Parse an inclusive range "first-last"
+bool parse_index_range(const std::string &str, size_t &first, size_t &last)
+{
+    const size_t dash = str.find('-');
+    if (dash == std::string::npos) {
+        return parse_size(str, first) && parse_size(str, last);
+    }
+    return parse_size(str.substr(0, dash), first) &&
+           parse_size(str.substr(dash + 1), last) && first <= last;
+}
+
+// Find the part of the file selected by the query string. Returns the HTTP status to respond
+// with on error, or 0 on success
+int select_query_range(const ServedFile &file, const std::string &query, ByteRange &range)
+{
+    range.offset = 0;
+    range.size = file.size;
+    if (query.empty()) {
+        return 0;
+    }
+    std::string stream_param;
+    std::string blocks_param;
+    std::istringstream params(query);
+    std::string param;
+    while (std::getline(params, param, '&')) {
+        const size_t eq = param.find('=');
+        const std::string key = param.substr(0, eq);
+        const std::string value = eq == std::string::npos ? "" : param.substr(eq + 1);
+        if (key == "stream") {
+            stream_param = value;
+        } else if (key == "blocks") {
+            blocks_param = value;
+        } else {
+            return 400;
+        }
+    }
+
+    uint64_t block_bytes = 0;
+    if (file.is_bcmc) {
+        if (stream_param.empty() && !blocks_param.empty()) {
+            return 400;
+        }
+        size_t stream = 0;
+        if (!stream_param.empty()) {
+            if (!parse_size(stream_param, stream) ||
+                stream >= file.bcmc_info.streams.size()) {
+                return 404;
+            }
+            const BCMCStreamEntry &entry = file.bcmc_info.streams[stream];
+            range.offset = entry.offset;
+            range.size = entry.size;
+            block_bytes = uint64_t(entry.rate) * (uint64_t(1) << (2 * entry.zfp_dims)) / 8;
+        }
+    } else {
+        if (!stream_param.empty()) {
+            return 400;
+        }
+        if (!blocks_param.empty() && file.zfp_info.rate <= 0) {
+            // Can't address blocks without knowing the rate
+            return 400;
+        }
+        block_bytes = uint64_t(file.zfp_info.rate) * ZFP_BLOCK_VOXELS / 8;
+    }
+
+    if (!blocks_param.empty()) {
+        size_t first = 0;
+        size_t last = 0;
+        if (!parse_index_range(blocks_param, first, last) || block_bytes == 0) {
+            return 400;
+        }
+        if (first >= (range.size + block_bytes - 1) / block_bytes) {
+            return 416;
+        }
+        const size_t end =
+            last < range.size / block_bytes ? (last + 1) * block_bytes : range.size;
+        range.offset += first * block_bytes;
+        range.size = end - first * block_bytes;
+    }
+    return 0;
+}
+
+// Apply a Range header within the selected range. Returns the HTTP status to respond with
+int apply_range_header(const std::string &header, ByteRange &range, size_t &full_size)
+{
+    full_size = range.size;
+    if (header.empty()) {
+        return 200;
+    }
+    const std::string prefix = "bytes=";
+    if (header.compare(0, prefix.size(), prefix) != 0 ||
+        header.find(',') != std::string::npos) {
+        // Multiple ranges aren't supported, ignoring the header is allowed
+        return 200;
+    }
+    const std::string spec = header.substr(prefix.size());
+    const size_t dash = spec.find('-');
+    if (dash == std::string::npos) {
+        return 200;
+    }
+    const std::string first_str = spec.substr(0, dash);
+    const std::string last_str = spec.substr(dash + 1);
+    size_t first = 0;
+    size_t last = range.size == 0 ? 0 : range.size - 1;
+    if (first_str.empty()) {
+        // Suffix range, the last n bytes
+        size_t n = 0;
+        if (!parse_size(last_str, n)) {
+            return 200;
+        }
+        if (n == 0 || range.size == 0) {
+            return 416;
+        }
+        first = range.size - std::min(n, range.size);
+    } else {
+        if (!parse_size(first_str, first) ||
+            (!last_str.empty() && !parse_size(last_str, last))) {
+            return 200;
+        }
+        if (first >= range.size || last < first) {
+            return 416;
+        }
+        last = std::min(last, range.size - 1);
+    }
+    range.offset += first;
+    range.size = last - first + 1;
+    return 206;
+}
+
+const char *status_text(int status)
+{
+    switch (status) {
+    case 200:
+        return "OK";
+    case 204:
+        return "No Content";
+    case 206:
+        return "Partial Content";
+    case 304:
+        return "Not Modified";
+    case 400:
+        return "Bad Request";
+    case 404:
+        return "Not Found";
+    case 405:
+        return "Method Not Allowed";
+    case 416:
+        return "Range Not Satisfiable";
+    case 431:
+        return "Request Header Fields Too Large";
+    default:
+        return "Error";
+    }
+}
+
+struct Request {
+    std::string method;
+    std::string path;
+    std::string query;
+    std::unordered_map<std::string, std::string> headers;
+    bool keep_alive = true;
+};
+
+bool parse_request(const std::string &text, Request &request)
+{
+    std::istringstream lines(text);
+    std::string line;
+    if (!std::getline(lines, line)) {
+        return false;
+    }
+    if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+    }
+    std::istringstream request_line(line);
+    std::string target;
+    std::string version;
+    if (!(request_line >> request.method >> target >> version)) {
+        return false;
+    }
+    const size_t q = target.find('?');
+    request.path = target.substr(0, q);
+    request.query = q == std::string::npos ? "" : target.substr(q + 1);
+    request.keep_alive = version != "HTTP/1.0";
+
+    while (std::getline(lines, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        const size_t colon = line.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        std::string name = line.substr(0, colon);
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        const size_t value_start = line.find_first_not_of(' ', colon + 1);
+        request.headers[name] =
+            value_start == std::string::npos ? "" : line.substr(value_start);
+    }
+    auto connection = request.headers.find("connection");
+    if (connection != request.headers.end()) {
+        std::string value = connection->second;
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+        if (value == "close") {
+            request.keep_alive = false;
+        } else if (value == "keep-alive") {
+            request.keep_alive = true;
+        }
+    }
+    return true;
+}
+
+struct Connection {
+    int fd = -1;
+    std::string input;
+    // The response header, and the file range to send after it
+    std::string header;
+    size_t header_sent = 0;
+    int file_fd = -1;
+    off_t file_offset = 0;
+    size_t file_remaining = 0;
+    bool keep_alive = true;
+
+    bool sending() const
+    {
+        return header_sent < header.size() || file_remaining != 0;
+    }
+};
+
+class Server {
+    std::unordered_map<std::string, ServedFile> &files;
+    int listen_fd = -1;
+    int epoll_fd = -1;
+    std::unordered_map<int, std::unique_ptr<Connection>> connections;
+
+    void respond(Connection &conn, const Request &request);
+
+    void respond_error(Connection &conn, int status, bool keep_alive);
+
+    void accept_connections();
+
+    // Returns false if the connection should be closed
+    bool read_input(Connection &conn);
+
+    // Returns false if the connection should be closed
+    bool write_output(Connection &conn);
+
+    // Handle buffered requests until one can't be written out completely. Returns false if
+    // the connection should be closed
+    bool process(Connection &conn);
+
+    void close_connection(int fd);
+
+public:
+    explicit Server(std::unordered_map<std::string, ServedFile> &files) : files(files) {}
+
+    ~Server();
+
+    bool listen(const ServeOptions &options);
+
+    void run();
+};
+
+Server::~Server()
+{
+    for (auto &c : connections) {
+        ::close(c.first);
+    }
+    if (epoll_fd >= 0) {
+        ::close(epoll_fd);
+    }
+    if (listen_fd >= 0) {
+        ::close(listen_fd);
+    }
+}
+
+bool Server::listen(const ServeOptions &options)
+{
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        std::cerr << "Failed to create socket: " << std::strerror(errno) << "\n";
+        return false;
+    }
+    const int enable = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    // Each worker listens on its own socket on the same port, the kernel balances the
+    // incoming connections between them
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable));
+
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(options.port);
+    if (inet_pton(AF_INET, options.bind_address.c_str(), &addr.sin_addr) != 1) {
+        std::cerr << "Invalid bind address " << options.bind_address << "\n";
+        return false;
+    }
+    if (bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        ::listen(listen_fd, SOMAXCONN) != 0) {
+        std::cerr << "Failed to listen on " << options.bind_address << ":" << options.port
+                  << ": " << std::strerror(errno) << "\n";
+        return false;
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        std::cerr << "Failed to create epoll instance: " << std::strerror(errno) << "\n";
+        return false;
+    }
+    epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = listen_fd;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) == 0;
+}
+
+void Server::run()
+{
+    epoll_event events[MAX_EPOLL_EVENTS];
+    while (true) {
+        const int n = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "epoll_wait failed: " << std::strerror(errno) << "\n";
+            return;
+        }
+        for (int i = 0; i < n; ++i) {
+            const int fd = events[i].data.fd;
+            if (fd == listen_fd) {
+                accept_connections();
+                continue;
+            }
+            auto fnd = connections.find(fd);
+            if (fnd == connections.end()) {
+                continue;
+            }
+            Connection &conn = *fnd->second;
+            bool open = !(events[i].events & (EPOLLERR | EPOLLHUP));
+            if (open && (events[i].events & EPOLLOUT)) {
+                open = write_output(conn);
+            }
+            if (open && (events[i].events & (EPOLLIN | EPOLLRDHUP))) {
+                open = read_input(conn);
+            }
+            if (open && !conn.sending()) {
+                open = process(conn);
+            }
+            if (!open) {
+                close_connection(fd);
+                continue;
+            }
+            // Only wait for the socket to be writable while a response is pending
+            epoll_event ev;
+            std::memset(&ev, 0, sizeof(ev));
+            ev.events = conn.sending() ? EPOLLOUT : EPOLLIN | EPOLLRDHUP;
+            ev.data.fd = fd;
+            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+        }
+    }
+}
+
+void Server::accept_connections()
+{
+    while (true) {
+        const int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        const int enable = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        epoll_event ev;
+        std::memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            ::close(fd);
+            continue;
+        }
+        std::unique_ptr<Connection> conn(new Connection());
+        conn->fd = fd;
+        connections[fd] = std::move(conn);
+    }
+}
+
+void Server::close_connection(int fd)
+{
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(fd);
+    connections.erase(fd);
+}
+
+bool Server::read_input(Connection &conn)
+{
+    char buf[4096];
+    while (true) {
+        const ssize_t n = recv(conn.fd, buf, sizeof(buf), 0);
+        if (n > 0) {
+            conn.input.append(buf, n);
+            if (conn.input.size() > 4 * MAX_REQUEST_BYTES) {
+                // Don't buffer unbounded pipelined input, the rest is read once the
+                // buffered requests are handled
+                return true;
+            }
+        } else if (n == 0) {
+            return false;
+        } else {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+    }
+}
+
+bool Server::write_output(Connection &conn)
+{
+    while (conn.header_sent < conn.header.size()) {
+        // Hold the header back until the body follows so they go out in the same packets
+        const int flags = MSG_NOSIGNAL | (conn.file_remaining != 0 ? MSG_MORE : 0);
+        const ssize_t n = send(conn.fd,
+                               conn.header.data() + conn.header_sent,
+                               conn.header.size() - conn.header_sent,
+                               flags);
+        if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+        conn.header_sent += n;
+    }
+    while (conn.file_remaining != 0) {
+        const ssize_t n =
+            sendfile(conn.fd, conn.file_fd, &conn.file_offset, conn.file_remaining);
+        if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+        if (n == 0) {
+            // The file was truncated under us
+            return false;
+        }
+        conn.file_remaining -= n;
+    }
+    return conn.keep_alive;
+}
+
+bool Server::process(Connection &conn)
+{
+    while (!conn.sending()) {
+        const size_t end = conn.input.find("\r\n\r\n");
+        if (end == std::string::npos) {
+            if (conn.input.size() > MAX_REQUEST_BYTES) {
+                respond_error(conn, 431, false);
+                return write_output(conn) || conn.sending();
+            }
+            return true;
+        }
+        Request request;
+        const bool valid = parse_request(conn.input.substr(0, end), request);
+        conn.input.erase(0, end + 4);
+        if (!valid) {
+            respond_error(conn, 400, false);
+        } else if (request.headers.count("content-length") ||
+                   request.headers.count("transfer-encoding")) {
+            // We don't expect request bodies, and can't tell where the next request starts
+            respond_error(conn, 400, false);
+        } else {
+            respond(conn, request);
+        }
+        // write_output returns false once a response with keep alive disabled is done
+        if (!write_output(conn)) {
+            return conn.sending();
+        }
+    }
+    return true;
+}
+
+void Server::respond_error(Connection &conn, int status, bool keep_alive)
+{
+    std::ostringstream ss;
+    ss << "HTTP/1.1 " << status << " " << status_text(status) << "\r\n"
+       << "Access-Control-Allow-Origin: *\r\n"
+       << "Content-Length: 0\r\n"
+       << "Connection: " << (keep_alive ? "keep-alive" : "close") << "\r\n\r\n";
+    conn.header = ss.str();
+    conn.header_sent = 0;
+    conn.file_remaining = 0;
+    conn.keep_alive = keep_alive;
+}
+
+void Server::respond(Connection &conn, const Request &request)
+{
+    const bool head = request.method == "HEAD";
+    if (request.method == "OPTIONS") {
+        // CORS preflight for viewers requesting ranges from another origin
+        std::ostringstream ss;
+        ss << "HTTP/1.1 204 No Content\r\n"
+           << "Access-Control-Allow-Origin: *\r\n"
+           << "Access-Control-Allow-Methods: GET, HEAD, OPTIONS\r\n"
+           << "Access-Control-Allow-Headers: Range, If-None-Match\r\n"
+           << "Access-Control-Max-Age: 86400\r\n"
+           << "Content-Length: 0\r\n"
+           << "Connection: " << (request.keep_alive ? "keep-alive" : "close") << "\r\n\r\n";
+        conn.header = ss.str();
+        conn.header_sent = 0;
+        conn.file_remaining = 0;
+        conn.keep_alive = request.keep_alive;
+        return;
+    }
+    if (request.method != "GET" && !head) {
+        respond_error(conn, 405, request.keep_alive);
+        return;
+    }
+    auto fnd = files.find(request.path.empty() ? "" : request.path.substr(1));
+    if (fnd == files.end()) {
+        respond_error(conn, 404, request.keep_alive);
+        return;
+    }
+    const ServedFile &file = fnd->second;
+
+    ByteRange range;
+    const int query_status = select_query_range(file, request.query, range);
+    if (query_status != 0) {
+        respond_error(conn, query_status, request.keep_alive);
+        return;
+    }
+    // Each selection of the file is its own resource with its own ETag
+    std::string etag = file.etag;
+    if (!request.query.empty()) {
+        etag.insert(etag.size() - 1, "-" + std::to_string(range.offset) + "-" +
+                                         std::to_string(range.size));
+    }
+    auto if_none_match = request.headers.find("if-none-match");
+    const bool not_modified = if_none_match != request.headers.end() &&
+                              (if_none_match->second == etag || if_none_match->second == "*");
+
+    // Content-Range is relative to the selected part of the file
+    const size_t selection_offset = range.offset;
+    int status = 304;
+    size_t full_size = range.size;
+    if (!not_modified) {
+        auto range_header = request.headers.find("range");
+        status = apply_range_header(
+            range_header == request.headers.end() ? "" : range_header->second,
+            range,
+            full_size);
+    }
+    std::ostringstream ss;
+    ss << "HTTP/1.1 " << status << " " << status_text(status) << "\r\n";
+    if (status == 206) {
+        const size_t first = range.offset - selection_offset;
+        ss << "Content-Range: bytes " << first << "-" << first + range.size - 1 << "/"
+           << full_size << "\r\n";
+    } else if (status == 416) {
+        ss << "Content-Range: bytes */" << full_size << "\r\n";
+        range.size = 0;
+    }
+    ss << "ETag: " << etag << "\r\n"
+       << "Accept-Ranges: bytes\r\n"
+       << "Access-Control-Allow-Origin: *\r\n"
+       << "Access-Control-Expose-Headers: Content-Range, ETag, Accept-Ranges\r\n"
+       << "Content-Type: application/octet-stream\r\n"
+       << "Content-Length: " << (status == 304 ? 0 : range.size) << "\r\n"
+       << "Connection: " << (request.keep_alive ? "keep-alive" : "close") << "\r\n\r\n";
+    conn.header = ss.str();
+    conn.header_sent = 0;
+    conn.file_fd = file.fd;
+    conn.file_offset = range.offset;
+    conn.file_remaining = (status == 200 || status == 206) && !head ? range.size : 0;
+    conn.keep_alive = request.keep_alive;
+}
+
+}
+
+bool serve_files(const std::vector<std::string> &paths, const ServeOptions &options)
+{
+    std::unordered_map<std::string, ServedFile> files;
+    for (const auto &path : expand_paths(paths)) {
+        ServedFile file;
+        if (!load_served_file(path, file)) {
+            return false;
+        }
+        const std::string name = base_name(path);
+        if (files.count(name)) {
+            std::cerr << "Multiple files named " << name << " were passed to serve\n";
+            return false;
+        }
+        std::cout << "Serving /" << name << " (" << file.size << "b, ETag " << file.etag
+                  << ")\n";
+        files[name] = file;
+    }
+    if (files.empty()) {
+        std::cerr << "No .zfp or .bcmc files to serve\n";
+        return false;
+    }
+
+    const size_t num_workers = worker_thread_count();
+    std::vector<std::unique_ptr<Server>> servers;
+    for (size_t i = 0; i < num_workers; ++i) {
+        servers.emplace_back(new Server(files));
+        if (!servers.back()->listen(options)) {
+            return false;
+        }
+    }
+    std::cout << "Listening on http://" << options.bind_address << ":" << options.port
+              << " with " << num_workers << " threads" << std::endl;
+    parallel_for(0, num_workers, [&](const size_t begin, const size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            servers[i]->run();
+        }
+    });
+    return false;
+}
+
+#else
+
+bool serve_files(const std::vector<std::string> &, const ServeOptions &)
+{
+    std::cerr << "-serve is only supported on Linux\n";
+    return false;
+}
+
+#endif
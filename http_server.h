@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct ServeOptions {
+    uint16_t port = 8080;
+    std::string bind_address = "127.0.0.1";
+};
+
+// Serve .zfp and .bcmc outputs over HTTP so viewers can fetch only the parts they need.
+// Files are served by name, e.g. GET /volume_256x256x256_uint8.raw.crate8.zfp, with support
+// for byte Range requests and precomputed ETags. Parts of a file can also be selected by
+// query:
+//   ?blocks=first-last        The byte range of the blocks of a .zfp stream
+//   ?stream=i                 Stream i of a .bcmc file
+//   ?stream=i&blocks=a-b      Blocks a-b of stream i of a .bcmc file
+// Range headers then apply within the selection. Each worker thread runs its own epoll loop
+// on a SO_REUSEPORT listening socket and sends file data with sendfile. Directories are
+// expanded to the .zfp and .bcmc files they contain. Only supported on Linux. Runs until
+// the process is killed, returns false if the server could not be started.
+bool serve_files(const std::vector<std::string> &paths, const ServeOptions &options);
@@ -0,0 +1,660 @@
+#include "input_reader.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "direct_io.h"
+#include "large_buffer.h"
+#include "parallel.h"
+#include "profiler.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define BCMC_HAVE_PREAD 1
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef __NR_io_uring_setup
+#define BCMC_HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+namespace {
+
+// Reads are issued at offsets and lengths aligned to this, so they can be served straight
+// into the block buffers, and with O_DIRECT
+constexpr size_t READ_ALIGNMENT = DIRECT_IO_ALIGNMENT;
+
+size_t round_up(size_t x, size_t align)
+{
+    return ((x + align - 1) / align) * align;
+}
+
+// The split of the range being read into blocks of whole elements, and the aligned range of
+// the file read for each
+struct BlockLayout {
+    size_t offset = 0;
+    size_t bytes = 0;
+    size_t block_bytes = 0;
+    size_t num_blocks = 0;
+    // Size of the block buffers, with room for the alignment before and after the block
+    size_t buffer_bytes = 0;
+
+    BlockLayout(size_t offset, size_t bytes, size_t element_size, size_t target_block_bytes)
+        : offset(offset), bytes(bytes)
+    {
+        const size_t unit = element_size * READ_ALIGNMENT;
+        block_bytes = std::max(size_t(1), target_block_bytes / unit) * unit;
+        num_blocks = (bytes + block_bytes - 1) / block_bytes;
+        buffer_bytes = block_bytes + 2 * READ_ALIGNMENT;
+    }
+
+    size_t begin(size_t i) const
+    {
+        return i * block_bytes;
+    }
+
+    size_t end(size_t i) const
+    {
+        return std::min(bytes, (i + 1) * block_bytes);
+    }
+
+    size_t read_begin(size_t i) const
+    {
+        return (offset + begin(i)) / READ_ALIGNMENT * READ_ALIGNMENT;
+    }
+
+    size_t read_bytes(size_t i) const
+    {
+        return round_up(offset + end(i), READ_ALIGNMENT) - read_begin(i);
+    }
+
+    // Bytes which must be read for the block to be complete, the aligned read may run past the
+    // end of the file
+    size_t needed_bytes(size_t i) const
+    {
+        return offset + end(i) - read_begin(i);
+    }
+
+    // Pass the block in the buffer it was read into on to fn
+    void deliver(size_t i, const uint8_t *buffer, const FileBlockFn &fn) const
+    {
+        fn(buffer + (offset + begin(i) - read_begin(i)), begin(i), end(i) - begin(i));
+    }
+};
+
+// Page aligned storage for a set of block buffers
+class BlockBuffers {
+    LargeVector<uint8_t> storage;
+    uint8_t *base = nullptr;
+    size_t buffer_bytes = 0;
+
+public:
+    BlockBuffers(size_t count, size_t buffer_bytes) : buffer_bytes(buffer_bytes)
+    {
+        storage.resize(count * buffer_bytes + READ_ALIGNMENT);
+        const uintptr_t address = reinterpret_cast<uintptr_t>(storage.data());
+        base = storage.data() + (round_up(address, READ_ALIGNMENT) - address);
+    }
+
+    uint8_t *operator[](size_t i)
+    {
+        return base + i * buffer_bytes;
+    }
+};
+
+#ifdef BCMC_HAVE_PREAD
+int open_input(const std::string &file_name, bool direct, bool &opened_direct)
+{
+    opened_direct = false;
+    if (direct) {
+        return open_direct(file_name, O_RDONLY, opened_direct);
+    }
+    const int fd = ::open(file_name.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Failed to open " << file_name << "\n";
+    }
+    return fd;
+}
+
+// Close the input, dropping the pages read from the cache if it was meant to be read direct
+void close_input(int fd, const BlockLayout &layout, bool direct, bool opened_direct)
+{
+    if (direct && !opened_direct) {
+        drop_cached_pages(
+            fd, layout.read_begin(0), layout.offset + layout.bytes - layout.read_begin(0));
+    }
+    ::close(fd);
+}
+#endif
+
+bool read_blocks_pread(const std::string &file_name,
+                       const BlockLayout &layout,
+                       bool direct,
+                       const FileBlockFn &fn)
+{
+    PROFILE_ZONE("read_blocks_pread");
+#ifdef BCMC_HAVE_PREAD
+    bool opened_direct = false;
+    const int fd = open_input(file_name, direct, opened_direct);
+    if (fd < 0) {
+        return false;
+    }
+#endif
+    const size_t num_workers = std::min(worker_thread_count(), layout.num_blocks);
+    BlockBuffers buffers(num_workers, layout.buffer_bytes);
+    std::atomic<size_t> next_block(0);
+    std::atomic<bool> success(true);
+    parallel_for(0, num_workers, [&](const size_t worker_begin, const size_t worker_end) {
+        for (size_t w = worker_begin; w < worker_end; ++w) {
+            uint8_t *buffer = buffers[w];
+#ifndef BCMC_HAVE_PREAD
+            std::ifstream fin(file_name.c_str(), std::ios::binary);
+#endif
+            for (size_t i = next_block++; i < layout.num_blocks && success; i = next_block++) {
+                const size_t needed = layout.needed_bytes(i);
+                size_t read = 0;
+#ifdef BCMC_HAVE_PREAD
+                while (read < needed) {
+                    const ssize_t n = pread(fd,
+                                            buffer + read,
+                                            layout.read_bytes(i) - read,
+                                            layout.read_begin(i) + read);
+                    if (n < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    if (n <= 0) {
+                        break;
+                    }
+                    read += n;
+                }
+#else
+                fin.seekg(layout.read_begin(i));
+                fin.read(reinterpret_cast<char *>(buffer), needed);
+                read = fin.gcount();
+#endif
+                if (read < needed) {
+                    std::cerr << "Failed to read " << needed << "b at offset "
+                              << layout.read_begin(i) << " of " << file_name << "\n";
+                    success = false;
+                    break;
+                }
+                layout.deliver(i, buffer, fn);
+            }
+        }
+    });
+#ifdef BCMC_HAVE_PREAD
+    close_input(fd, layout, direct, opened_direct);
+#endif
+    return success;
+}
+
+#ifdef BCMC_HAVE_IO_URING
+
+// A minimal io_uring set up through the raw syscalls, so there's no dependency on liburing
+class IoUring {
+    int ring_fd = -1;
+    void *sq_ring = MAP_FAILED;
+    void *cq_ring = MAP_FAILED;
+    size_t sq_ring_bytes = 0;
+    size_t cq_ring_bytes = 0;
+    io_uring_sqe *sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+    size_t sqes_bytes = 0;
+    unsigned *sq_tail = nullptr;
+    unsigned *sq_mask = nullptr;
+    unsigned *sq_array = nullptr;
+    unsigned *cq_head = nullptr;
+    unsigned *cq_tail = nullptr;
+    unsigned *cq_mask = nullptr;
+    io_uring_cqe *cqes = nullptr;
+    // Entries queued since the last submit
+    unsigned queued = 0;
+    std::vector<iovec> iovecs;
+    bool fixed_buffers = false;
+
+public:
+    IoUring() = default;
+
+    IoUring(const IoUring &) = delete;
+    IoUring &operator=(const IoUring &) = delete;
+
+    ~IoUring()
+    {
+        if (sqes != MAP_FAILED) {
+            munmap(sqes, sqes_bytes);
+        }
+        if (cq_ring != MAP_FAILED && cq_ring != sq_ring) {
+            munmap(cq_ring, cq_ring_bytes);
+        }
+        if (sq_ring != MAP_FAILED) {
+            munmap(sq_ring, sq_ring_bytes);
+        }
+        if (ring_fd >= 0) {
+            close(ring_fd);
+        }
+    }
+
+    bool init(unsigned entries)
+    {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+        if (ring_fd < 0) {
+            return false;
+        }
+        sq_ring_bytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_bytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) {
+            sq_ring_bytes = cq_ring_bytes = std::max(sq_ring_bytes, cq_ring_bytes);
+        }
+        sq_ring = mmap(nullptr,
+                       sq_ring_bytes,
+                       PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE,
+                       ring_fd,
+                       IORING_OFF_SQ_RING);
+        if (sq_ring == MAP_FAILED) {
+            return false;
+        }
+        cq_ring = single_mmap ? sq_ring
+                              : mmap(nullptr,
+                                     cq_ring_bytes,
+                                     PROT_READ | PROT_WRITE,
+                                     MAP_SHARED | MAP_POPULATE,
+                                     ring_fd,
+                                     IORING_OFF_CQ_RING);
+        if (cq_ring == MAP_FAILED) {
+            return false;
+        }
+        sqes_bytes = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe *>(mmap(nullptr,
+                                                sqes_bytes,
+                                                PROT_READ | PROT_WRITE,
+                                                MAP_SHARED | MAP_POPULATE,
+                                                ring_fd,
+                                                IORING_OFF_SQES));
+        if (sqes == MAP_FAILED) {
+            return false;
+        }
+        uint8_t *sq = static_cast<uint8_t *>(sq_ring);
+        uint8_t *cq = static_cast<uint8_t *>(cq_ring);
+        sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    // Register the buffers reads go into, so the kernel maps them once instead of on every
+    // read. Reads fall back to readv into the buffers if registering them fails, e.g. when
+    // they're over the locked memory limit
+    void set_buffers(const std::vector<iovec> &buffers)
+    {
+        iovecs = buffers;
+        fixed_buffers = syscall(__NR_io_uring_register,
+                                ring_fd,
+                                IORING_REGISTER_BUFFERS,
+                                iovecs.data(),
+                                unsigned(iovecs.size())) == 0;
+    }
+
+    bool using_fixed_buffers() const
+    {
+        return fixed_buffers;
+    }
+
+    // Queue a read of len bytes at file_offset into buffer, at offset into it
+    void queue_read(int fd, size_t buffer, size_t offset, size_t len, size_t file_offset)
+    {
+        const unsigned tail = *sq_tail;
+        const unsigned index = tail & *sq_mask;
+        io_uring_sqe *sqe = &sqes[index];
+        std::memset(sqe, 0, sizeof(io_uring_sqe));
+        sqe->fd = fd;
+        sqe->off = file_offset;
+        sqe->user_data = buffer;
+        uint8_t *dst = static_cast<uint8_t *>(iovecs[buffer].iov_base) + offset;
+        if (fixed_buffers) {
+            sqe->opcode = IORING_OP_READ_FIXED;
+            sqe->addr = reinterpret_cast<uint64_t>(dst);
+            sqe->len = unsigned(len);
+            sqe->buf_index = uint16_t(buffer);
+        } else {
+            // The iovec is read at submission, each buffer has one read in flight at a time
+            iovecs[buffer].iov_len = len;
+            sqe->opcode = IORING_OP_READV;
+            sqe->addr = reinterpret_cast<uint64_t>(&iovecs[buffer]);
+            sqe->len = 1;
+            iovecs[buffer].iov_base = dst;
+        }
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        ++queued;
+    }
+
+    // Restore the buffer's iovec after a readv into part of it
+    void reset_buffer(size_t buffer, uint8_t *base, size_t bytes)
+    {
+        iovecs[buffer].iov_base = base;
+        iovecs[buffer].iov_len = bytes;
+    }
+
+    // Submit the queued reads and wait for at least min_complete completions
+    bool submit(unsigned min_complete)
+    {
+        while (true) {
+            const int submitted = syscall(__NR_io_uring_enter,
+                                          ring_fd,
+                                          queued,
+                                          min_complete,
+                                          min_complete > 0 ? IORING_ENTER_GETEVENTS : 0,
+                                          nullptr,
+                                          0);
+            if (submitted >= 0) {
+                queued -= std::min(queued, unsigned(submitted));
+                return true;
+            }
+            if (errno != EINTR) {
+                return false;
+            }
+        }
+    }
+
+    // Forget the reads queued since the last submit, which the kernel never took and won't
+    // run. Returns how many there were
+    unsigned drop_queued()
+    {
+        const unsigned dropped = queued;
+        queued = 0;
+        return dropped;
+    }
+
+    // Call fn(buffer, result) for each completed read
+    template <typename F>
+    void reap(const F &fn)
+    {
+        unsigned head = *cq_head;
+        while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+            const io_uring_cqe &cqe = cqes[head & *cq_mask];
+            fn(size_t(cqe.user_data), cqe.res);
+            ++head;
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+};
+
+// Read the blocks through io_uring, keeping a read in flight into each free block buffer.
+// Returns false without reading anything if io_uring isn't available, setting unavailable
+bool read_blocks_uring(const std::string &file_name,
+                       const BlockLayout &layout,
+                       uint32_t queue_depth,
+                       bool direct,
+                       const FileBlockFn &fn,
+                       bool &unavailable)
+{
+    PROFILE_ZONE("read_blocks_uring");
+    const size_t num_buffers =
+        std::min(size_t(std::max(queue_depth, 1u)), std::max(layout.num_blocks, size_t(1)));
+    // Closing the ring doesn't wait for the reads in flight, so every read submitted is reaped
+    // before the buffers are freed, even when reading fails
+    BlockBuffers buffers(num_buffers, layout.buffer_bytes);
+    IoUring ring;
+    unavailable = !ring.init(unsigned(num_buffers));
+    if (unavailable) {
+        return false;
+    }
+    bool opened_direct = false;
+    const int fd = open_input(file_name, direct, opened_direct);
+    if (fd < 0) {
+        return false;
+    }
+    std::vector<iovec> iovecs(num_buffers);
+    for (size_t b = 0; b < num_buffers; ++b) {
+        iovecs[b].iov_base = buffers[b];
+        iovecs[b].iov_len = layout.buffer_bytes;
+    }
+    ring.set_buffers(iovecs);
+
+    // The block in each buffer and how much of it has been read
+    struct BufferState {
+        size_t block = 0;
+        size_t read = 0;
+    };
+    std::vector<BufferState> states(num_buffers);
+
+    // Completed buffers are handed to the workers through the ready queue, and come back
+    // through the free list once fn is done with them
+    std::mutex mutex;
+    std::condition_variable ready_cv, free_cv;
+    std::deque<size_t> ready, free_buffers;
+    bool reading_done = false;
+    for (size_t b = 0; b < num_buffers; ++b) {
+        free_buffers.push_back(b);
+    }
+    std::vector<std::thread> workers;
+    for (size_t w = 0; w < worker_thread_count(); ++w) {
+        workers.emplace_back([&]() {
+            PROFILE_ZONE("io_uring block worker");
+            while (true) {
+                size_t b = 0;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    ready_cv.wait(lock, [&]() { return !ready.empty() || reading_done; });
+                    if (ready.empty()) {
+                        return;
+                    }
+                    b = ready.front();
+                    ready.pop_front();
+                }
+                layout.deliver(states[b].block, buffers[b], fn);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    free_buffers.push_back(b);
+                }
+                free_cv.notify_one();
+            }
+        });
+    }
+
+    bool success = true;
+    size_t next_block = 0;
+    size_t in_flight = 0;
+    while (in_flight > 0 || (success && next_block < layout.num_blocks)) {
+        if (success && next_block < layout.num_blocks) {
+            std::vector<size_t> to_read;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (in_flight == 0) {
+                    free_cv.wait(lock, [&]() { return !free_buffers.empty(); });
+                }
+                while (!free_buffers.empty() &&
+                       next_block + to_read.size() < layout.num_blocks) {
+                    to_read.push_back(free_buffers.front());
+                    free_buffers.pop_front();
+                }
+            }
+            for (const size_t b : to_read) {
+                states[b].block = next_block++;
+                states[b].read = 0;
+                ring.queue_read(fd,
+                                b,
+                                0,
+                                layout.read_bytes(states[b].block),
+                                layout.read_begin(states[b].block));
+                ++in_flight;
+            }
+        }
+        if (!ring.submit(in_flight > 0 ? 1 : 0)) {
+            if (success) {
+                std::cerr << "io_uring submit failed: " << std::strerror(errno) << "\n";
+            }
+            // Stop reading, but keep waiting on the reads the kernel already took, which
+            // still write into the buffers
+            success = false;
+            in_flight -= ring.drop_queued();
+            continue;
+        }
+        ring.reap([&](const size_t b, const int result) {
+            BufferState &state = states[b];
+            const size_t needed = layout.needed_bytes(state.block);
+            if (!ring.using_fixed_buffers()) {
+                ring.reset_buffer(b, buffers[b], layout.buffer_bytes);
+            }
+            if (result > 0 && state.read + result < needed && success) {
+                // Short read, queue the rest of the block
+                state.read += result;
+                ring.queue_read(fd,
+                                b,
+                                state.read,
+                                layout.read_bytes(state.block) - state.read,
+                                layout.read_begin(state.block) + state.read);
+                return;
+            }
+            --in_flight;
+            std::lock_guard<std::mutex> lock(mutex);
+            if (result < 0 || state.read + result < needed || !success) {
+                if (success) {
+                    std::cerr << "Failed to read block at offset "
+                              << layout.read_begin(state.block) << " of " << file_name
+                              << ": "
+                              << (result < 0 ? std::strerror(-result)
+                                             : "unexpected end of file")
+                              << "\n";
+                }
+                success = false;
+                free_buffers.push_back(b);
+                return;
+            }
+            ready.push_back(b);
+            ready_cv.notify_one();
+        });
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        reading_done = true;
+    }
+    ready_cv.notify_all();
+    for (auto &w : workers) {
+        w.join();
+    }
+    close_input(fd, layout, direct, opened_direct);
+    return success;
+}
+
+#endif
+
+}
+
+bool parse_read_backend(const std::string &name, ReadBackend &backend)
+{
+    if (name == "mmap") {
+        backend = ReadBackend::MMAP;
+    } else if (name == "uring") {
+        backend = ReadBackend::URING;
+    } else if (name == "pread") {
+        backend = ReadBackend::PREAD;
+    } else {
+        std::cout << "Unknown read backend '" << name << "', expected mmap, uring or pread\n";
+        return false;
+    }
+    return true;
+}
+
+const char *read_backend_name(ReadBackend backend)
+{
+    switch (backend) {
+    case ReadBackend::URING:
+        return "io_uring";
+    case ReadBackend::PREAD:
+        return "pread";
+    default:
+        break;
+    }
+    return "mmap";
+}
+
+size_t read_buffer_bytes(const InputReadOptions &options, size_t num_threads)
+{
+    if (options.backend == ReadBackend::MMAP) {
+        return 0;
+    }
+    // Blocks hold at least one aligned page per byte of the element size
+    const size_t buffer_bytes =
+        std::max(options.block_bytes, 8 * READ_ALIGNMENT) + 2 * READ_ALIGNMENT;
+    // io_uring keeps a buffer per read in flight, but falls back to a buffer per worker
+    size_t num_buffers = num_threads;
+    if (options.backend == ReadBackend::URING) {
+        num_buffers = std::max(num_buffers, size_t(options.queue_depth));
+    }
+    return num_buffers * buffer_bytes + READ_ALIGNMENT;
+}
+
+bool read_file_blocks(const std::string &file_name,
+                      size_t offset,
+                      size_t bytes,
+                      size_t element_size,
+                      const InputReadOptions &options,
+                      const FileBlockFn &fn)
+{
+    using namespace std::chrono;
+    if (bytes == 0) {
+        return true;
+    }
+    const BlockLayout layout(offset, bytes, element_size, options.block_bytes);
+    ReadBackend backend = options.backend;
+    auto start = steady_clock::now();
+    bool success = false;
+#ifdef BCMC_HAVE_IO_URING
+    if (backend == ReadBackend::URING) {
+        bool unavailable = false;
+        success = read_blocks_uring(
+            file_name, layout, options.queue_depth, options.direct, fn, unavailable);
+        if (unavailable) {
+            std::cout << "io_uring is unavailable, reading with pread\n";
+            backend = ReadBackend::PREAD;
+        }
+    }
+#else
+    if (backend == ReadBackend::URING) {
+        std::cout << "io_uring is not supported on this platform, reading with pread\n";
+        backend = ReadBackend::PREAD;
+    }
+#endif
+    if (backend != ReadBackend::URING) {
+        success = read_blocks_pread(file_name, layout, options.direct, fn);
+    }
+    const double elapsed_ms =
+        duration_cast<microseconds>(steady_clock::now() - start).count() / 1000.0;
+    if (success) {
+        std::cout << "Read " << bytes << "b in " << layout.num_blocks << " blocks with "
+                  << read_backend_name(backend);
+        if (backend == ReadBackend::URING) {
+            std::cout << " (queue depth " << options.queue_depth << ")";
+        }
+        if (options.direct) {
+            std::cout << " bypassing the page cache";
+        }
+        std::cout << " in " << elapsed_ms << "ms, "
+                  << (elapsed_ms > 0.0 ? bytes / (elapsed_ms * 1e6) : 0.0) << "GB/s\n";
+    }
+    return success;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+enum class ReadBackend {
+    // Map the input and convert from the mapping, the default
+    MMAP,
+    // Keep queue_depth block reads in flight with io_uring, falling back to PREAD if the
+    // kernel doesn't support it
+    URING,
+    // Read blocks with pread from a pool of worker threads
+    PREAD
+};
+
+struct InputReadOptions {
+    ReadBackend backend = ReadBackend::MMAP;
+    // Number of block reads in flight, and of block buffers, for io_uring
+    uint32_t queue_depth = 32;
+    size_t block_bytes = size_t(4) << 20;
+    // Read with O_DIRECT, bypassing the page cache (-direct-io)
+    bool direct = false;
+};
+
+// The read options used for uncompressed inputs, set by the -io options
+inline InputReadOptions &input_read_options()
+{
+    static InputReadOptions options;
+    return options;
+}
+
+// Parse a read backend name: mmap, uring or pread
+bool parse_read_backend(const std::string &name, ReadBackend &backend);
+
+const char *read_backend_name(ReadBackend backend);
+
+// Upper bound on the memory held by the block buffers of read_file_blocks with these options
+// and num_threads worker threads, for planning memory use (see memory_plan.h)
+size_t read_buffer_bytes(const InputReadOptions &options, size_t num_threads);
+
+// Called with a block of the range being read, holding whole elements starting bytes_offset
+// bytes into the range. Called concurrently from the worker threads, in no particular order
+using FileBlockFn =
+    std::function<void(const uint8_t *data, size_t bytes_offset, size_t bytes)>;
+
+// Read the bytes [offset, offset + bytes) of the file with the URING or PREAD backend, in
+// blocks of about options.block_bytes holding whole elements of element_size bytes, and pass
+// each to fn as it arrives. Reads are issued at page aligned offsets into page aligned block
+// buffers, which are reused once fn returns. With io_uring the calling thread keeps the ring
+// full while the worker threads run fn on completed blocks, with the pread fallback each
+// worker reads its next block and runs fn on it. With options.direct the file is read with
+// O_DIRECT, or where that's not supported its pages are dropped from the cache once read.
+bool read_file_blocks(const std::string &file_name,
+                      size_t offset,
+                      size_t bytes,
+                      size_t element_size,
+                      const InputReadOptions &options,
+                      const FileBlockFn &fn);
@@ -0,0 +1,118 @@
+#include "large_buffer.h"
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+#include "parallel.h"
+#include "profiler.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Buffers smaller than this go through the regular heap, there's nothing to gain from huge
+// pages or a parallel first touch for them
+constexpr size_t LARGE_BUFFER_THRESHOLD = size_t(4) << 20;
+constexpr size_t HUGE_PAGE_SIZE = size_t(2) << 20;
+
+std::mutex stats_mutex;
+LargeBufferStats stats;
+
+size_t page_size()
+{
+#ifdef __linux__
+    static const size_t size = sysconf(_SC_PAGESIZE);
+    return size;
+#else
+    return 4096;
+#endif
+}
+
+size_t round_up(size_t x, size_t align)
+{
+    return ((x + align - 1) / align) * align;
+}
+
+}
+
+void *large_buffer_alloc(size_t bytes)
+{
+    PROFILE_ZONE("large_buffer_alloc");
+    using namespace std::chrono;
+    auto start = steady_clock::now();
+
+    void *ptr = nullptr;
+#ifdef __linux__
+    if (bytes >= LARGE_BUFFER_THRESHOLD) {
+        // Over-allocate so we can trim the mapping to start on a huge page boundary, which is
+        // required for the kernel to back it with transparent huge pages
+        const size_t mapped_bytes = round_up(bytes, page_size());
+        const size_t reserve_bytes = mapped_bytes + HUGE_PAGE_SIZE;
+        void *reserved = mmap(nullptr,
+                              reserve_bytes,
+                              PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS,
+                              -1,
+                              0);
+        if (reserved == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        uint8_t *base = static_cast<uint8_t *>(reserved);
+        uint8_t *aligned = reinterpret_cast<uint8_t *>(
+            round_up(reinterpret_cast<uintptr_t>(base), HUGE_PAGE_SIZE));
+        if (aligned != base) {
+            munmap(base, aligned - base);
+        }
+        const size_t tail = (base + reserve_bytes) - (aligned + mapped_bytes);
+        if (tail != 0) {
+            munmap(aligned + mapped_bytes, tail);
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(aligned, mapped_bytes, MADV_HUGEPAGE);
+#endif
+        // First touch each page from the worker that will process it
+        const size_t stride = page_size();
+        parallel_for(0, bytes, [&](const size_t begin, const size_t end) {
+            for (size_t i = round_up(begin, stride); i < end; i += stride) {
+                aligned[i] = 0;
+            }
+        });
+        ptr = aligned;
+    }
+#endif
+    if (!ptr) {
+        ptr = std::malloc(bytes);
+        if (!ptr && bytes != 0) {
+            throw std::bad_alloc();
+        }
+    }
+
+    auto end = steady_clock::now();
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    stats.bytes_allocated += bytes;
+    stats.num_allocations++;
+    stats.alloc_ms += duration_cast<duration<double, std::milli>>(end - start).count();
+    return ptr;
+}
+
+void large_buffer_free(void *ptr, size_t bytes)
+{
+    if (!ptr) {
+        return;
+    }
+#ifdef __linux__
+    if (bytes >= LARGE_BUFFER_THRESHOLD) {
+        munmap(ptr, round_up(bytes, page_size()));
+        return;
+    }
+#endif
+    std::free(ptr);
+}
+
+LargeBufferStats large_buffer_stats()
+{
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    return stats;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Allocate a buffer for a large volume or compressed stream. On Linux large buffers are
+// mmap'd, aligned to and advised for transparent huge pages, and first touched in parallel
+// using the same partitioning as parallel_for so pages are placed on the NUMA node of the
+// worker that will fill them. The contents of the returned buffer are unspecified.
+void *large_buffer_alloc(size_t bytes);
+
+void large_buffer_free(void *ptr, size_t bytes);
+
+struct LargeBufferStats {
+    size_t bytes_allocated = 0;
+    size_t num_allocations = 0;
+    // Total time spent allocating and first touching large buffers
+    double alloc_ms = 0.0;
+};
+
+LargeBufferStats large_buffer_stats();
+
+// Allocator for std::vector which uses large_buffer_alloc and default initializes elements
+// on resize(n) instead of value initializing them, so resizing a vector of floats or bytes
+// does not zero fill memory which is about to be overwritten.
+template <typename T>
+struct LargeBufferAllocator {
+    using value_type = T;
+
+    LargeBufferAllocator() = default;
+
+    template <typename U>
+    LargeBufferAllocator(const LargeBufferAllocator<U> &)
+    {
+    }
+
+    T *allocate(size_t n)
+    {
+        return static_cast<T *>(large_buffer_alloc(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n)
+    {
+        large_buffer_free(p, n * sizeof(T));
+    }
+
+    template <typename U>
+    void construct(U *p)
+    {
+        ::new (static_cast<void *>(p)) U;
+    }
+
+    template <typename U, typename... Args>
+    void construct(U *p, Args &&... args)
+    {
+        ::new (static_cast<void *>(p)) U(std::forward<Args>(args)...);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const LargeBufferAllocator<T> &, const LargeBufferAllocator<U> &)
+{
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const LargeBufferAllocator<T> &, const LargeBufferAllocator<U> &)
+{
+    return false;
+}
+
+template <typename T>
+using LargeVector = std::vector<T, LargeBufferAllocator<T>>;
+
+using VolumeBuffer = LargeVector<float>;
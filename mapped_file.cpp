@@ -0,0 +1,198 @@
+#include "mapped_file.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define BCMC_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const std::string &file_name)
+{
+    close();
+#ifdef BCMC_HAVE_MMAP
+    const int fd = ::open(file_name.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Failed to open " << file_name << "\n";
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        std::cerr << "Failed to stat " << file_name << "\n";
+        return false;
+    }
+    mapped_size = st.st_size;
+    if (mapped_size == 0) {
+        ::close(fd);
+        return true;
+    }
+    void *m = mmap(nullptr, mapped_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) {
+        mapped_size = 0;
+        std::cerr << "Failed to mmap " << file_name << "\n";
+        return false;
+    }
+    mapping = static_cast<const uint8_t *>(m);
+    return true;
+#else
+    std::ifstream fin(file_name.c_str(), std::ios::binary | std::ios::ate);
+    if (!fin) {
+        std::cerr << "Failed to open " << file_name << "\n";
+        return false;
+    }
+    fallback_data.resize(fin.tellg());
+    fin.seekg(0);
+    fin.read(reinterpret_cast<char *>(fallback_data.data()), fallback_data.size());
+    mapping = fallback_data.data();
+    mapped_size = fallback_data.size();
+    return true;
+#endif
+}
+
+void MappedFile::close()
+{
+#ifdef BCMC_HAVE_MMAP
+    if (mapping) {
+        munmap(const_cast<uint8_t *>(mapping), mapped_size);
+    }
+#endif
+    fallback_data = std::vector<uint8_t>();
+    mapping = nullptr;
+    mapped_size = 0;
+}
+
+void MappedFile::will_need(size_t offset, size_t bytes) const
+{
+#ifdef BCMC_HAVE_MMAP
+    if (!mapping || offset >= mapped_size) {
+        return;
+    }
+    // madvise requires a page aligned start address
+    const size_t page = sysconf(_SC_PAGESIZE);
+    const size_t aligned_offset = (offset / page) * page;
+    bytes = std::min(bytes + offset - aligned_offset, mapped_size - aligned_offset);
+    madvise(const_cast<uint8_t *>(mapping) + aligned_offset, bytes, MADV_WILLNEED);
+#endif
+}
+
+MappedOutputFile::~MappedOutputFile()
+{
+    close();
+}
+
+bool MappedOutputFile::open(const std::string &name, size_t size, bool truncate)
+{
+    close();
+    file_name = name;
+#ifdef BCMC_HAVE_MMAP
+    fd = ::open(name.c_str(), O_RDWR | O_CREAT | (truncate ? O_TRUNC : 0), 0644);
+    if (fd < 0) {
+        std::cerr << "Failed to open " << name << ": " << std::strerror(errno) << "\n";
+        return false;
+    }
+    if (ftruncate(fd, size) != 0) {
+        std::cerr << "Failed to resize " << name << ": " << std::strerror(errno) << "\n";
+        close();
+        return false;
+    }
+#ifdef __linux__
+    // On file systems without fallocate, posix_fallocate writes a zero byte to each block not
+    // already holding data instead, so the file is never left sparse
+    const int err = size > 0 ? posix_fallocate(fd, 0, size) : 0;
+    if (err != 0) {
+        if (err == ENOSPC) {
+            std::cerr << "Not enough space for the " << size << "B output " << name << "\n";
+        } else {
+            std::cerr << "Failed to allocate " << name << ": " << std::strerror(err) << "\n";
+        }
+        close();
+        return false;
+    }
+#endif
+    mapped_size = size;
+    if (mapped_size == 0) {
+        return true;
+    }
+    void *m = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED) {
+        std::cerr << "Failed to mmap " << name << ": " << std::strerror(errno) << "\n";
+        close();
+        return false;
+    }
+    mapping = static_cast<uint8_t *>(m);
+    return true;
+#else
+    fallback_data.resize(size);
+    if (!truncate) {
+        std::ifstream fin(name.c_str(), std::ios::binary);
+        fin.read(reinterpret_cast<char *>(fallback_data.data()), fallback_data.size());
+    }
+    mapping = fallback_data.data();
+    mapped_size = size;
+    fd = 0;
+    return true;
+#endif
+}
+
+bool MappedOutputFile::close()
+{
+    if (fd < 0) {
+        return true;
+    }
+    bool success = true;
+#ifdef BCMC_HAVE_MMAP
+    // Wait for the mapping to be written back, so errors writing it are reported here rather
+    // than lost with the page cache
+    if (mapping) {
+        if (msync(mapping, mapped_size, MS_SYNC) != 0) {
+            std::cerr << "Failed to write back " << file_name << ": " << std::strerror(errno)
+                      << "\n";
+            success = false;
+        }
+        munmap(mapping, mapped_size);
+    }
+    if (::close(fd) != 0) {
+        std::cerr << "Failed to close " << file_name << ": " << std::strerror(errno) << "\n";
+        success = false;
+    }
+#else
+    std::ofstream fout(file_name.c_str(), std::ios::binary | std::ios::trunc);
+    fout.write(reinterpret_cast<const char *>(fallback_data.data()), fallback_data.size());
+    success = bool(fout);
+    fallback_data = std::vector<uint8_t>();
+#endif
+    fd = -1;
+    mapping = nullptr;
+    mapped_size = 0;
+    return success;
+}
+
+void MappedOutputFile::write_back(size_t offset, size_t bytes)
+{
+#ifdef BCMC_HAVE_MMAP
+    if (!mapping || offset >= mapped_size) {
+        return;
+    }
+    bytes = std::min(bytes, mapped_size - offset);
+#ifdef SYNC_FILE_RANGE_WRITE
+    sync_file_range(fd, offset, bytes, SYNC_FILE_RANGE_WRITE);
+#else
+    const size_t page = sysconf(_SC_PAGESIZE);
+    const size_t aligned_offset = (offset / page) * page;
+    msync(mapping + aligned_offset, bytes + offset - aligned_offset, MS_ASYNC);
+#endif
+#endif
+}
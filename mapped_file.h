@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A read only memory mapping of a file. On platforms without mmap the file is read into
+// memory instead.
+class MappedFile {
+    const uint8_t *mapping = nullptr;
+    size_t mapped_size = 0;
+    std::vector<uint8_t> fallback_data;
+
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool open(const std::string &file_name);
+
+    void close();
+
+    const uint8_t *data() const
+    {
+        return mapping;
+    }
+
+    size_t size() const
+    {
+        return mapped_size;
+    }
+
+    // Hint that the range will be read sequentially soon, so the kernel can start read ahead
+    void will_need(size_t offset, size_t bytes) const;
+};
+
+// A writable shared memory mapping of an output file of a size known up front. The file is
+// set to the size and its blocks allocated when opened, so running out of disk fails then
+// instead of as a SIGBUS while writing through the mapping. Pages written to the mapping
+// belong to the page cache, and are written back by the kernel as they're filled or when
+// write_back is called. On platforms without mmap the file is built in memory and written
+// out by close instead.
+class MappedOutputFile {
+    std::string file_name;
+    int fd = -1;
+    uint8_t *mapping = nullptr;
+    size_t mapped_size = 0;
+    std::vector<uint8_t> fallback_data;
+
+public:
+    MappedOutputFile() = default;
+    ~MappedOutputFile();
+
+    MappedOutputFile(const MappedOutputFile &) = delete;
+    MappedOutputFile &operator=(const MappedOutputFile &) = delete;
+
+    // Open or create the file and map size bytes of it. With truncate its contents are
+    // discarded, otherwise existing contents within size are kept
+    bool open(const std::string &file_name, size_t size, bool truncate);
+
+    // Write back the mapping, waiting for it to reach the disk, and unmap the file. Returns
+    // false if the contents couldn't be written
+    bool close();
+
+    uint8_t *data()
+    {
+        return mapping;
+    }
+
+    size_t size() const
+    {
+        return mapped_size;
+    }
+
+    // Start writing back the range to disk without waiting for it to complete
+    void write_back(size_t offset, size_t bytes);
+};
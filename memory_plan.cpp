@@ -0,0 +1,250 @@
+#include "memory_plan.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include "compress.h"
+#include "compressed_input.h"
+#include "hdf5_input.h"
+#include "input_reader.h"
+#include "parallel.h"
+
+namespace {
+
+// Allowance for the program itself, the threads and the small tables of each stage
+constexpr size_t BASE_BYTES = size_t(64) << 20;
+
+// The smallest slabs and read blocks tried before giving up on a strategy, unless a smaller
+// -checkpoint-mb is asked for, which is started from as is
+constexpr size_t MIN_SLAB_BYTES = size_t(16) << 20;
+constexpr size_t MIN_BLOCK_BYTES = size_t(1) << 20;
+
+std::string format_memory_size(size_t bytes)
+{
+    std::ostringstream str;
+    str << std::fixed << std::setprecision(1);
+    if (bytes >= size_t(1) << 30) {
+        str << bytes / double(size_t(1) << 30) << "GB";
+    } else {
+        str << bytes / double(size_t(1) << 20) << "MB";
+    }
+    return str.str();
+}
+
+// The buffers of the input's reader or decoder
+size_t input_buffer_bytes(const MemoryPlanInput &input,
+                          const InputReadOptions &read_options,
+                          size_t num_threads)
+{
+    const RawVolumeInfo *info = input.input;
+    if (!info) {
+        return 0;
+    }
+    const size_t raw_bytes = size_t(info->dims.x) * info->dims.y * info->dims.z *
+                             dtype_size(info->voxel_type.dtype);
+    if (!info->hdf5_dataset.empty()) {
+        return hdf5_buffer_bytes(*info, num_threads);
+    }
+    if (info->compression != InputCompression::NONE) {
+        return compressed_input_buffer_bytes(info->compression, raw_bytes, num_threads);
+    }
+    return read_buffer_bytes(read_options, num_threads);
+}
+
+// Whether the input is read in blocks by read_file_blocks, whose size the plan sets
+bool uses_read_blocks(const MemoryPlanInput &input)
+{
+    return input.input && input.input->hdf5_dataset.empty() &&
+           input.input->compression == InputCompression::NONE &&
+           input_read_options().backend != ReadBackend::MMAP;
+}
+
+// Slices of the input streamed per slab by compress_raw_volume_streamed
+uint32_t stream_slab_slices(const MemoryPlanInput &input, const CheckpointOptions &options)
+{
+    uint32_t slices = checkpoint_slab_slices(input.volume_dims, options);
+    if (input.input && !input.input->hdf5_dataset.empty()) {
+        slices = hdf5_slab_slices(*input.input, slices);
+    }
+    return std::min(slices, input.volume_dims.z);
+}
+
+size_t estimate_peak_bytes(const MemoryPlanInput &input,
+                           LoadStrategy strategy,
+                           size_t slab_bytes,
+                           size_t block_bytes,
+                           size_t num_threads,
+                           const CheckpointOptions &checkpoint_options)
+{
+    const glm::uvec3 dims = input.volume_dims;
+    const size_t slice_bytes = size_t(dims.x) * dims.y * sizeof(float);
+    InputReadOptions read_options = input_read_options();
+    read_options.block_bytes = block_bytes;
+    CheckpointOptions options = checkpoint_options;
+    options.slab_bytes = slab_bytes;
+
+    size_t bytes = BASE_BYTES + input_buffer_bytes(input, read_options, num_threads);
+    if (strategy == LoadStrategy::SLAB_STREAM) {
+        const uint32_t slices = stream_slab_slices(input, options);
+        bytes += slices * slice_bytes;
+        bytes += SlabStreamWriter::buffer_bytes(dims, input.compression_rate, slices, options);
+        return bytes;
+    }
+    bytes += dims.z * slice_bytes;
+    bytes += SlabStreamWriter::buffer_bytes(
+        dims, input.compression_rate, checkpoint_slab_slices(dims, options), options);
+    if (input.resample) {
+        bytes += slab_bytes;
+    }
+    if (strategy == LoadStrategy::MULTI_RATE) {
+        // Adaptive rates hold the blocks of each rate in turn, at most the whole volume at
+        // the highest rate
+        bytes += fixed_rate_stream_bytes(dims, input.compression_rate);
+    }
+    return bytes;
+}
+
+}
+
+bool parse_memory_size(const std::string &str, size_t &bytes)
+{
+    size_t end = 0;
+    double value = 0.0;
+    try {
+        value = std::stod(str, &end);
+    } catch (const std::exception &) {
+        end = 0;
+    }
+    std::string suffix = str.substr(end);
+    std::transform(suffix.begin(), suffix.end(), suffix.begin(), [](unsigned char c) {
+        return char(std::toupper(c));
+    });
+    int shift = -1;
+    if (suffix.empty() || suffix == "B") {
+        shift = 0;
+    } else if (suffix[0] == 'K' || suffix[0] == 'M' || suffix[0] == 'G' || suffix[0] == 'T') {
+        const std::string unit = suffix.substr(1);
+        if (unit.empty() || unit == "B" || unit == "IB") {
+            shift = suffix[0] == 'K' ? 10 : suffix[0] == 'M' ? 20 : suffix[0] == 'G' ? 30 : 40;
+        }
+    }
+    if (end == 0 || shift < 0 || value <= 0.0) {
+        std::cout << "Invalid memory size '" << str << "', expected e.g. 512M, 16G or 1.5T\n";
+        return false;
+    }
+    bytes = size_t(value * double(size_t(1) << shift));
+    return true;
+}
+
+const char *load_strategy_name(LoadStrategy strategy)
+{
+    switch (strategy) {
+    case LoadStrategy::SLAB_STREAM:
+        return "slab streaming";
+    case LoadStrategy::MULTI_RATE:
+        return "multi-rate";
+    default:
+        break;
+    }
+    return "full load";
+}
+
+bool plan_memory(const MemoryPlanInput &input,
+                 size_t max_bytes,
+                 const CheckpointOptions &checkpoint_options,
+                 MemoryPlan &plan)
+{
+    const LoadStrategy load_strategy =
+        input.multi_rate ? LoadStrategy::MULTI_RATE : LoadStrategy::FULL_LOAD;
+    std::vector<LoadStrategy> strategies = {load_strategy};
+    if (input.can_stream && !input.multi_rate) {
+        strategies.push_back(LoadStrategy::SLAB_STREAM);
+    }
+    const size_t default_slab_bytes = checkpoint_options.slab_bytes;
+    const size_t min_slab_bytes = std::min(default_slab_bytes, MIN_SLAB_BYTES);
+    const size_t default_block_bytes =
+        std::max(input_read_options().block_bytes, MIN_BLOCK_BYTES);
+
+    MemoryPlan smallest;
+    smallest.peak_bytes = SIZE_MAX;
+    // Fewer threads are only tried when the input keeps buffers per thread
+    for (size_t threads = worker_thread_count(); threads > 0; threads /= 2) {
+        for (const LoadStrategy strategy : strategies) {
+            // Shrink the slabs and read blocks together until they're at their smallest
+            for (size_t level = 0;; ++level) {
+                MemoryPlan candidate;
+                candidate.strategy = strategy;
+                candidate.slab_bytes = std::max(default_slab_bytes >> level, min_slab_bytes);
+                candidate.io_block_bytes =
+                    std::max(default_block_bytes >> level, MIN_BLOCK_BYTES);
+                candidate.num_threads = threads;
+                candidate.peak_bytes = estimate_peak_bytes(input,
+                                                           strategy,
+                                                           candidate.slab_bytes,
+                                                           candidate.io_block_bytes,
+                                                           threads,
+                                                           checkpoint_options);
+                if (candidate.peak_bytes < smallest.peak_bytes) {
+                    smallest = candidate;
+                }
+                if (candidate.peak_bytes <= max_bytes) {
+                    plan = candidate;
+                    if (!uses_read_blocks(input)) {
+                        plan.io_block_bytes = 0;
+                    }
+                    plan.full_load_bytes = estimate_peak_bytes(input,
+                                                               load_strategy,
+                                                               default_slab_bytes,
+                                                               default_block_bytes,
+                                                               worker_thread_count(),
+                                                               checkpoint_options);
+                    return true;
+                }
+                if (candidate.slab_bytes == min_slab_bytes &&
+                    candidate.io_block_bytes == MIN_BLOCK_BYTES) {
+                    break;
+                }
+            }
+        }
+        const InputReadOptions &read_options = input_read_options();
+        if (threads == 1 || input_buffer_bytes(input, read_options, threads) ==
+                                input_buffer_bytes(input, read_options, 1)) {
+            break;
+        }
+    }
+    std::cout << "No plan fits in -max-mem " << format_memory_size(max_bytes) << ": the "
+              << "smallest, " << load_strategy_name(smallest.strategy) << " with "
+              << format_memory_size(smallest.slab_bytes) << " slabs and "
+              << smallest.num_threads << (smallest.num_threads == 1 ? " thread" : " threads")
+              << ", needs about "
+              << format_memory_size(smallest.peak_bytes) << "\n";
+    if (input.multi_rate) {
+        std::cout << "-adaptive-rates and rate targets need the whole volume loaded\n";
+    } else if (!input.can_stream) {
+        std::cout << "Slab streaming is only possible for raw volumes without -shard, "
+                     "-resample, -pad, -bcmc-ref or -resume\n";
+    }
+    return false;
+}
+
+void print_memory_plan(const MemoryPlan &plan, size_t max_bytes)
+{
+    std::cout << "Memory plan for -max-mem " << format_memory_size(max_bytes) << ": "
+              << load_strategy_name(plan.strategy) << ", "
+              << format_memory_size(plan.slab_bytes) << " slabs, ";
+    if (plan.io_block_bytes > 0) {
+        std::cout << format_memory_size(plan.io_block_bytes) << " read blocks, ";
+    }
+    std::cout << plan.num_threads << (plan.num_threads == 1 ? " thread" : " threads")
+              << ", peak about "
+              << format_memory_size(plan.peak_bytes);
+    if (plan.strategy == LoadStrategy::SLAB_STREAM) {
+        std::cout << " (full load needs about " << format_memory_size(plan.full_load_bytes)
+                  << ")";
+    }
+    std::cout << "\n";
+}
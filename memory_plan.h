@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <glm/glm.hpp>
+#include "checkpoint.h"
+#include "raw_volume.h"
+
+// Parse a memory size such as 512M, 16G or 1.5T, in powers of 1024, or a plain byte count
+bool parse_memory_size(const std::string &str, size_t &bytes);
+
+enum class LoadStrategy {
+    // Load or generate the whole volume as floats, then compress it in checkpointed slabs
+    FULL_LOAD,
+    // Stream the input in slabs of block layers, compressing each slab as it's converted
+    SLAB_STREAM,
+    // Load the whole volume for -adaptive-rates or a rate target, which compress or sample
+    // it at several rates
+    MULTI_RATE
+};
+
+const char *load_strategy_name(LoadStrategy strategy);
+
+// The volume being compressed, for estimating the memory each strategy needs
+struct MemoryPlanInput {
+    // Dims of the float volume compressed: padded, resampled or the slices of a shard
+    glm::uvec3 volume_dims = glm::uvec3(0);
+    // The raw input, null for generated volumes
+    const RawVolumeInfo *input = nullptr;
+    // The fixed rate the volume is compressed at, or the highest rate tried by multi-rate
+    int compression_rate = 32;
+    bool multi_rate = false;
+    // Whether the volume can be streamed from its input instead of loaded
+    bool can_stream = false;
+    // Resampled inputs stream through in float slabs of the plan's slab_bytes
+    bool resample = false;
+};
+
+struct MemoryPlan {
+    LoadStrategy strategy = LoadStrategy::FULL_LOAD;
+    // Estimated peak memory use of the plan, and of loading the full volume
+    size_t peak_bytes = 0;
+    size_t full_load_bytes = 0;
+    // Size of the float slabs compressed between checkpoints or streamed from the input
+    size_t slab_bytes = 0;
+    // Size of the blocks uncompressed inputs are read in, 0 if they're mapped instead
+    size_t io_block_bytes = 0;
+    size_t num_threads = 0;
+};
+
+// Estimate the peak memory use of each strategy that can compress the volume, from the float
+// volume or slab, the stream buffers of checkpoint_options and the buffers of the input's
+// reader or decoder, and pick the fastest plan that fits in max_bytes. Loading the full volume
+// is preferred, then streaming it, each with the largest slabs and read blocks that fit, and
+// with fewer threads only when per thread buffers don't fit otherwise. Mapped inputs and
+// outputs are in the page cache, which the kernel reclaims, so they aren't counted. Returns
+// false and prints the smallest estimate if no plan fits.
+bool plan_memory(const MemoryPlanInput &input,
+                 size_t max_bytes,
+                 const CheckpointOptions &checkpoint_options,
+                 MemoryPlan &plan);
+
+void print_memory_plan(const MemoryPlan &plan, size_t max_bytes);
@@ -0,0 +1,193 @@
+#include "multi_component.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <glm/gtx/string_cast.hpp>
+#include "bcmc_file.h"
+#include "compress.h"
+#include "compressed_input.h"
+#include "mapped_file.h"
+#include "parallel.h"
+#include "profiler.h"
+
+namespace {
+
+// Number of voxels converted at a time into the per-thread scratch buffer before being
+// scattered to the channels, sized so the scratch stays in L1/L2
+constexpr size_t DEINTERLEAVE_CHUNK_VOXELS = 1024;
+
+// Convert and deinterleave voxels [begin, end) of the interleaved input into the channels, the
+// magnitude channel (if any) follows the component channels
+void deinterleave(const uint8_t *src,
+                  const VoxelType &voxel_type,
+                  uint32_t num_components,
+                  bool magnitude,
+                  size_t begin,
+                  size_t end,
+                  std::vector<float *> &channels)
+{
+    const size_t voxel_size = dtype_size(voxel_type.dtype) * num_components;
+    const uint32_t magnitude_components = std::min(num_components, 3u);
+    std::vector<float> scratch(DEINTERLEAVE_CHUNK_VOXELS * num_components);
+    for (size_t v = begin; v < end; v += DEINTERLEAVE_CHUNK_VOXELS) {
+        const size_t n = std::min(DEINTERLEAVE_CHUNK_VOXELS, end - v);
+        convert_to_float_serial(
+            src + v * voxel_size, voxel_type, scratch.data(), n * num_components);
+        for (uint32_t c = 0; c < num_components; ++c) {
+            float *out = channels[c] + v;
+            for (size_t i = 0; i < n; ++i) {
+                out[i] = scratch[i * num_components + c];
+            }
+        }
+        if (magnitude) {
+            float *out = channels[num_components] + v;
+            for (size_t i = 0; i < n; ++i) {
+                float sum = 0.f;
+                for (uint32_t c = 0; c < magnitude_components; ++c) {
+                    const float x = scratch[i * num_components + c];
+                    sum += x * x;
+                }
+                out[i] = std::sqrt(sum);
+            }
+        }
+    }
+}
+
+}
+
+bool compress_multi_component_volume(const std::string &raw_file_name,
+                                     const RawVolumeInfo &info,
+                                     const ComponentOptions &options,
+                                     int compression_rate,
+                                     std::string &out_name)
+{
+    using namespace std::chrono;
+    if (!info.hdf5_dataset.empty()) {
+        std::cerr << "Multi-component HDF5 datasets must be stored contiguously\n";
+        return false;
+    }
+    const uint32_t num_components =
+        options.num_components != 0 ? options.num_components : info.num_components;
+    const glm::uvec3 dims = info.dims;
+    const size_t num_voxels = size_t(dims.x) * size_t(dims.y) * size_t(dims.z);
+    const size_t voxel_size = dtype_size(info.voxel_type.dtype) * num_components;
+
+    const int used_compression_rate = fixed_compression_rate(compression_rate);
+    if (used_compression_rate < 0) {
+        return false;
+    }
+
+    std::vector<std::string> channel_names;
+    for (uint32_t c = 0; c < num_components; ++c) {
+        channel_names.push_back("c" + std::to_string(c));
+    }
+    if (options.magnitude) {
+        channel_names.push_back("magnitude");
+    }
+    const size_t num_channels = channel_names.size();
+    std::cout << "Loading " << num_components << " component "
+              << voxel_type_name(info.voxel_type) << " volume, size: " << glm::to_string(dims)
+              << ", into " << num_channels << " channels\n";
+
+    // Compressed inputs are decoded to the interleaved raw data first, uncompressed inputs are
+    // deinterleaved directly from the mapped file
+    MappedFile file;
+    LargeVector<uint8_t> decoded;
+    const uint8_t *src = nullptr;
+    auto start = steady_clock::now();
+    if (info.compression == InputCompression::NONE) {
+        if (!file.open(info.data_file)) {
+            return false;
+        }
+        if (file.size() < info.data_offset + num_voxels * voxel_size) {
+            std::cerr << "Raw volume " << info.data_file << " is too small: expected "
+                      << num_voxels * voxel_size << "b at offset " << info.data_offset
+                      << " but the file is " << file.size() << "b\n";
+            return false;
+        }
+        file.will_need(info.data_offset, num_voxels * voxel_size);
+        src = file.data() + info.data_offset;
+    } else {
+        PROFILE_ZONE("decode compressed components");
+        decoded.resize(num_voxels * voxel_size);
+        // Decode the components as single voxels of the base type so decoded runs don't need
+        // to respect the interleaved voxel boundaries
+        const size_t component_size = dtype_size(info.voxel_type.dtype);
+        uint8_t *dst = decoded.data();
+        const bool success = decode_compressed_raw_volume(
+            info.data_file,
+            info.compression,
+            info.voxel_type,
+            num_voxels * num_components,
+            [&](const uint8_t *voxels, size_t first, size_t n, bool) {
+                std::memcpy(dst + first * component_size, voxels, n * component_size);
+            },
+            false,
+            info.data_offset);
+        if (!success) {
+            return false;
+        }
+        src = decoded.data();
+    }
+
+    std::vector<LargeVector<float>> channel_data(num_channels);
+    std::vector<float *> channels(num_channels);
+    for (size_t c = 0; c < num_channels; ++c) {
+        channel_data[c].resize(num_voxels);
+        channels[c] = channel_data[c].data();
+    }
+    parallel_for(0, num_voxels, [&](const size_t begin, const size_t end) {
+        PROFILE_ZONE("deinterleave");
+        deinterleave(
+            src, info.voxel_type, num_components, options.magnitude, begin, end, channels);
+    });
+    auto loaded = steady_clock::now();
+    std::cout << "Loaded and deinterleaved channels in "
+              << duration_cast<milliseconds>(loaded - start).count() << "ms\n";
+
+    // Compress each channel on its own thread
+    std::vector<LargeVector<uint8_t>> compressed(num_channels);
+    std::atomic<bool> failed(false);
+    parallel_for(0, num_channels, [&](const size_t begin, const size_t end) {
+        for (size_t c = begin; c < end; ++c) {
+            if (!compress_volume(channels[c], dims, used_compression_rate, compressed[c])) {
+                failed = true;
+            }
+        }
+    });
+    auto compressed_time = steady_clock::now();
+    if (failed) {
+        std::cout << "Failed to compress channels\n";
+        return false;
+    }
+    std::cout << "Compressed channels in "
+              << duration_cast<milliseconds>(compressed_time - loaded).count() << "ms\n";
+
+    out_name = volume_output_name(raw_file_name, info) + ".crate" +
+               std::to_string(used_compression_rate) + ".bcmc";
+    BCMCFileWriter writer;
+    const uint32_t file_dims[3] = {dims.x, dims.y, dims.z};
+    if (!writer.open(out_name, file_dims, num_channels, 1, channel_names)) {
+        return false;
+    }
+    size_t total_bytes = 0;
+    for (size_t c = 0; c < num_channels; ++c) {
+        BCMCStreamEntry entry;
+        entry.rate = used_compression_rate;
+        entry.channel = c;
+        if (!writer.add_stream(entry, compressed[c].data(), compressed[c].size())) {
+            return false;
+        }
+        std::cout << "Channel " << channel_names[c] << ": " << compressed[c].size() << "B\n";
+        total_bytes += compressed[c].size();
+    }
+    if (!writer.finish()) {
+        std::cout << "Failed to write " << out_name << "\n";
+        return false;
+    }
+    std::cout << "Total compressed size: " << total_bytes << "B\n";
+    return true;
+}
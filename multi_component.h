@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+#include "raw_volume.h"
+
+struct ComponentOptions {
+    // Number of interleaved components per voxel. Overrides the count in the file name if set
+    uint32_t num_components = 0;
+    // Also compute the magnitude of the vector formed by the first (up to 3) components while
+    // loading and store it as an extra channel
+    bool magnitude = false;
+};
+
+// Load a raw volume with multiple interleaved components per voxel, e.g. xyz velocity and
+// pressure, deinterleaving the components into separate channels in a single pass over the
+// input. Each channel is compressed as its own fixed rate stream on a separate thread and
+// written to a BCMC file with a channel table.
+bool compress_multi_component_volume(const std::string &raw_file_name,
+                                     const RawVolumeInfo &info,
+                                     const ComponentOptions &options,
+                                     int compression_rate,
+                                     std::string &out_name);
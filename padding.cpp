@@ -0,0 +1,85 @@
+#include "padding.h"
+#include <algorithm>
+#include <iostream>
+#include "parallel.h"
+#include "profiler.h"
+#include "raw_volume.h"
+
+bool parse_padding_multiple(const std::string &arg, PaddingOptions &padding)
+{
+    padding.multiple = std::stoul(arg);
+    if (padding.multiple == 0 || padding.multiple % 4 != 0) {
+        std::cout << "-pad must be a multiple of 4, the ZFP block size, but got " << arg
+                  << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool parse_padding_fill(const std::string &arg, PaddingOptions &padding)
+{
+    if (arg == "edge") {
+        padding.replicate_edge = true;
+        return true;
+    }
+    try {
+        padding.fill_value = std::stof(arg);
+    } catch (const std::exception &) {
+        std::cout << "-pad-fill must be edge or a value, but got '" << arg << "'\n";
+        return false;
+    }
+    padding.replicate_edge = false;
+    return true;
+}
+
+void fill_padding(float *data,
+                  const glm::uvec3 &logical_dims,
+                  const glm::uvec3 &padded_dims,
+                  const PaddingOptions &padding)
+{
+    PROFILE_ZONE("fill_padding");
+    const size_t row_pitch = padded_dims.x;
+    const size_t slice_pitch = row_pitch * padded_dims.y;
+    // Pad the rows and slices of the logical volume along x and y
+    parallel_for(0, logical_dims.z, [&](const size_t z_begin, const size_t z_end) {
+        for (size_t z = z_begin; z < z_end; ++z) {
+            float *slice = data + z * slice_pitch;
+            for (size_t y = 0; y < logical_dims.y; ++y) {
+                float *row = slice + y * row_pitch;
+                const float value =
+                    padding.replicate_edge ? row[logical_dims.x - 1] : padding.fill_value;
+                std::fill(row + logical_dims.x, row + padded_dims.x, value);
+            }
+            const float *edge_row = slice + (logical_dims.y - 1) * row_pitch;
+            for (size_t y = logical_dims.y; y < padded_dims.y; ++y) {
+                float *row = slice + y * row_pitch;
+                if (padding.replicate_edge) {
+                    std::copy(edge_row, edge_row + row_pitch, row);
+                } else {
+                    std::fill(row, row + row_pitch, padding.fill_value);
+                }
+            }
+        }
+    });
+    // Then the slices past the end along z, from the now padded last slice
+    const float *edge_slice = data + (logical_dims.z - 1) * slice_pitch;
+    parallel_for(logical_dims.z, padded_dims.z, [&](const size_t z_begin, const size_t z_end) {
+        for (size_t z = z_begin; z < z_end; ++z) {
+            float *slice = data + z * slice_pitch;
+            if (padding.replicate_edge) {
+                std::copy(edge_slice, edge_slice + slice_pitch, slice);
+            } else {
+                std::fill(slice, slice + slice_pitch, padding.fill_value);
+            }
+        }
+    });
+}
+
+std::string padded_volume_name(const std::string &name,
+                               const glm::uvec3 &logical_dims,
+                               const glm::uvec3 &padded_dims)
+{
+    return replace_volume_name_dims(name, padded_dims) + ".logical" +
+           std::to_string(logical_dims.x) + "x" + std::to_string(logical_dims.y) + "x" +
+           std::to_string(logical_dims.z);
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <glm/glm.hpp>
+#include "field_kernels.h"
+
+// Padding of a volume's dims up to a multiple of a brick size, so every ZFP block (or brick of
+// blocks) is whole and renderers can address blocks without bounds checks
+struct PaddingOptions {
+    // Pad each dim up to a multiple of this, 4 for whole ZFP blocks or a larger brick size.
+    // Padding is disabled when zero
+    uint32_t multiple = 0;
+    // Replicate the voxels on the edge of the volume into the padding, otherwise fill it with
+    // fill_value
+    bool replicate_edge = true;
+    float fill_value = 0.f;
+
+    bool enabled() const
+    {
+        return multiple != 0;
+    }
+
+    glm::uvec3 padded_dims(const glm::uvec3 &dims) const
+    {
+        if (!enabled()) {
+            return dims;
+        }
+        return (dims + glm::uvec3(multiple - 1)) / glm::uvec3(multiple) * glm::uvec3(multiple);
+    }
+};
+
+// Parse the -pad multiple, which must be a multiple of 4
+bool parse_padding_multiple(const std::string &arg, PaddingOptions &padding);
+
+// Parse the -pad-fill mode: edge, or a value to fill the padding with
+bool parse_padding_fill(const std::string &arg, PaddingOptions &padding);
+
+// Fill the padding of a volume stored at padded_dims, whose voxels inside logical_dims have
+// already been written at their coordinates. Only the padding voxels are written
+void fill_padding(float *data,
+                  const glm::uvec3 &logical_dims,
+                  const glm::uvec3 &padded_dims,
+                  const PaddingOptions &padding);
+
+// Get the output name of a padded volume: the dims in the name are replaced by the padded
+// dims, which the stream is made of, and the logical dims are appended as .logical<X>x<Y>x<Z>,
+// e.g. skull_260x260x260_uint8.raw.logical257x257x257
+std::string padded_volume_name(const std::string &name,
+                               const glm::uvec3 &logical_dims,
+                               const glm::uvec3 &padded_dims);
+
+// Field kernel evaluating a field of the logical dims over the padded dims, clamping to the
+// edge or returning the fill value outside the logical dims
+template <typename Field>
+class PaddedField {
+    Field field;
+    glm::vec3 max_coord;
+    bool replicate_edge;
+    float fill_value;
+
+public:
+    PaddedField(const Field &field, const glm::uvec3 &dims, const PaddingOptions &padding)
+        : field(field),
+          max_coord(glm::vec3(dims) - glm::vec3(1.f)),
+          replicate_edge(padding.replicate_edge),
+          fill_value(padding.fill_value)
+    {
+    }
+
+    float operator()(float x, float y, float z) const
+    {
+        if (replicate_edge) {
+            return field(std::min(x, max_coord.x),
+                         std::min(y, max_coord.y),
+                         std::min(z, max_coord.z));
+        }
+        if (x > max_coord.x || y > max_coord.y || z > max_coord.z) {
+            return fill_value;
+        }
+        return field(x, y, z);
+    }
+};
+
+// Generate a field of the logical dims into data at the padded dims, see generate_field
+template <typename Field>
+void generate_padded_field(const Field &field,
+                           const glm::uvec3 &dims,
+                           const PaddingOptions &padding,
+                           VolumeBuffer &data)
+{
+    if (!padding.enabled()) {
+        generate_field(field, dims, data);
+        return;
+    }
+    generate_field(PaddedField<Field>(field, dims, padding), padding.padded_dims(dims), data);
+}
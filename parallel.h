@@ -0,0 +1,69 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+#include "profiler.h"
+
+// The number of worker threads used by parallel_for. Defaults to the hardware concurrency and
+// can be overridden with set_worker_thread_count (the -threads option)
+inline size_t &worker_thread_count_storage()
+{
+    static size_t count = std::max(1u, std::thread::hardware_concurrency());
+    return count;
+}
+
+inline size_t worker_thread_count()
+{
+    return worker_thread_count_storage();
+}
+
+inline void set_worker_thread_count(size_t count)
+{
+    worker_thread_count_storage() = std::max(size_t(1), count);
+}
+
+// Get the sub-range of [begin, end) assigned to worker i of n. Ranges are contiguous and
+// deterministic for a given range and worker count, so a buffer first touched through
+// parallel_for places its pages on the NUMA node of the worker which processes the same
+// range later.
+inline void partition_range(
+    size_t begin, size_t end, size_t i, size_t n, size_t &range_begin, size_t &range_end)
+{
+    const size_t count = end - begin;
+    range_begin = begin + (count * i) / n;
+    range_end = begin + (count * (i + 1)) / n;
+}
+
+// Run fn(range_begin, range_end) over [begin, end) split into one contiguous range per worker
+// thread. The calling thread processes the first range.
+template <typename F>
+void parallel_for(size_t begin, size_t end, const F &fn)
+{
+    if (end <= begin) {
+        return;
+    }
+    const size_t num_workers = std::min(worker_thread_count(), end - begin);
+    if (num_workers == 1) {
+        fn(begin, end);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    workers.reserve(num_workers - 1);
+    for (size_t i = 1; i < num_workers; ++i) {
+        size_t range_begin, range_end;
+        partition_range(begin, end, i, num_workers, range_begin, range_end);
+        workers.emplace_back([&fn, range_begin, range_end]() {
+            PROFILE_ZONE("parallel_for worker");
+            fn(range_begin, range_end);
+        });
+    }
+    size_t range_begin, range_end;
+    partition_range(begin, end, 0, num_workers, range_begin, range_end);
+    fn(range_begin, range_end);
+    for (auto &w : workers) {
+        w.join();
+    }
+}
@@ -0,0 +1,115 @@
+#include "profiler.h"
+
+#ifdef BCMC_PROFILE
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+struct ProfileEvent {
+    const char *name;
+    int64_t start_us;
+    int64_t duration_us;
+};
+
+struct ThreadEvents {
+    size_t thread_id = 0;
+    std::string thread_name;
+    // Only touched by the owning thread until the trace is written
+    std::vector<ProfileEvent> events;
+};
+
+std::mutex registry_mutex;
+// Event buffers outlive their threads, so the short lived parallel_for workers are kept
+std::vector<std::shared_ptr<ThreadEvents>> registry;
+const std::chrono::steady_clock::time_point trace_start = std::chrono::steady_clock::now();
+
+ThreadEvents &thread_events()
+{
+    thread_local std::shared_ptr<ThreadEvents> events;
+    if (!events) {
+        events = std::make_shared<ThreadEvents>();
+        events->events.reserve(1024);
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        events->thread_id = registry.size();
+        registry.push_back(events);
+    }
+    return *events;
+}
+
+int64_t to_us(const std::chrono::steady_clock::time_point &t)
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(t - trace_start).count();
+}
+
+void write_json_string(std::ostream &os, const std::string &str)
+{
+    os << '"';
+    for (const char c : str) {
+        if (c == '"' || c == '\\') {
+            os << '\\';
+        }
+        os << c;
+    }
+    os << '"';
+}
+
+}
+
+ProfileZone::ProfileZone(const char *name)
+    : name(name), start(std::chrono::steady_clock::now())
+{
+}
+
+ProfileZone::~ProfileZone()
+{
+    const auto end = std::chrono::steady_clock::now();
+    const int64_t start_us = to_us(start);
+    thread_events().events.push_back(ProfileEvent{name, start_us, to_us(end) - start_us});
+}
+
+void profiler_set_thread_name(const std::string &name)
+{
+    thread_events().thread_name = name;
+}
+
+bool profiler_write_trace(const std::string &file_name)
+{
+    std::ofstream fout(file_name.c_str());
+    if (!fout) {
+        std::cerr << "Failed to open trace file " << file_name << "\n";
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    fout << "{\"traceEvents\":[\n";
+    bool first = true;
+    size_t num_events = 0;
+    for (const auto &thread : registry) {
+        if (!thread->thread_name.empty()) {
+            fout << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                 << "\"tid\":" << thread->thread_id << ",\"args\":{\"name\":";
+            write_json_string(fout, thread->thread_name);
+            fout << "}}";
+            first = false;
+        }
+        for (const auto &e : thread->events) {
+            fout << (first ? "" : ",\n") << "{\"name\":";
+            write_json_string(fout, e.name);
+            fout << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread->thread_id
+                 << ",\"ts\":" << e.start_us << ",\"dur\":" << e.duration_us << "}";
+            first = false;
+        }
+        num_events += thread->events.size();
+    }
+    fout << "\n]}\n";
+    std::cout << "Wrote " << num_events << " profile events to " << file_name << "\n";
+    return bool(fout);
+}
+
+#endif
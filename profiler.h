@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+
+// Scoped profiler zones, compiled in when building with the BCMC_PROFILE CMake option. Each
+// zone records its start and duration on the calling thread and the timeline of all threads
+// is written out as a Chrome trace event JSON file (viewable in chrome://tracing or Perfetto).
+// When profiling is disabled the zone macros expand to nothing.
+#ifdef BCMC_PROFILE
+
+#include <chrono>
+
+class ProfileZone {
+    const char *name;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    // The name must be a string literal or otherwise outlive the profiler
+    explicit ProfileZone(const char *name);
+
+    ~ProfileZone();
+
+    ProfileZone(const ProfileZone &) = delete;
+    ProfileZone &operator=(const ProfileZone &) = delete;
+};
+
+#define BCMC_PROFILE_CONCAT_IMPL(a, b) a##b
+#define BCMC_PROFILE_CONCAT(a, b) BCMC_PROFILE_CONCAT_IMPL(a, b)
+#define PROFILE_ZONE(name) ProfileZone BCMC_PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+
+// Name the calling thread in the trace
+void profiler_set_thread_name(const std::string &name);
+
+// Write the events recorded so far to a Chrome trace event JSON file
+bool profiler_write_trace(const std::string &file_name);
+
+#else
+
+#define PROFILE_ZONE(name)
+
+inline void profiler_set_thread_name(const std::string &)
+{
+}
+
+inline bool profiler_write_trace(const std::string &)
+{
+    return true;
+}
+
+#endif
+
+// Writes the trace when going out of scope, so every exit path of main produces a timeline
+class ProfileTraceWriter {
+    std::string file_name;
+
+public:
+    explicit ProfileTraceWriter(const std::string &file_name) : file_name(file_name) {}
+
+    ~ProfileTraceWriter()
+    {
+        profiler_write_trace(file_name);
+    }
+
+    void set_file_name(const std::string &name)
+    {
+        file_name = name;
+    }
+};
@@ -0,0 +1,168 @@
+#include "rate_search.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <random>
+#include <vector>
+#include "compress.h"
+#include "parallel.h"
+#include "profiler.h"
+
+namespace {
+
+constexpr int MIN_RATE = 1;
+constexpr int MAX_RATE = 32;
+constexpr size_t MIN_SAMPLE_BLOCKS = 4096;
+
+// Pick a random sample of the blocks, with a fixed seed so searches are repeatable
+std::vector<size_t> sample_blocks(size_t num_blocks, double fraction)
+{
+    const size_t count = std::min(
+        num_blocks,
+        std::max(MIN_SAMPLE_BLOCKS, size_t(std::ceil(std::max(fraction, 0.0) * num_blocks))));
+    std::vector<size_t> blocks;
+    if (count == num_blocks) {
+        blocks.resize(num_blocks);
+        for (size_t i = 0; i < num_blocks; ++i) {
+            blocks[i] = i;
+        }
+        return blocks;
+    }
+    std::mt19937_64 rng(0x42434d43);
+    std::uniform_int_distribution<size_t> distribution(0, num_blocks - 1);
+    blocks.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        blocks.push_back(distribution(rng));
+    }
+    // Compress the sample in block order for better locality in the volume
+    std::sort(blocks.begin(), blocks.end());
+    blocks.erase(std::unique(blocks.begin(), blocks.end()), blocks.end());
+    return blocks;
+}
+
+// Compress the sampled blocks at the rate across the worker threads and combine their error
+TrialError estimate_error(const float *data,
+                          const glm::uvec3 &dims,
+                          const std::vector<size_t> &blocks,
+                          int rate)
+{
+    PROFILE_ZONE("estimate rate error");
+    const glm::uvec3 block_dims = (dims + glm::uvec3(3)) / glm::uvec3(4);
+    std::vector<TrialError> chunk_errors(std::min(worker_thread_count(), blocks.size()));
+    parallel_for(0, chunk_errors.size(), [&](const size_t begin, const size_t end) {
+        uint64_t scratch[MAX_COMPRESSED_BLOCK_WORDS];
+        bitstream *stream = stream_open(scratch, sizeof(scratch));
+        zfp_stream *zfp = zfp_stream_open(stream);
+        zfp_stream_set_rate(zfp, rate, zfp_type_float, 3, 0);
+        for (size_t c = begin; c < end; ++c) {
+            size_t blocks_begin, blocks_end;
+            partition_range(
+                0, blocks.size(), c, chunk_errors.size(), blocks_begin, blocks_end);
+            for (size_t i = blocks_begin; i < blocks_end; ++i) {
+                const size_t b = blocks[i];
+                const glm::uvec3 block(b % block_dims.x,
+                                       (b / block_dims.x) % block_dims.y,
+                                       b / (size_t(block_dims.x) * block_dims.y));
+                trial_compress_block(zfp, data, dims, block, chunk_errors[c]);
+            }
+        }
+        zfp_stream_close(zfp);
+        stream_close(stream);
+    });
+
+    TrialError error;
+    for (const auto &e : chunk_errors) {
+        error.max_error = std::max(error.max_error, e.max_error);
+        error.sum_squared_error += e.sum_squared_error;
+        error.num_values += e.num_values;
+    }
+    return error;
+}
+
+double psnr(const TrialError &error, float value_range)
+{
+    if (error.sum_squared_error == 0.0) {
+        return std::numeric_limits<double>::infinity();
+    }
+    const double mse = error.sum_squared_error / error.num_values;
+    return 20.0 * std::log10(value_range) - 10.0 * std::log10(mse);
+}
+
+}
+
+int search_compression_rate(const float *data,
+                            const glm::uvec3 &dims,
+                            const RateTarget &target)
+{
+    using namespace std::chrono;
+    PROFILE_ZONE("search_compression_rate");
+    const glm::uvec3 block_dims = (dims + glm::uvec3(3)) / glm::uvec3(4);
+    const size_t num_blocks = size_t(block_dims.x) * block_dims.y * block_dims.z;
+
+    if (target.kind == RateTarget::BYTES) {
+        // Each block takes 64 * rate bits
+        const double rate = std::floor(target.value / (num_blocks * 8.0));
+        if (rate < MIN_RATE) {
+            std::cout << "Target size " << target.value << "B is too small, rate 1 needs "
+                      << num_blocks * 8 << "B\n";
+            return -1;
+        }
+        const int used_rate = std::min(int(rate), MAX_RATE);
+        std::cout << "Rate " << used_rate << " gives " << num_blocks * 8 * used_rate
+                  << "B for target size " << target.value << "B\n";
+        return used_rate;
+    }
+    if (target.kind != RateTarget::PSNR && target.kind != RateTarget::MAX_ERROR) {
+        std::cout << "Invalid rate search target\n";
+        return -1;
+    }
+
+    auto start = steady_clock::now();
+    const size_t num_voxels = size_t(dims.x) * size_t(dims.y) * size_t(dims.z);
+    const glm::vec2 range = compute_volume_range(data, num_voxels);
+    const std::vector<size_t> blocks = sample_blocks(num_blocks, target.sample_fraction);
+    std::cout << "Searching for rate with "
+              << (target.kind == RateTarget::PSNR ? "PSNR >= " : "max error <= ")
+              << target.value << ", sampling " << blocks.size() << " of " << num_blocks
+              << " blocks\n";
+
+    std::map<int, TrialError> estimates;
+    auto meets_target = [&](const int rate) {
+        auto fnd = estimates.find(rate);
+        if (fnd == estimates.end()) {
+            fnd = estimates.emplace(rate, estimate_error(data, dims, blocks, rate)).first;
+            std::cout << "Rate " << rate << ": estimated PSNR "
+                      << psnr(fnd->second, range.y - range.x) << "dB, max error "
+                      << fnd->second.max_error << "\n";
+        }
+        if (target.kind == RateTarget::PSNR) {
+            return psnr(fnd->second, range.y - range.x) >= target.value;
+        }
+        return fnd->second.max_error <= target.value;
+    };
+
+    int rate = MAX_RATE;
+    if (!meets_target(MAX_RATE)) {
+        std::cout << "Warning: no rate meets the target, using the highest rate\n";
+    } else {
+        // The error decreases with the rate, so bisect for the lowest rate meeting the target
+        int lo = MIN_RATE;
+        int hi = MAX_RATE;
+        while (lo < hi) {
+            const int mid = (lo + hi) / 2;
+            if (meets_target(mid)) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+        rate = lo;
+    }
+    auto end = steady_clock::now();
+    std::cout << "Selected rate " << rate << " in "
+              << duration_cast<milliseconds>(end - start).count() << "ms\n";
+    return rate;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+struct RateTarget {
+    enum Kind { NONE, PSNR, MAX_ERROR, BYTES };
+    Kind kind = NONE;
+    // The target PSNR in dB, largest absolute error or compressed size in bytes
+    double value = 0.0;
+    // Fraction of the blocks sampled to estimate the error at a rate. At least 4096 blocks
+    // are drawn, or all of them are used for small volumes
+    double sample_fraction = 0.01;
+};
+
+// Find the lowest fixed rate meeting the target. The compressed size is exact for a given
+// rate, so size targets are computed directly. For error targets, the error at a rate is
+// estimated by compressing a random sample of blocks in parallel, and the rate is found by
+// bisecting over the integer rates. If no rate meets an error target, the highest rate is
+// returned. Returns -1 if the target can't be met or is invalid.
+int search_compression_rate(const float *data,
+                            const glm::uvec3 &dims,
+                            const RateTarget &target);
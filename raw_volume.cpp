@@ -0,0 +1,588 @@
+#include "raw_volume.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <mutex>
+#include <regex>
+#include <sstream>
+#include <glm/gtx/string_cast.hpp>
+#include "compressed_input.h"
+#include "hdf5_input.h"
+#include "input_reader.h"
+#include "mapped_file.h"
+#include "parallel.h"
+#include "profiler.h"
+#include "volume_header.h"
+
+bool parse_raw_volume_name(const std::string &raw_file_name, RawVolumeInfo &info)
+{
+    const std::regex match_filename("(\\w+)_(\\d+)x(\\d+)x(\\d+)_(.+)\\.raw");
+    auto matches =
+        std::sregex_iterator(raw_file_name.begin(), raw_file_name.end(), match_filename);
+    if (matches == std::sregex_iterator() || matches->size() != 6) {
+        std::cerr << "Unrecognized raw volume naming scheme, expected a format like: "
+                  << "'<name>_<X>x<Y>x<Z>_<data type>.raw' but '" << raw_file_name
+                  << "' did not match" << std::endl;
+        return false;
+    }
+
+    info = RawVolumeInfo();
+    info.name = (*matches)[1];
+    info.dims = glm::uvec3(
+        std::stoi((*matches)[2]), std::stoi((*matches)[3]), std::stoi((*matches)[4]));
+    std::string volume_type = (*matches)[5];
+    info.num_components = 1;
+    const std::regex match_components("(.+)x(\\d+)");
+    std::smatch component_match;
+    if (std::regex_match(volume_type, component_match, match_components)) {
+        info.num_components = std::stoi(component_match[2]);
+        volume_type = component_match[1];
+        if (info.num_components == 0) {
+            std::cerr << "Raw volume must have at least one component per voxel\n";
+            return false;
+        }
+    }
+    if (!parse_voxel_type(volume_type, info.voxel_type)) {
+        std::cerr << "Unsupported raw volume data type '" << volume_type
+                  << "', supported types are: " << supported_voxel_type_names() << std::endl;
+        return false;
+    }
+    info.data_file = raw_file_name;
+    info.compression = detect_input_compression(raw_file_name);
+    return true;
+}
+
+bool read_volume_info(const std::string &file_name, RawVolumeInfo &info)
+{
+    if (is_volume_header_file(file_name)) {
+        return parse_volume_header(file_name, info);
+    }
+    if (is_hdf5_volume(file_name)) {
+        return parse_hdf5_volume(file_name, info);
+    }
+    return parse_raw_volume_name(file_name, info);
+}
+
+std::string volume_output_name(const std::string &file_name,
+                               const RawVolumeInfo &info,
+                               const glm::uvec3 &out_dims)
+{
+    if (!is_volume_header_file(file_name) && !is_hdf5_volume(file_name)) {
+        return file_name;
+    }
+    // HDF5 inputs may name a dataset after the file, which is left out
+    const std::string &path = is_hdf5_volume(file_name) ? info.data_file : file_name;
+    const size_t slash = path.find_last_of("/\\");
+    const size_t dot = path.find_last_of('.');
+    std::string type_name = voxel_type_name(info.voxel_type);
+    if (info.num_components > 1) {
+        type_name += "x" + std::to_string(info.num_components);
+    }
+    std::string name = path.substr(0, slash == std::string::npos ? 0 : slash + 1) + info.name +
+                       "_" + std::to_string(info.dims.x) + "x" + std::to_string(info.dims.y) +
+                       "x" + std::to_string(info.dims.z) + "_" + type_name + path.substr(dot);
+    // Resampling stretches the voxels over the same extent
+    const glm::vec3 spacing = out_dims == glm::uvec3(0)
+                                  ? info.spacing
+                                  : info.spacing * glm::vec3(info.dims) / glm::vec3(out_dims);
+    if (spacing != glm::vec3(1.f)) {
+        std::ostringstream str;
+        str << ".spacing" << spacing.x << "x" << spacing.y << "x" << spacing.z;
+        name += str.str();
+    }
+    return name;
+}
+
+std::string replace_volume_name_dims(const std::string &name, const glm::uvec3 &dims)
+{
+    // Replace the last _XxYxZ_ in the name, which is the one parse_raw_volume_name reads
+    const std::regex match_dims("_\\d+x\\d+x\\d+_(?!.*_\\d+x\\d+x\\d+_)");
+    return std::regex_replace(name,
+                              match_dims,
+                              "_" + std::to_string(dims.x) + "x" + std::to_string(dims.y) +
+                                  "x" + std::to_string(dims.z) + "_");
+}
+
+bool read_raw_volume(const std::string &raw_file_name,
+                     VolumeBuffer &data,
+                     glm::uvec3 &dims,
+                     const NormalizeOptions &normalize,
+                     const PaddingOptions &padding)
+{
+    RawVolumeInfo info;
+    if (!read_volume_info(raw_file_name, info)) {
+        return false;
+    }
+    dims = info.dims;
+    const glm::uvec3 padded_dims = padding.padded_dims(dims);
+    data.resize(size_t(padded_dims.x) * size_t(padded_dims.y) * size_t(padded_dims.z));
+    if (!load_raw_volume(
+            raw_file_name, info, data.data(), normalize, 0, UINT32_MAX, padded_dims)) {
+        return false;
+    }
+    if (padded_dims != dims) {
+        fill_padding(data.data(), dims, padded_dims, padding);
+    }
+    return true;
+}
+
+namespace {
+
+// Size of the raw slabs of chunks read from HDF5 datasets at a time when loading
+constexpr size_t HDF5_SLAB_BYTES = size_t(256) << 20;
+
+uint32_t hdf5_load_slices(const RawVolumeInfo &info)
+{
+    const size_t slice_bytes =
+        size_t(info.dims.x) * info.dims.y * dtype_size(info.voxel_type.dtype);
+    return uint32_t(std::max(size_t(1), HDF5_SLAB_BYTES / slice_bytes));
+}
+
+// Convert a box of voxels read from an HDF5 chunk into out, which holds the slices from
+// out_z_begin at the given pitch
+void convert_chunk_box(const uint8_t *voxels,
+                       const HDF5ChunkBox &box,
+                       const VoxelType &voxel_type,
+                       const Normalization &normalization,
+                       float *out,
+                       uint32_t out_z_begin,
+                       const glm::uvec3 &pitch)
+{
+    const size_t voxel_size = dtype_size(voxel_type.dtype);
+    for (uint32_t z = 0; z < box.size.z; ++z) {
+        for (uint32_t y = 0; y < box.size.y; ++y) {
+            const size_t out_z = box.origin.z + z - out_z_begin;
+            convert_to_float_serial(
+                voxels + (z * box.slice_pitch + y * box.row_pitch) * voxel_size,
+                voxel_type,
+                out + (out_z * pitch.y + box.origin.y + y) * pitch.x + box.origin.x,
+                box.size.x,
+                normalization);
+        }
+    }
+}
+
+// Map an uncompressed input and check it holds the whole volume, setting payload to its first
+// voxel. Compressed inputs are mapped by their decoder, and HDF5 chunks by read_hdf5_chunks
+bool open_raw_input(const RawVolumeInfo &info, MappedFile &file, const uint8_t *&payload)
+{
+    if (info.compression != InputCompression::NONE || !info.hdf5_dataset.empty()) {
+        return true;
+    }
+    if (!file.open(info.data_file)) {
+        return false;
+    }
+    const size_t num_voxels = size_t(info.dims.x) * size_t(info.dims.y) * size_t(info.dims.z);
+    const size_t voxel_size = dtype_size(info.voxel_type.dtype);
+    if (file.size() < info.data_offset + num_voxels * voxel_size) {
+        std::cerr << "Raw volume " << info.data_file << " is too small: expected "
+                  << num_voxels * voxel_size << "b at offset " << info.data_offset
+                  << " for a " << glm::to_string(info.dims) << " "
+                  << voxel_type_name(info.voxel_type) << " volume but the file is "
+                  << file.size() << "b" << std::endl;
+        return false;
+    }
+    payload = file.data() + info.data_offset;
+    return true;
+}
+
+bool decode_payload(const RawVolumeInfo &info,
+                    size_t num_voxels,
+                    const VoxelRunFn &fn,
+                    bool in_order = false)
+{
+    return decode_compressed_raw_volume(info.data_file,
+                                        info.compression,
+                                        info.voxel_type,
+                                        num_voxels,
+                                        fn,
+                                        in_order,
+                                        info.data_offset);
+}
+
+// Uncompressed inputs are read in blocks by read_file_blocks instead of converted from the
+// mapping when a URING or PREAD backend is selected
+bool use_block_reader(const RawVolumeInfo &info)
+{
+    return info.compression == InputCompression::NONE && info.hdf5_dataset.empty() &&
+           input_read_options().backend != ReadBackend::MMAP;
+}
+
+// Read the n voxels from first_voxel of an uncompressed input in blocks, passing them to fn
+// as runs from the worker threads like a compressed input's decoder does
+bool read_payload_blocks(const RawVolumeInfo &info,
+                         size_t first_voxel,
+                         size_t n,
+                         const VoxelRunFn &fn)
+{
+    const size_t voxel_size = dtype_size(info.voxel_type.dtype);
+    return read_file_blocks(info.data_file,
+                            info.data_offset + first_voxel * voxel_size,
+                            n * voxel_size,
+                            voxel_size,
+                            input_read_options(),
+                            [&](const uint8_t *voxels, size_t offset, size_t bytes) {
+                                fn(voxels,
+                                   first_voxel + offset / voxel_size,
+                                   bytes / voxel_size,
+                                   false);
+                            });
+}
+
+// Set up the normalization applied while converting the input to float. In AUTO mode the
+// range is found on the raw input in its native type, compressed inputs are decoded an extra
+// time for this rather than keeping a float copy around
+bool find_normalization(const RawVolumeInfo &info,
+                        const uint8_t *payload,
+                        const NormalizeOptions &normalize,
+                        Normalization &normalization)
+{
+    using namespace std::chrono;
+    if (normalize.mode == NormalizeOptions::RANGE) {
+        normalization = make_normalization(normalize.min, normalize.max);
+    } else if (normalize.mode == NormalizeOptions::AUTO) {
+        PROFILE_ZONE("compute value range");
+        auto start = steady_clock::now();
+        const size_t num_voxels =
+            size_t(info.dims.x) * size_t(info.dims.y) * size_t(info.dims.z);
+        ValueRange range;
+        if (!info.hdf5_dataset.empty()) {
+            std::mutex range_mutex;
+            const size_t voxel_size = dtype_size(info.voxel_type.dtype);
+            const bool success = read_hdf5_chunks(
+                info,
+                0,
+                info.dims.z,
+                hdf5_load_slices(info),
+                [&](const uint8_t *voxels, const HDF5ChunkBox &box) {
+                    ValueRange local;
+                    for (uint32_t z = 0; z < box.size.z; ++z) {
+                        for (uint32_t y = 0; y < box.size.y; ++y) {
+                            const size_t row = z * box.slice_pitch + y * box.row_pitch;
+                            local.extend(compute_value_range_serial(
+                                voxels + row * voxel_size, info.voxel_type, box.size.x));
+                        }
+                    }
+                    std::lock_guard<std::mutex> lock(range_mutex);
+                    range.extend(local);
+                });
+            if (!success) {
+                return false;
+            }
+        } else if (info.compression == InputCompression::NONE && !use_block_reader(info)) {
+            range = compute_value_range(payload, info.voxel_type, num_voxels);
+        } else {
+            std::mutex range_mutex;
+            auto extend_range = [&](const uint8_t *voxels, size_t, size_t n, bool parallel) {
+                const ValueRange local =
+                    parallel ? compute_value_range(voxels, info.voxel_type, n)
+                             : compute_value_range_serial(voxels, info.voxel_type, n);
+                std::lock_guard<std::mutex> lock(range_mutex);
+                range.extend(local);
+            };
+            const bool success = use_block_reader(info)
+                                     ? read_payload_blocks(info, 0, num_voxels, extend_range)
+                                     : decode_payload(info, num_voxels, extend_range);
+            if (!success) {
+                return false;
+            }
+        }
+        auto end = steady_clock::now();
+        std::cout << "Value range: [" << range.min << ", " << range.max << "], found in "
+                  << duration_cast<milliseconds>(end - start).count() << "ms\n";
+        // Empty or all NaN inputs leave the range at [inf, -inf], and infinite values can't
+        // be mapped to [0, 1] either
+        if (!std::isfinite(range.min) || !std::isfinite(range.max)) {
+            std::cout << "The value range of " << info.data_file << " is not finite, pass "
+                      << "-normalize <min> <max> to normalize it\n";
+            return false;
+        }
+        normalization = make_normalization(range.min, range.max);
+    }
+    return true;
+}
+
+void print_load_summary(const char *verb,
+                        const RawVolumeInfo &info,
+                        const Normalization &normalization,
+                        std::chrono::steady_clock::duration elapsed)
+{
+    using namespace std::chrono;
+    std::cout << verb << " " << voxel_type_name(info.voxel_type) << " volume";
+    if (info.compression != InputCompression::NONE) {
+        std::cout << " (" << input_compression_name(info.compression) << " compressed)";
+    }
+    if (!info.hdf5_dataset.empty()) {
+        std::cout << " (HDF5 dataset " << info.hdf5_dataset << ")";
+    }
+    if (normalization.enabled) {
+        std::cout << ", normalized";
+    }
+    std::cout << " in " << duration_cast<milliseconds>(elapsed).count() << "ms\n";
+}
+
+}
+
+bool load_raw_volume(const std::string &raw_file_name,
+                     const RawVolumeInfo &info,
+                     float *out,
+                     const NormalizeOptions &normalize,
+                     uint32_t z_begin,
+                     uint32_t z_end,
+                     const glm::uvec3 &out_dims)
+{
+    PROFILE_ZONE("load_raw_volume");
+    using namespace std::chrono;
+    if (info.num_components != 1) {
+        std::cerr << "Raw volume " << raw_file_name << " has " << info.num_components
+                  << " components per voxel, but a single component volume was expected\n";
+        return false;
+    }
+    const glm::uvec3 dims = info.dims;
+    const size_t voxel_size = dtype_size(info.voxel_type.dtype);
+    const size_t num_voxels = size_t(dims.x) * size_t(dims.y) * size_t(dims.z);
+    z_end = std::min(z_end, dims.z);
+    if (z_begin >= z_end) {
+        std::cerr << "No slices of " << raw_file_name << " to load in z range [" << z_begin
+                  << ", " << z_end << ")\n";
+        return false;
+    }
+    const size_t first_voxel = size_t(dims.x) * size_t(dims.y) * z_begin;
+    const size_t load_voxels = size_t(dims.x) * size_t(dims.y) * (z_end - z_begin);
+    const InputCompression compression = info.compression;
+    const glm::uvec3 pitch = out_dims == glm::uvec3(0) ? dims : out_dims;
+    // Only the row and slice pitch matter, z padding past the loaded slices is left alone
+    const bool pitched = pitch.x != dims.x || pitch.y != dims.y;
+
+    MappedFile file;
+    const uint8_t *payload = nullptr;
+    if (!open_raw_input(info, file, payload)) {
+        return false;
+    }
+    if (compression == InputCompression::NONE && info.hdf5_dataset.empty() &&
+        !use_block_reader(info)) {
+        file.will_need(info.data_offset + first_voxel * voxel_size, load_voxels * voxel_size);
+    }
+    Normalization normalization;
+    if (!find_normalization(info, payload, normalize, normalization)) {
+        return false;
+    }
+
+    // Convert the n voxels from voxel first of the loaded slices into their rows of out at
+    // its pitch, in parallel over the rows if requested
+    auto convert_pitched = [&](const uint8_t *voxels, size_t first, size_t n, bool parallel) {
+        const size_t first_row = first / dims.x;
+        const size_t end_row = (first + n + dims.x - 1) / dims.x;
+        auto convert_rows = [&](const size_t row_begin, const size_t row_end) {
+            for (size_t r = row_begin; r < row_end; ++r) {
+                const size_t begin = std::max(first, r * dims.x);
+                const size_t end = std::min(first + n, (r + 1) * dims.x);
+                const size_t y = r % dims.y;
+                const size_t z = r / dims.y;
+                convert_to_float_serial(voxels + (begin - first) * voxel_size,
+                                        info.voxel_type,
+                                        out + (z * pitch.y + y) * pitch.x + begin - r * dims.x,
+                                        end - begin,
+                                        normalization);
+            }
+        };
+        if (parallel) {
+            parallel_for(first_row, end_row, convert_rows);
+        } else {
+            convert_rows(first_row, end_row);
+        }
+    };
+
+    auto start = steady_clock::now();
+    if (!info.hdf5_dataset.empty()) {
+        // Chunks are converted into place by the workers reading them, a slab at a time
+        const bool success = read_hdf5_chunks(
+            info,
+            z_begin,
+            z_end,
+            hdf5_load_slices(info),
+            [&](const uint8_t *voxels, const HDF5ChunkBox &box) {
+                convert_chunk_box(
+                    voxels, box, info.voxel_type, normalization, out, z_begin, pitch);
+            });
+        if (!success) {
+            return false;
+        }
+    } else if (compression == InputCompression::NONE && !use_block_reader(info) && pitched) {
+        convert_pitched(payload + first_voxel * voxel_size, 0, load_voxels, true);
+    } else if (compression == InputCompression::NONE && !use_block_reader(info)) {
+        // Convert directly from the mapped file, the page faults on the input are taken in
+        // parallel by the conversion workers
+        convert_to_float(payload + first_voxel * voxel_size,
+                         info.voxel_type,
+                         out,
+                         load_voxels,
+                         normalization);
+    } else {
+        auto convert_run = [&](const uint8_t *voxels,
+                               size_t run_first_voxel,
+                               size_t n,
+                               bool parallel) {
+            // Keep the part of the decoded run inside the slices being loaded
+            const size_t begin = std::max(run_first_voxel, first_voxel);
+            const size_t end = std::min(run_first_voxel + n, first_voxel + load_voxels);
+            if (begin >= end) {
+                return;
+            }
+            voxels += (begin - run_first_voxel) * voxel_size;
+            if (pitched) {
+                convert_pitched(voxels, begin - first_voxel, end - begin, parallel);
+            } else if (parallel) {
+                convert_to_float(voxels,
+                                 info.voxel_type,
+                                 out + (begin - first_voxel),
+                                 end - begin,
+                                 normalization);
+            } else {
+                convert_to_float_serial(voxels,
+                                        info.voxel_type,
+                                        out + (begin - first_voxel),
+                                        end - begin,
+                                        normalization);
+            }
+        };
+        // Blocks read from an uncompressed input are converted as they complete, only the
+        // loaded slices are read
+        const bool success =
+            use_block_reader(info)
+                ? read_payload_blocks(info, first_voxel, load_voxels, convert_run)
+                : decode_payload(info, num_voxels, convert_run);
+        if (!success) {
+            return false;
+        }
+    }
+    print_load_summary("Loaded", info, normalization, steady_clock::now() - start);
+    return true;
+}
+
+bool stream_raw_volume(const std::string &raw_file_name,
+                       const RawVolumeInfo &info,
+                       const NormalizeOptions &normalize,
+                       size_t slab_bytes,
+                       const RawSlabFn &fn)
+{
+    PROFILE_ZONE("stream_raw_volume");
+    using namespace std::chrono;
+    if (info.num_components != 1) {
+        std::cerr << "Raw volume " << raw_file_name << " has " << info.num_components
+                  << " components per voxel, but a single component volume was expected\n";
+        return false;
+    }
+    const glm::uvec3 dims = info.dims;
+    const size_t voxel_size = dtype_size(info.voxel_type.dtype);
+    const size_t slice_voxels = size_t(dims.x) * size_t(dims.y);
+    const size_t num_voxels = slice_voxels * dims.z;
+    uint32_t slab_slices = std::max(
+        size_t(1), std::min(size_t(dims.z), slab_bytes / (slice_voxels * sizeof(float))));
+    if (!info.hdf5_dataset.empty()) {
+        // HDF5 slabs hold whole layers of chunks
+        slab_slices = std::min(dims.z, hdf5_slab_slices(info, slab_slices));
+    }
+    const InputCompression compression = info.compression;
+
+    MappedFile file;
+    const uint8_t *payload = nullptr;
+    if (!open_raw_input(info, file, payload)) {
+        return false;
+    }
+    Normalization normalization;
+    if (!find_normalization(info, payload, normalize, normalization)) {
+        return false;
+    }
+
+    auto start = steady_clock::now();
+    LargeVector<float> slab(slab_slices * slice_voxels);
+    if (!info.hdf5_dataset.empty()) {
+        uint32_t slab_z = 0;
+        const bool success = read_hdf5_chunks(
+            info,
+            0,
+            dims.z,
+            slab_slices,
+            [&](const uint8_t *voxels, const HDF5ChunkBox &box) {
+                convert_chunk_box(
+                    voxels, box, info.voxel_type, normalization, slab.data(), slab_z, dims);
+            },
+            [&](uint32_t z_begin, uint32_t z_end) {
+                slab_z = z_end;
+                return fn(slab.data(), z_begin, z_end);
+            });
+        if (!success) {
+            return false;
+        }
+    } else if (compression == InputCompression::NONE) {
+        for (uint32_t z = 0; z < dims.z; z += slab_slices) {
+            const uint32_t z_end = std::min(dims.z, z + slab_slices);
+            const size_t first_voxel = slice_voxels * z;
+            const size_t n = slice_voxels * (z_end - z);
+            if (use_block_reader(info)) {
+                const bool success = read_payload_blocks(
+                    info,
+                    first_voxel,
+                    n,
+                    [&](const uint8_t *voxels, size_t run_first_voxel, size_t run, bool) {
+                        convert_to_float_serial(voxels,
+                                                info.voxel_type,
+                                                slab.data() + (run_first_voxel - first_voxel),
+                                                run,
+                                                normalization);
+                    });
+                if (!success) {
+                    return false;
+                }
+            } else {
+                // Start reading the next slab while this one is converted and processed
+                if (z_end < dims.z) {
+                    file.will_need(info.data_offset + (first_voxel + n) * voxel_size,
+                                   slice_voxels * std::min(slab_slices, dims.z - z_end) *
+                                       voxel_size);
+                }
+                convert_to_float(payload + first_voxel * voxel_size,
+                                 info.voxel_type,
+                                 slab.data(),
+                                 n,
+                                 normalization);
+            }
+            if (!fn(slab.data(), z, z_end)) {
+                return false;
+            }
+        }
+    } else {
+        // Runs arrive in order, so whole slices are gathered into the slab and handed to fn
+        // each time it fills
+        uint32_t slab_z = 0;
+        size_t filled = 0;
+        bool success = true;
+        const bool decoded = decode_payload(
+            info,
+            num_voxels,
+            [&](const uint8_t *voxels, size_t, size_t n, bool) {
+                while (n > 0 && success) {
+                    const uint32_t slices = std::min(slab_slices, dims.z - slab_z);
+                    const size_t take = std::min(n, slices * slice_voxels - filled);
+                    convert_to_float(
+                        voxels, info.voxel_type, slab.data() + filled, take, normalization);
+                    voxels += take * voxel_size;
+                    n -= take;
+                    filled += take;
+                    if (filled == slices * slice_voxels) {
+                        success = fn(slab.data(), slab_z, slab_z + slices);
+                        slab_z += slices;
+                        filled = 0;
+                    }
+                }
+            },
+            true);
+        if (!decoded || !success || slab_z != dims.z) {
+            return false;
+        }
+    }
+    print_load_summary("Streamed", info, normalization, steady_clock::now() - start);
+    return true;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <glm/glm.hpp>
+#include "compressed_input.h"
+#include "dtype.h"
+#include "large_buffer.h"
+#include "padding.h"
+
+// The volume name, dimensions and voxel type parsed from a raw volume file name or a volume
+// header, and where its voxels are stored
+struct RawVolumeInfo {
+    std::string name;
+    glm::uvec3 dims = glm::uvec3(0);
+    VoxelType voxel_type;
+    // Number of interleaved components per voxel, e.g. 3 for a vector field
+    uint32_t num_components = 1;
+    // The file holding the voxels and the byte offset they start at. This is the raw volume
+    // itself, or for header formats the file the header names or the header file
+    std::string data_file;
+    size_t data_offset = 0;
+    InputCompression compression = InputCompression::NONE;
+    // Distance between voxels along each axis, for formats which store it
+    glm::vec3 spacing = glm::vec3(1.f);
+    // Set for HDF5 datasets which can't be mapped like a raw volume, e.g. chunked or
+    // compressed ones, which are read by read_hdf5_chunks (see hdf5_input.h) instead
+    std::string hdf5_dataset;
+    glm::uvec3 hdf5_chunk_dims = glm::uvec3(0);
+};
+
+// Parse a raw volume file name following the OpenSciVisData convention:
+// <name>_<X>x<Y>x<Z>_<data type>.raw. Volumes with multiple interleaved components per voxel
+// append the component count to the data type, e.g. <name>_<X>x<Y>x<Z>_float32x4.raw
+bool parse_raw_volume_name(const std::string &raw_file_name, RawVolumeInfo &info);
+
+// Get the info of a volume from its NRRD, MetaImage or VTK header (see volume_header.h), its
+// HDF5 dataset (see hdf5_input.h), or otherwise from its raw volume file name
+bool read_volume_info(const std::string &file_name, RawVolumeInfo &info);
+
+// Get the base name of the outputs made from a volume. Raw volumes keep their file name, while
+// header formats get the dims and type added to theirs, e.g. CT-head_256x256x113_uint16.nrrd,
+// so outputs follow the raw naming convention the .zfp readers parse. HDF5 datasets are named
+// by their file and dataset, e.g. run_density_512x512x512_float32.h5 for run.h5:/density.
+// Spacing other than 1 is kept as a suffix, e.g. CT-head_256x256x113_uint16.nrrd.spacing1x1x2,
+// scaled to out_dims if the volume is resampled to them
+std::string volume_output_name(const std::string &file_name,
+                               const RawVolumeInfo &info,
+                               const glm::uvec3 &out_dims = glm::uvec3(0));
+
+// Replace the dims in a volume name with new dims, e.g. giving skull_256x256x256_uint8.raw for
+// skull_512x512x512_uint8.raw, for outputs made of a resampled or padded volume
+std::string replace_volume_name_dims(const std::string &name, const glm::uvec3 &dims);
+
+// How values are normalized to [0, 1] while loading
+struct NormalizeOptions {
+    enum Mode { NONE, RANGE, AUTO };
+    Mode mode = NONE;
+    // The input value range mapped to [0, 1] in RANGE mode
+    double min = 0.0;
+    double max = 1.0;
+};
+
+// Load the raw volume and convert it to float, normalizing values in the same pass if
+// requested. In AUTO mode the value range is found by a parallel reduction over the raw input
+// first. With padding, data holds the volume at the padded dims, with the voxels converted
+// straight to their padded positions, while dims is set to the volume's logical dims.
+bool read_raw_volume(const std::string &raw_file_name,
+                     VolumeBuffer &data,
+                     glm::uvec3 &dims,
+                     const NormalizeOptions &normalize = NormalizeOptions(),
+                     const PaddingOptions &padding = PaddingOptions());
+
+// Load the z slices [z_begin, z_end) of the raw volume described by info into out, which must
+// have room for all their voxels. By default the whole volume is loaded. AUTO normalization
+// uses the value range of the whole volume, so separately loaded slabs are normalized alike.
+// out_dims gives the row and slice pitch of out when it's larger than the volume, e.g. for a
+// padded volume, and defaults to the volume's dims
+bool load_raw_volume(const std::string &raw_file_name,
+                     const RawVolumeInfo &info,
+                     float *out,
+                     const NormalizeOptions &normalize = NormalizeOptions(),
+                     uint32_t z_begin = 0,
+                     uint32_t z_end = UINT32_MAX,
+                     const glm::uvec3 &out_dims = glm::uvec3(0));
+
+// Called with the z slices [z_begin, z_end) of a streamed volume converted to float. Return
+// false to stop streaming
+using RawSlabFn = std::function<bool(const float *slices, uint32_t z_begin, uint32_t z_end)>;
+
+// Stream the raw volume to fn as float slabs of whole z slices in order, about slab_bytes in
+// size, converting and normalizing each as it's read. Only one slab of float data is held at a
+// time, so volumes larger than memory as floats can be processed. Compressed inputs are
+// decoded in order on the streaming path.
+bool stream_raw_volume(const std::string &raw_file_name,
+                       const RawVolumeInfo &info,
+                       const NormalizeOptions &normalize,
+                       size_t slab_bytes,
+                       const RawSlabFn &fn);
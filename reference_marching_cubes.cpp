@@ -0,0 +1,431 @@
+#include "reference_marching_cubes.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+#include "parallel.h"
+#include "profiler.h"
+
+namespace {
+
+// Cube corners are indexed by their offset in the cell, x | y << 1 | z << 2. Each edge runs
+// from a corner to the corner one step further along the edge's axis.
+struct CubeEdge {
+    int c0 = 0;
+    int c1 = 0;
+};
+
+struct MCCaseTable {
+    std::array<CubeEdge, 12> edges;
+    // The edges of the triangles for each case, where the case has the bit of each corner
+    // above the isovalue set
+    std::array<std::vector<uint8_t>, 256> triangles;
+    size_t max_triangles = 0;
+};
+
+// Build the marching cubes case table by walking the faces of the cube for each case instead
+// of using a precomputed table. On each face the surface runs from an edge where the face's
+// boundary enters the corners above the isovalue to the next edge counter clockwise where
+// it leaves them, and the segments are linked into loops which are triangulated as fans.
+// Ambiguous faces are resolved by the face alone, keeping the corners above the isovalue
+// separate, so neighboring cells always agree on the shared face and the surface is
+// watertight. Triangles face away from the values above the isovalue.
+MCCaseTable build_case_table()
+{
+    MCCaseTable table;
+    int edge_ids[8][8] = {};
+    int num_edges = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+        for (int c = 0; c < 8; ++c) {
+            if (!(c & (1 << axis))) {
+                table.edges[num_edges] = CubeEdge{c, c | (1 << axis)};
+                edge_ids[c][c | (1 << axis)] = num_edges;
+                edge_ids[c | (1 << axis)][c] = num_edges;
+                ++num_edges;
+            }
+        }
+    }
+
+    // The corners of each face in counter clockwise order seen from outside the cube
+    std::array<std::array<int, 4>, 6> faces;
+    for (int axis = 0; axis < 3; ++axis) {
+        const int u = 1 << ((axis + 1) % 3);
+        const int v = 1 << ((axis + 2) % 3);
+        for (int side = 0; side < 2; ++side) {
+            const int w = side ? 1 << axis : 0;
+            std::array<int, 4> face = {w, w | u, w | u | v, w | v};
+            if (!side) {
+                std::reverse(face.begin(), face.end());
+            }
+            faces[axis * 2 + side] = face;
+        }
+    }
+
+    for (int mc_case = 0; mc_case < 256; ++mc_case) {
+        auto above = [&](const int c) { return (mc_case & (1 << c)) != 0; };
+        int next_edge[12];
+        std::fill(next_edge, next_edge + 12, -1);
+        for (const auto &face : faces) {
+            for (int i = 0; i < 4; ++i) {
+                if (above(face[i]) || !above(face[(i + 1) % 4])) {
+                    continue;
+                }
+                for (int j = 1; j < 4; ++j) {
+                    const int k = (i + j) % 4;
+                    if (above(face[k]) && !above(face[(k + 1) % 4])) {
+                        next_edge[edge_ids[face[i]][face[(i + 1) % 4]]] =
+                            edge_ids[face[k]][face[(k + 1) % 4]];
+                        break;
+                    }
+                }
+            }
+        }
+
+        bool visited[12] = {false};
+        std::vector<uint8_t> &triangles = table.triangles[mc_case];
+        for (int e = 0; e < 12; ++e) {
+            if (next_edge[e] < 0 || visited[e]) {
+                continue;
+            }
+            std::vector<uint8_t> loop;
+            for (int i = e; !visited[i]; i = next_edge[i]) {
+                visited[i] = true;
+                loop.push_back(i);
+            }
+            for (size_t i = 1; i + 1 < loop.size(); ++i) {
+                triangles.push_back(loop[0]);
+                triangles.push_back(loop[i]);
+                triangles.push_back(loop[i + 1]);
+            }
+        }
+        table.max_triangles = std::max(table.max_triangles, triangles.size() / 3);
+    }
+    return table;
+}
+
+const MCCaseTable &case_table()
+{
+    static const MCCaseTable table = build_case_table();
+    return table;
+}
+
+glm::uvec3 corner_offset(const int c)
+{
+    return glm::uvec3(c & 1, (c >> 1) & 1, (c >> 2) & 1);
+}
+
+glm::uvec3 block_coords(const size_t block_index, const glm::uvec3 &block_dims)
+{
+    return glm::uvec3(block_index % block_dims.x,
+                      (block_index / block_dims.x) % block_dims.y,
+                      block_index / (size_t(block_dims.x) * block_dims.y));
+}
+
+size_t block_index(const glm::uvec3 &b, const glm::uvec3 &block_dims)
+{
+    return b.x + size_t(block_dims.x) * (b.y + size_t(block_dims.y) * b.z);
+}
+
+// Per thread storage for the triangles output by a worker. Vertices are allocated in chunks
+// which are never reallocated, and the triangles of a block are contiguous in one chunk
+class VertexArena {
+    static constexpr size_t CHUNK_VERTICES = size_t(1) << 20;
+    std::vector<std::unique_ptr<glm::vec3[]>> chunks;
+    size_t chunk_used = CHUNK_VERTICES;
+
+public:
+    // Get room for up to n vertices, n must be at most CHUNK_VERTICES
+    glm::vec3 *reserve(size_t n)
+    {
+        if (chunk_used + n > CHUNK_VERTICES) {
+            chunks.emplace_back(new glm::vec3[CHUNK_VERTICES]);
+            chunk_used = 0;
+        }
+        return chunks.back().get() + chunk_used;
+    }
+
+    void commit(size_t n)
+    {
+        chunk_used += n;
+    }
+};
+
+struct BlockTriangles {
+    size_t block = 0;
+    const glm::vec3 *vertices = nullptr;
+    size_t num_triangles = 0;
+};
+
+// Run marching cubes on the cells of the block, i.e. the cells whose lower corner is a voxel
+// of the block. Returns the number of vertices written to out
+size_t march_block(BlockDecoder &decoder,
+                   const CompressedVolumeInfo &info,
+                   const MCCaseTable &table,
+                   const float isovalue,
+                   const size_t block,
+                   glm::vec3 *out)
+{
+    const glm::uvec3 block_dims = info.block_dims();
+    const glm::uvec3 b = block_coords(block, block_dims);
+
+    // The block's voxels and the first layer of voxels of its +x/+y/+z neighbors
+    float values[5 * 5 * 5];
+    float decoded[ZFP_BLOCK_VOXELS];
+    for (int n = 0; n < 8; ++n) {
+        const glm::uvec3 o = corner_offset(n);
+        const glm::uvec3 nb = b + o;
+        if (glm::any(glm::greaterThanEqual(nb, block_dims))) {
+            continue;
+        }
+        decoder.decode(block_index(nb, block_dims), decoded);
+        const glm::uvec3 extent = glm::uvec3(4) - glm::uvec3(3) * o;
+        for (uint32_t z = 0; z < extent.z; ++z) {
+            for (uint32_t y = 0; y < extent.y; ++y) {
+                for (uint32_t x = 0; x < extent.x; ++x) {
+                    const glm::uvec3 l = glm::uvec3(x, y, z) + glm::uvec3(4) * o;
+                    values[l.x + 5 * (l.y + 5 * l.z)] = decoded[x + 4 * (y + 4 * z)];
+                }
+            }
+        }
+    }
+
+    const glm::uvec3 origin = b * glm::uvec3(4);
+    const glm::uvec3 cells = glm::min(glm::uvec3(4), info.dims - glm::uvec3(1) - origin);
+    size_t num_vertices = 0;
+    for (uint32_t z = 0; z < cells.z; ++z) {
+        for (uint32_t y = 0; y < cells.y; ++y) {
+            for (uint32_t x = 0; x < cells.x; ++x) {
+                float corners[8];
+                int mc_case = 0;
+                for (int c = 0; c < 8; ++c) {
+                    const glm::uvec3 l = glm::uvec3(x, y, z) + corner_offset(c);
+                    corners[c] = values[l.x + 5 * (l.y + 5 * l.z)];
+                    if (corners[c] > isovalue) {
+                        mc_case |= 1 << c;
+                    }
+                }
+                const glm::vec3 cell(origin + glm::uvec3(x, y, z));
+                for (const uint8_t edge : table.triangles[mc_case]) {
+                    const CubeEdge &e = table.edges[edge];
+                    const float t =
+                        (isovalue - corners[e.c0]) / (corners[e.c1] - corners[e.c0]);
+                    out[num_vertices++] = cell + glm::vec3(corner_offset(e.c0)) +
+                                          t * glm::vec3(corner_offset(e.c1 ^ e.c0));
+                }
+            }
+        }
+    }
+    return num_vertices;
+}
+
+bool write_stl(const std::string &file_name,
+               const std::vector<BlockTriangles> &blocks,
+               size_t num_triangles,
+               float isovalue)
+{
+    if (num_triangles > UINT32_MAX) {
+        std::cerr << "Mesh has too many triangles to write as STL\n";
+        return false;
+    }
+    std::ofstream fout(file_name.c_str(), std::ios::binary);
+    if (!fout) {
+        std::cerr << "Failed to open mesh file " << file_name << "\n";
+        return false;
+    }
+    char header[80] = {0};
+    std::snprintf(header, sizeof(header), "zfp_make_test_data isosurface %g", isovalue);
+    fout.write(header, sizeof(header));
+    const uint32_t count = num_triangles;
+    fout.write(reinterpret_cast<const char *>(&count), sizeof(count));
+
+    // Each STL triangle is its normal, 3 vertices and a 2 byte attribute
+    constexpr size_t STL_TRIANGLE_BYTES = 50;
+    std::vector<char> buffer;
+    buffer.reserve(STL_TRIANGLE_BYTES * 8192);
+    for (const auto &b : blocks) {
+        for (size_t i = 0; i < b.num_triangles; ++i) {
+            const glm::vec3 *v = b.vertices + i * 3;
+            glm::vec3 normal = glm::cross(v[1] - v[0], v[2] - v[0]);
+            const float len = glm::length(normal);
+            normal = len > 0.f ? normal / len : glm::vec3(0.f);
+            float data[12] = {normal.x,
+                              normal.y,
+                              normal.z,
+                              v[0].x,
+                              v[0].y,
+                              v[0].z,
+                              v[1].x,
+                              v[1].y,
+                              v[1].z,
+                              v[2].x,
+                              v[2].y,
+                              v[2].z};
+            const size_t offset = buffer.size();
+            buffer.resize(offset + STL_TRIANGLE_BYTES, 0);
+            std::memcpy(buffer.data() + offset, data, sizeof(data));
+            if (buffer.size() + STL_TRIANGLE_BYTES > buffer.capacity()) {
+                fout.write(buffer.data(), buffer.size());
+                buffer.clear();
+            }
+        }
+    }
+    fout.write(buffer.data(), buffer.size());
+    return bool(fout);
+}
+
+}
+
+bool run_reference_marching_cubes(const uint8_t *stream,
+                                  size_t stream_size,
+                                  const CompressedVolumeInfo &info,
+                                  const ReferenceMCOptions &options)
+{
+    using namespace std::chrono;
+    PROFILE_ZONE("reference marching cubes");
+    if (stream_size < info.stream_bytes()) {
+        std::cerr << "Compressed stream is too small for the volume\n";
+        return false;
+    }
+    const MCCaseTable &table = case_table();
+    const glm::uvec3 block_dims = info.block_dims();
+    const size_t num_blocks = info.num_blocks();
+    const float isovalue = options.isovalue;
+
+    // Find the value range of each block over its voxels inside the volume
+    auto start = steady_clock::now();
+    std::vector<glm::vec2> ranges(num_blocks);
+    parallel_for(0, num_blocks, [&](const size_t begin, const size_t end) {
+        PROFILE_ZONE("compute block ranges");
+        BlockDecoder decoder(stream, stream_size, info.rate);
+        float block[ZFP_BLOCK_VOXELS];
+        for (size_t i = begin; i < end; ++i) {
+            decoder.decode(i, block);
+            const glm::uvec3 origin = block_coords(i, block_dims) * glm::uvec3(4);
+            const glm::uvec3 extent = glm::min(glm::uvec3(4), info.dims - origin);
+            glm::vec2 range(block[0], block[0]);
+            for (uint32_t z = 0; z < extent.z; ++z) {
+                for (uint32_t y = 0; y < extent.y; ++y) {
+                    for (uint32_t x = 0; x < extent.x; ++x) {
+                        const float v = block[x + 4 * (y + 4 * z)];
+                        range.x = std::min(range.x, v);
+                        range.y = std::max(range.y, v);
+                    }
+                }
+            }
+            ranges[i] = range;
+        }
+    });
+    auto ranges_time = steady_clock::now();
+
+    // A block is active if the range of its cells, which include the first layer of voxels of
+    // its +x/+y/+z neighbors, contains the isovalue. The neighbors are decoded along with it
+    std::vector<uint8_t> needed(num_blocks, 0);
+    std::vector<size_t> active_blocks;
+    {
+        PROFILE_ZONE("select active blocks");
+        std::vector<uint8_t> active(num_blocks, 0);
+        parallel_for(0, num_blocks, [&](const size_t begin, const size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                const glm::uvec3 b = block_coords(i, block_dims);
+                glm::vec2 range = ranges[i];
+                for (int n = 1; n < 8; ++n) {
+                    const glm::uvec3 nb = b + corner_offset(n);
+                    if (!glm::any(glm::greaterThanEqual(nb, block_dims))) {
+                        const glm::vec2 &r = ranges[block_index(nb, block_dims)];
+                        range = glm::vec2(std::min(range.x, r.x), std::max(range.y, r.y));
+                    }
+                }
+                active[i] = range.x <= isovalue && isovalue < range.y;
+            }
+        });
+        for (size_t i = 0; i < num_blocks; ++i) {
+            if (!active[i]) {
+                continue;
+            }
+            active_blocks.push_back(i);
+            const glm::uvec3 b = block_coords(i, block_dims);
+            for (int n = 0; n < 8; ++n) {
+                const glm::uvec3 nb = b + corner_offset(n);
+                if (!glm::any(glm::greaterThanEqual(nb, block_dims))) {
+                    needed[block_index(nb, block_dims)] = 1;
+                }
+            }
+        }
+    }
+    const size_t num_decoded = std::count(needed.begin(), needed.end(), uint8_t(1));
+    auto select_time = steady_clock::now();
+
+    // Workers take batches of active blocks and append their triangles to their own arena
+    constexpr size_t BATCH_BLOCKS = 64;
+    const size_t max_block_vertices = size_t(64) * table.max_triangles * 3;
+    const size_t num_workers = worker_thread_count();
+    std::vector<VertexArena> arenas(num_workers);
+    std::vector<std::vector<BlockTriangles>> worker_blocks(num_workers);
+    std::atomic<size_t> next_batch(0);
+    parallel_for(0, num_workers, [&](const size_t worker, const size_t) {
+        PROFILE_ZONE("marching cubes");
+        BlockDecoder decoder(stream, stream_size, info.rate);
+        VertexArena &arena = arenas[worker];
+        for (size_t batch = next_batch++; batch * BATCH_BLOCKS < active_blocks.size();
+             batch = next_batch++) {
+            const size_t end = std::min((batch + 1) * BATCH_BLOCKS, active_blocks.size());
+            for (size_t i = batch * BATCH_BLOCKS; i < end; ++i) {
+                glm::vec3 *vertices = arena.reserve(max_block_vertices);
+                const size_t n = march_block(
+                    decoder, info, table, isovalue, active_blocks[i], vertices);
+                arena.commit(n);
+                if (n != 0) {
+                    worker_blocks[worker].push_back(
+                        BlockTriangles{active_blocks[i], vertices, n / 3});
+                }
+            }
+        }
+    });
+    auto mc_time = steady_clock::now();
+
+    // Gather the triangles in block order, so the mesh doesn't depend on the scheduling
+    std::vector<BlockTriangles> blocks;
+    size_t num_triangles = 0;
+    for (const auto &w : worker_blocks) {
+        for (const auto &b : w) {
+            blocks.push_back(b);
+            num_triangles += b.num_triangles;
+        }
+    }
+    std::sort(blocks.begin(),
+              blocks.end(),
+              [](const BlockTriangles &a, const BlockTriangles &b) {
+                  return a.block < b.block;
+              });
+
+    std::cout << "Reference marching cubes at isovalue " << isovalue << ":\n"
+              << "  Block ranges: " << num_blocks << " blocks decoded in "
+              << duration_cast<milliseconds>(ranges_time - start).count() << "ms\n"
+              << "  Active blocks: " << active_blocks.size() << "/" << num_blocks << " ("
+              << num_decoded << " blocks decoded with their neighbors), selected in "
+              << duration_cast<milliseconds>(select_time - ranges_time).count() << "ms\n"
+              << "  Marching cubes: " << num_triangles << " triangles in "
+              << duration_cast<milliseconds>(mc_time - select_time).count() << "ms on "
+              << num_workers << " threads\n"
+              << "  Vertex buffer: " << num_triangles * 3 << " vertices, "
+              << num_triangles * 3 * sizeof(glm::vec3) << "b of float3 positions\n";
+
+    if (!options.mesh_file.empty()) {
+        PROFILE_ZONE("write mesh");
+        auto write_start = steady_clock::now();
+        if (!write_stl(options.mesh_file, blocks, num_triangles, isovalue)) {
+            return false;
+        }
+        auto write_end = steady_clock::now();
+        std::cout << "  Wrote mesh to " << options.mesh_file << " in "
+                  << duration_cast<milliseconds>(write_end - write_start).count() << "ms\n";
+    }
+    return true;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "block_decoder.h"
+
+struct ReferenceMCOptions {
+    float isovalue = 0.f;
+    // Write the isosurface to this file as a binary STL mesh, if set
+    std::string mesh_file;
+};
+
+// CPU reference of BCMC's block compressed marching cubes, run over a fixed rate ZFP stream.
+// The value range of each block is found by decoding all blocks, then the blocks containing
+// the isovalue (including the cells shared with their +x/+y/+z neighbors) are decoded along
+// with those neighbors and marching cubes is run on their cells. Workers append triangles to
+// their own vertex arenas. Prints the active block and triangle counts, the size of the
+// vertex buffer BCMC would need and the time taken by each stage.
+bool run_reference_marching_cubes(const uint8_t *stream,
+                                  size_t stream_size,
+                                  const CompressedVolumeInfo &info,
+                                  const ReferenceMCOptions &options);
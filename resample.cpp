@@ -0,0 +1,293 @@
+#include "resample.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <vector>
+#include <glm/gtx/string_cast.hpp>
+#include "parallel.h"
+#include "profiler.h"
+
+namespace {
+
+// The input voxels (taps) and their weights for each output voxel along one axis, with the
+// taps of output i in [offsets[i], offsets[i + 1]), in increasing input order
+struct AxisTaps {
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> index;
+    std::vector<float> weight;
+
+    uint32_t first(uint32_t i) const
+    {
+        return index[offsets[i]];
+    }
+
+    uint32_t last(uint32_t i) const
+    {
+        return index[offsets[i + 1] - 1];
+    }
+};
+
+AxisTaps make_axis_taps(uint32_t in, uint32_t out, ResampleFilter filter)
+{
+    AxisTaps taps;
+    taps.offsets.push_back(0);
+    const double scale = double(in) / out;
+    for (uint32_t i = 0; i < out; ++i) {
+        if (filter == ResampleFilter::TRILINEAR) {
+            const double c =
+                std::min(std::max((i + 0.5) * scale - 0.5, 0.0), double(in - 1));
+            const uint32_t j = std::min(uint32_t(c), in - 1);
+            const float f = float(c - j);
+            taps.index.push_back(j);
+            taps.weight.push_back(1.f - f);
+            if (f > 0.f && j + 1 < in) {
+                taps.index.push_back(j + 1);
+                taps.weight.push_back(f);
+            }
+        } else {
+            // The output voxel covers [lo, hi) of the input
+            const double lo = i * scale;
+            const double hi = (i + 1) * scale;
+            const uint32_t begin = std::min(uint32_t(lo), in - 1);
+            const uint32_t end =
+                std::max(begin + 1, std::min(in, uint32_t(std::ceil(hi - 1e-9))));
+            for (uint32_t j = begin; j < end; ++j) {
+                // MINMAX weights give the mean of the covered voxels
+                const double overlap = std::min(hi, j + 1.0) - std::max(lo, double(j));
+                taps.index.push_back(j);
+                taps.weight.push_back(filter == ResampleFilter::BOX
+                                          ? float(overlap / scale)
+                                          : 1.f / (end - begin));
+            }
+        }
+        taps.offsets.push_back(taps.index.size());
+    }
+    return taps;
+}
+
+// The output slices along z which each input slice contributes to, and its weight in each
+struct SliceContribution {
+    uint32_t out_z;
+    float weight;
+};
+
+class SliceResampler {
+    glm::uvec3 in_dims;
+    glm::uvec3 out_dims;
+    // Dims of the output buffer, larger than out_dims when the output is padded
+    glm::uvec3 out_pitch;
+    ResampleFilter filter;
+    AxisTaps x_taps, y_taps, z_taps;
+    std::vector<std::vector<SliceContribution>> contributions;
+    // Running min and max of the output slices being accumulated by MINMAX, in a ring of
+    // slices indexed by out_z % ring_slices
+    uint32_t ring_slices = 1;
+    std::vector<float> ring_min, ring_max;
+    float *out;
+
+    // Filter input row y of the slice along x, accumulating the weighted sum, min and max
+    // for each output voxel of the row
+    void filter_row(const float *slice,
+                    uint32_t y,
+                    float y_weight,
+                    bool first,
+                    float *sum,
+                    float *lo,
+                    float *hi) const
+    {
+        const float *row = slice + size_t(in_dims.x) * y;
+        for (uint32_t x = 0; x < out_dims.x; ++x) {
+            float s = 0.f;
+            float row_lo = std::numeric_limits<float>::infinity();
+            float row_hi = -row_lo;
+            for (uint32_t t = x_taps.offsets[x]; t < x_taps.offsets[x + 1]; ++t) {
+                const float v = row[x_taps.index[t]];
+                s += x_taps.weight[t] * v;
+                row_lo = std::min(row_lo, v);
+                row_hi = std::max(row_hi, v);
+            }
+            sum[x] = (first ? 0.f : sum[x]) + y_weight * s;
+            lo[x] = first ? row_lo : std::min(lo[x], row_lo);
+            hi[x] = first ? row_hi : std::max(hi[x], row_hi);
+        }
+    }
+
+public:
+    SliceResampler(const glm::uvec3 &in_dims,
+                   const glm::uvec3 &out_dims,
+                   const glm::uvec3 &out_pitch,
+                   ResampleFilter filter,
+                   float *out)
+        : in_dims(in_dims),
+          out_dims(out_dims),
+          out_pitch(out_pitch),
+          filter(filter),
+          x_taps(make_axis_taps(in_dims.x, out_dims.x, filter)),
+          y_taps(make_axis_taps(in_dims.y, out_dims.y, filter)),
+          z_taps(make_axis_taps(in_dims.z, out_dims.z, filter)),
+          contributions(in_dims.z),
+          out(out)
+    {
+        for (uint32_t z = 0; z < out_dims.z; ++z) {
+            for (uint32_t t = z_taps.offsets[z]; t < z_taps.offsets[z + 1]; ++t) {
+                contributions[z_taps.index[t]].push_back(
+                    SliceContribution{z, z_taps.weight[t]});
+            }
+        }
+        if (filter == ResampleFilter::MINMAX) {
+            // Output slices are open from their first to their last tap, size the ring to
+            // hold all the slices open at once
+            for (const auto &c : contributions) {
+                if (!c.empty()) {
+                    ring_slices =
+                        std::max(ring_slices, c.back().out_z - c.front().out_z + 1);
+                }
+            }
+            const size_t ring_size = size_t(ring_slices) * out_dims.x * out_dims.y;
+            ring_min.resize(ring_size);
+            ring_max.resize(ring_size);
+        }
+    }
+
+    // Accumulate the input slices [z_begin, z_end) into the output. Slabs must be passed in
+    // order. Output slices are complete once their last input slice has been passed
+    void process(const float *slab, uint32_t z_begin, uint32_t z_end)
+    {
+        PROFILE_ZONE("resample slab");
+        const size_t in_slice_voxels = size_t(in_dims.x) * in_dims.y;
+        const size_t out_slice_voxels = size_t(out_dims.x) * out_dims.y;
+        const size_t out_slice_pitch = size_t(out_pitch.x) * out_pitch.y;
+        // Workers own disjoint output rows across all the slices of the slab, so the
+        // accumulation needs no synchronization
+        parallel_for(0, out_dims.y, [&](const size_t y_begin, const size_t y_end) {
+            std::vector<float> sum(out_dims.x), lo(out_dims.x), hi(out_dims.x);
+            for (uint32_t z = z_begin; z < z_end; ++z) {
+                const auto &slice_contributions = contributions[z];
+                if (slice_contributions.empty()) {
+                    continue;
+                }
+                const float *slice = slab + (z - z_begin) * in_slice_voxels;
+                for (size_t y = y_begin; y < y_end; ++y) {
+                    for (uint32_t t = y_taps.offsets[y]; t < y_taps.offsets[y + 1]; ++t) {
+                        filter_row(slice,
+                                   y_taps.index[t],
+                                   y_taps.weight[t],
+                                   t == y_taps.offsets[y],
+                                   sum.data(),
+                                   lo.data(),
+                                   hi.data());
+                    }
+                    for (const auto &c : slice_contributions) {
+                        const size_t row = c.out_z * out_slice_pitch + y * out_pitch.x;
+                        const size_t ring_row =
+                            (c.out_z % ring_slices) * out_slice_voxels + y * out_dims.x;
+                        const bool first = z == z_taps.first(c.out_z);
+                        for (uint32_t x = 0; x < out_dims.x; ++x) {
+                            out[row + x] = (first ? 0.f : out[row + x]) + c.weight * sum[x];
+                        }
+                        if (filter != ResampleFilter::MINMAX) {
+                            continue;
+                        }
+                        float *slice_lo = &ring_min[ring_row];
+                        float *slice_hi = &ring_max[ring_row];
+                        for (uint32_t x = 0; x < out_dims.x; ++x) {
+                            slice_lo[x] = first ? lo[x] : std::min(slice_lo[x], lo[x]);
+                            slice_hi[x] = first ? hi[x] : std::max(slice_hi[x], hi[x]);
+                        }
+                        if (z == z_taps.last(c.out_z)) {
+                            // The output holds the mean, replace it with the extreme
+                            // furthest from the mean
+                            for (uint32_t x = 0; x < out_dims.x; ++x) {
+                                const float mean = out[row + x];
+                                out[row + x] = slice_hi[x] - mean > mean - slice_lo[x]
+                                                   ? slice_hi[x]
+                                                   : slice_lo[x];
+                            }
+                        }
+                    }
+                }
+            }
+        });
+    }
+};
+
+const char *filter_name(ResampleFilter filter)
+{
+    switch (filter) {
+    case ResampleFilter::TRILINEAR:
+        return "trilinear";
+    case ResampleFilter::MINMAX:
+        return "minmax";
+    default:
+        break;
+    }
+    return "box";
+}
+
+}
+
+bool parse_resample_filter(const std::string &name, ResampleFilter &filter)
+{
+    if (name == "box") {
+        filter = ResampleFilter::BOX;
+    } else if (name == "trilinear") {
+        filter = ResampleFilter::TRILINEAR;
+    } else if (name == "minmax") {
+        filter = ResampleFilter::MINMAX;
+    } else {
+        std::cout << "Unknown resample filter '" << name
+                  << "', expected box, trilinear or minmax\n";
+        return false;
+    }
+    return true;
+}
+
+bool read_raw_volume_resampled(const std::string &raw_file_name,
+                               const ResampleOptions &options,
+                               const NormalizeOptions &normalize,
+                               VolumeBuffer &data,
+                               const PaddingOptions &padding)
+{
+    using namespace std::chrono;
+    PROFILE_ZONE("read_raw_volume_resampled");
+    RawVolumeInfo info;
+    if (!read_volume_info(raw_file_name, info)) {
+        return false;
+    }
+    if (glm::any(glm::equal(options.dims, glm::uvec3(0))) ||
+        glm::any(glm::equal(info.dims, glm::uvec3(0)))) {
+        std::cout << "Resampling needs non-zero input and target dims\n";
+        return false;
+    }
+    std::cout << "Resampling " << glm::to_string(info.dims) << " to "
+              << glm::to_string(options.dims) << " with the "
+              << filter_name(options.filter) << " filter\n";
+
+    auto start = steady_clock::now();
+    const glm::uvec3 padded_dims = padding.padded_dims(options.dims);
+    data.resize(size_t(padded_dims.x) * padded_dims.y * padded_dims.z);
+    SliceResampler resampler(
+        info.dims, options.dims, padded_dims, options.filter, data.data());
+    const bool success = stream_raw_volume(
+        raw_file_name,
+        info,
+        normalize,
+        options.slab_bytes,
+        [&](const float *slab, uint32_t z_begin, uint32_t z_end) {
+            resampler.process(slab, z_begin, z_end);
+            return true;
+        });
+    if (!success) {
+        std::cout << "Failed to stream " << raw_file_name << " for resampling\n";
+        return false;
+    }
+    if (padded_dims != options.dims) {
+        fill_padding(data.data(), options.dims, padded_dims, padding);
+    }
+    auto end = steady_clock::now();
+    std::cout << "Resampled in " << duration_cast<milliseconds>(end - start).count()
+              << "ms\n";
+    return true;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <glm/glm.hpp>
+#include "large_buffer.h"
+#include "raw_volume.h"
+
+enum class ResampleFilter {
+    // Average of the input voxels covered by the output voxel, weighted by their overlap
+    BOX,
+    // Trilinear interpolation at the output voxel center
+    TRILINEAR,
+    // The min or max of the covered input voxels, whichever is further from their mean, so
+    // thin peaks and valleys which a box filter would average away survive downsampling
+    MINMAX
+};
+
+struct ResampleOptions {
+    // Target dims, resampling is disabled when zero
+    glm::uvec3 dims = glm::uvec3(0);
+    ResampleFilter filter = ResampleFilter::BOX;
+    // Size of the float slabs of input slices streamed through the resampler
+    size_t slab_bytes = size_t(256) << 20;
+
+    bool enabled() const
+    {
+        return dims != glm::uvec3(0);
+    }
+};
+
+// Parse a filter name: box, trilinear or minmax
+bool parse_resample_filter(const std::string &name, ResampleFilter &filter);
+
+// Load a raw volume resampled to options.dims. The input streams through in slabs of z
+// slices (see stream_raw_volume), and each input slice is filtered along x and y then
+// accumulated into the output slices it contributes to along z as it arrives, in parallel
+// over output rows. Only the output volume and one slab of the input are held as floats.
+// With padding, the output is written at the padded dims of options.dims.
+bool read_raw_volume_resampled(const std::string &raw_file_name,
+                               const ResampleOptions &options,
+                               const NormalizeOptions &normalize,
+                               VolumeBuffer &data,
+                               const PaddingOptions &padding = PaddingOptions());
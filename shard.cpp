@@ -0,0 +1,227 @@
+#include "shard.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <regex>
+#include <glm/gtx/string_cast.hpp>
+#include "block_decoder.h"
+#include "parallel.h"
+#include "profiler.h"
+
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr size_t COPY_CHUNK_BYTES = size_t(16) << 20;
+
+#ifdef __linux__
+bool write_all(int fd, const char *data, size_t size)
+{
+    while (size > 0) {
+        const ssize_t n = write(fd, data, size);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Write the files to out_name one after the other. The data is copied with copy_file_range,
+// so it stays in the kernel or is reflinked on file systems that support it, falling back to
+// read and write where it isn't supported
+bool concatenate_files(const std::vector<std::string> &files,
+                       const std::vector<size_t> &sizes,
+                       const std::string &out_name)
+{
+    const int out_fd = open(out_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out_fd < 0) {
+        return false;
+    }
+    bool kernel_copy = true;
+    std::vector<char> buffer;
+    bool success = true;
+    for (size_t i = 0; i < files.size() && success; ++i) {
+        const int in_fd = open(files[i].c_str(), O_RDONLY);
+        success = in_fd >= 0;
+        size_t copied = 0;
+        while (success && copied < sizes[i]) {
+            const size_t remaining = sizes[i] - copied;
+            ssize_t n = 0;
+            if (kernel_copy) {
+                n = copy_file_range(in_fd, nullptr, out_fd, nullptr, remaining, 0);
+                if (n < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+                              errno == EOPNOTSUPP)) {
+                    kernel_copy = false;
+                    continue;
+                }
+            } else {
+                buffer.resize(COPY_CHUNK_BYTES);
+                n = read(in_fd, buffer.data(), std::min(remaining, buffer.size()));
+                if (n > 0 && !write_all(out_fd, buffer.data(), n)) {
+                    n = -1;
+                }
+            }
+            success = n > 0;
+            copied += success ? n : 0;
+        }
+        if (in_fd >= 0) {
+            close(in_fd);
+        }
+    }
+    return close(out_fd) == 0 && success;
+}
+#else
+bool concatenate_files(const std::vector<std::string> &files,
+                       const std::vector<size_t> &sizes,
+                       const std::string &out_name)
+{
+    std::ofstream out(out_name.c_str(), std::ios::binary | std::ios::trunc);
+    std::vector<char> buffer(COPY_CHUNK_BYTES);
+    for (size_t i = 0; i < files.size() && out; ++i) {
+        std::ifstream in(files[i].c_str(), std::ios::binary);
+        for (size_t offset = 0; offset < sizes[i] && in && out; offset += buffer.size()) {
+            const size_t n = std::min(buffer.size(), sizes[i] - offset);
+            in.read(buffer.data(), n);
+            out.write(buffer.data(), n);
+        }
+        if (!in) {
+            return false;
+        }
+    }
+    return bool(out.flush());
+}
+#endif
+
+}
+
+bool parse_shard(const std::string &arg, ShardOptions &shard)
+{
+    const std::regex match_shard("(\\d+)/(\\d+)");
+    std::smatch matches;
+    if (!std::regex_match(arg, matches, match_shard)) {
+        std::cout << "Expected a shard as i/N, e.g. 0/4, but got '" << arg << "'\n";
+        return false;
+    }
+    shard.index = std::stoul(matches[1]);
+    shard.count = std::stoul(matches[2]);
+    if (shard.count == 0 || shard.index >= shard.count) {
+        std::cout << "Invalid shard " << arg << ", the index must be in [0, N)\n";
+        return false;
+    }
+    return true;
+}
+
+void shard_z_range(const glm::uvec3 &dims,
+                   const ShardOptions &shard,
+                   uint32_t &z_begin,
+                   uint32_t &z_end)
+{
+    const size_t block_layers = (dims.z + 3) / 4;
+    size_t layers_begin, layers_end;
+    partition_range(0, block_layers, shard.index, shard.count, layers_begin, layers_end);
+    z_begin = std::min(size_t(dims.z), layers_begin * 4);
+    z_end = std::min(size_t(dims.z), layers_end * 4);
+}
+
+std::string shard_file_name(const std::string &out_name, const ShardOptions &shard)
+{
+    return out_name + ".shard" + std::to_string(shard.index) + "of" +
+           std::to_string(shard.count);
+}
+
+bool merge_shards(const std::vector<std::string> &shard_files, std::string &out_name)
+{
+    using namespace std::chrono;
+    PROFILE_ZONE("merge_shards");
+    if (shard_files.empty()) {
+        std::cout << "-merge requires the shard outputs to merge\n";
+        return false;
+    }
+
+    // Order the shards by index and check they're all from the same conversion
+    const std::regex match_shard_name("(.+)\\.shard(\\d+)of(\\d+)");
+    std::vector<std::string> shards;
+    for (const auto &file : shard_files) {
+        std::smatch matches;
+        if (!std::regex_match(file, matches, match_shard_name)) {
+            std::cout << "'" << file << "' is not a shard output, expected a name like "
+                      << "<output>.shard<i>of<N>\n";
+            return false;
+        }
+        const size_t index = std::stoul(matches[2]);
+        const size_t count = std::stoul(matches[3]);
+        if (shards.empty()) {
+            out_name = matches[1];
+            shards.resize(count);
+        }
+        if (matches[1] != out_name || count != shards.size() || index >= count ||
+            !shards[index].empty()) {
+            std::cout << "Shard " << file << " does not belong to " << out_name << " with "
+                      << shards.size() << " shards, or was given twice\n";
+            return false;
+        }
+        shards[index] = file;
+    }
+    for (size_t i = 0; i < shards.size(); ++i) {
+        if (shards[i].empty()) {
+            std::cout << "Shard " << i << " of " << shards.size() << " of " << out_name
+                      << " is missing\n";
+            return false;
+        }
+    }
+
+    CompressedVolumeInfo info;
+    if (!parse_compressed_volume_name(out_name, info)) {
+        std::cout << "Could not find the dimensions and rate of " << out_name
+                  << " from its name\n";
+        return false;
+    }
+    const glm::uvec3 block_dims = info.block_dims();
+    const size_t layer_stream_bytes =
+        size_t(block_dims.x) * block_dims.y * size_t(info.rate) * 8;
+    std::vector<size_t> shard_bytes(shards.size(), 0);
+    for (size_t i = 0; i < shards.size(); ++i) {
+        ShardOptions shard;
+        shard.index = i;
+        shard.count = shards.size();
+        uint32_t z_begin, z_end;
+        shard_z_range(info.dims, shard, z_begin, z_end);
+        shard_bytes[i] = layer_stream_bytes * ((z_end - z_begin + 3) / 4);
+
+        std::ifstream file(shards[i].c_str(), std::ios::binary | std::ios::ate);
+        if (!file || size_t(file.tellg()) != shard_bytes[i]) {
+            std::cout << "Shard " << shards[i] << " should be " << shard_bytes[i]
+                      << "b for a " << glm::to_string(info.dims) << " volume at rate "
+                      << info.rate << ", it may be incomplete\n";
+            return false;
+        }
+    }
+
+    // Write to a temporary file and rename it when complete, so a failed merge doesn't leave
+    // a truncated stream behind
+    auto start = steady_clock::now();
+    const std::string tmp_name = out_name + ".tmp";
+    if (!concatenate_files(shards, shard_bytes, tmp_name) ||
+        std::rename(tmp_name.c_str(), out_name.c_str()) != 0) {
+        std::cout << "Failed to write merged output " << out_name << "\n";
+        std::remove(tmp_name.c_str());
+        return false;
+    }
+    auto end = steady_clock::now();
+    size_t total_bytes = 0;
+    for (const auto &b : shard_bytes) {
+        total_bytes += b;
+    }
+    const double seconds = duration<double>(end - start).count();
+    std::cout << "Merged " << shards.size() << " shards, " << total_bytes << "B in "
+              << seconds * 1000.0 << "ms (" << total_bytes / seconds / 1e9 << "GB/s)\n";
+    return true;
+}
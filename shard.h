@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Shard i of N of a sharded conversion. Each shard compresses a contiguous range of the layers
+// of blocks along z, which is a contiguous range of the fixed rate stream
+struct ShardOptions {
+    uint32_t index = 0;
+    uint32_t count = 0;
+
+    bool enabled() const
+    {
+        return count != 0;
+    }
+};
+
+// Parse a shard given as i/N
+bool parse_shard(const std::string &arg, ShardOptions &shard);
+
+// Get the z slices [z_begin, z_end) of the volume compressed by the shard. The range is empty
+// if there are more shards than layers of blocks
+void shard_z_range(const glm::uvec3 &dims,
+                   const ShardOptions &shard,
+                   uint32_t &z_begin,
+                   uint32_t &z_end);
+
+// Get the name of the partial output of the shard for the output out_name, e.g.
+// volume_256x256x256_uint8.raw.crate8.zfp.shard2of8
+std::string shard_file_name(const std::string &out_name, const ShardOptions &shard);
+
+// Concatenate the partial outputs of all shards of a conversion into the final stream, named
+// by removing the shard suffix. The dims and rate are taken from the output name, and the
+// shards are checked to be complete and of the expected size before anything is written.
+// Fixed rate streams are split on block boundaries, so the result is bit identical to
+// compressing the volume in one run.
+bool merge_shards(const std::vector<std::string> &shard_files, std::string &out_name);
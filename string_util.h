@@ -0,0 +1,10 @@
+#pragma once
+
+#include <string>
+
+// Check if str ends with suffix, e.g. for matching file extensions
+inline bool ends_with(const std::string &str, const std::string &suffix)
+{
+    return str.size() >= suffix.size() &&
+           str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
@@ -0,0 +1,486 @@
+#include "synthetic_volumes.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <vector>
+#include <glm/gtx/string_cast.hpp>
+#include "field_kernels.h"
+#include "parallel.h"
+#include "profiler.h"
+
+namespace {
+
+// Blocks sampled when calibrating the density parameter of a field, and the number of
+// bisection steps taken
+constexpr size_t CALIBRATION_SAMPLES = 4096;
+constexpr int CALIBRATION_ITERATIONS = 16;
+constexpr uint64_t SAMPLE_STREAM = 0x5a3c9e17d2b4f601ull;
+// Relative error in the active fraction of a generated volume past which a warning is printed
+constexpr double ACTIVE_FRACTION_TOLERANCE = 0.5;
+constexpr float PI = 3.14159265358979f;
+// Upper bound on the number of metaballs tried, well past where the balls fill the volume
+constexpr double MAX_METABALLS = 65536.0;
+
+// Counter-based RNG: hash the seed and a counter to 64 random bits with the splitmix64
+// finalizer. Values depend only on the counter, not on the order they're drawn in
+uint64_t hash_counter(uint64_t seed, uint64_t counter)
+{
+    uint64_t z = seed + 0x9e3779b97f4a7c15ull * (counter + 1);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// Map random bits to a float in [0, 1)
+float hash_to_unit(uint64_t h)
+{
+    return (h >> 40) * (1.f / 16777216.f);
+}
+
+// Seeded Perlin style gradient noise, with a gradient for each lattice point picked by
+// hashing its coordinates. Values are remapped from about [-1, 1] to [0, 1]
+class GradientNoiseField {
+    uint64_t seed;
+    float frequency;
+
+    float gradient_dot(const glm::ivec3 &lattice, const glm::vec3 &d) const
+    {
+        static const float gradients[12][3] = {{1, 1, 0},
+                                               {-1, 1, 0},
+                                               {1, -1, 0},
+                                               {-1, -1, 0},
+                                               {1, 0, 1},
+                                               {-1, 0, 1},
+                                               {1, 0, -1},
+                                               {-1, 0, -1},
+                                               {0, 1, 1},
+                                               {0, -1, 1},
+                                               {0, 1, -1},
+                                               {0, -1, -1}};
+        const uint64_t counter = (uint64_t(uint32_t(lattice.x)) & 0x1fffff) |
+                                 ((uint64_t(uint32_t(lattice.y)) & 0x1fffff) << 21) |
+                                 ((uint64_t(uint32_t(lattice.z)) & 0x1fffff) << 42);
+        const float *g = gradients[hash_counter(seed, counter) % 12];
+        return g[0] * d.x + g[1] * d.y + g[2] * d.z;
+    }
+
+public:
+    // frequency is the number of lattice cells per voxel
+    GradientNoiseField(uint64_t seed, float frequency) : seed(seed), frequency(frequency) {}
+
+    float operator()(float x, float y, float z) const
+    {
+        const glm::vec3 q = glm::vec3(x, y, z) * frequency;
+        const glm::vec3 cell = glm::floor(q);
+        const glm::ivec3 i(cell);
+        const glm::vec3 f = q - cell;
+        const glm::vec3 u = f * f * f * (f * (f * 6.f - 15.f) + 10.f);
+        float corners[8];
+        for (int c = 0; c < 8; ++c) {
+            const glm::ivec3 offset(c & 1, (c >> 1) & 1, (c >> 2) & 1);
+            corners[c] = gradient_dot(i + offset, f - glm::vec3(offset));
+        }
+        const float x0 = glm::mix(corners[0], corners[1], u.x);
+        const float x1 = glm::mix(corners[2], corners[3], u.x);
+        const float x2 = glm::mix(corners[4], corners[5], u.x);
+        const float x3 = glm::mix(corners[6], corners[7], u.x);
+        const float n = glm::mix(glm::mix(x0, x1, u.y), glm::mix(x2, x3, u.y), u.z);
+        return 0.5f + 0.5f * n;
+    }
+};
+
+// The Marschner-Lobb test function (Marschner and Lobb, 1994) with alpha = 0.25 and
+// f_M = 6, mirrored to tile the volume a whole number of times along its largest axis. Each
+// tile holds the full [-1, 1]^3 domain and so a full copy of the isosurface, which makes the
+// active fraction grow with the tile count. Values are in [0, 1] and the classic isosurface
+// is at 0.5
+class MarschnerLobbField {
+    float tile_scale;
+
+    static float mirror(float q)
+    {
+        const float u = q - 2.f * std::floor(q * 0.5f);
+        return u <= 1.f ? 2.f * u - 1.f : 3.f - 2.f * u;
+    }
+
+public:
+    MarschnerLobbField(const glm::uvec3 &dims, uint32_t tiles)
+        : tile_scale(float(std::max(tiles, 1u)) / std::max(dims.x, std::max(dims.y, dims.z)))
+    {
+    }
+
+    float operator()(float x, float y, float z) const
+    {
+        constexpr float alpha = 0.25f;
+        constexpr float f_m = 6.f;
+        const float cx = mirror(x * tile_scale);
+        const float cy = mirror(y * tile_scale);
+        const float cz = mirror(z * tile_scale);
+        const float r = std::sqrt(cx * cx + cy * cy);
+        const float rho_r = std::cos(2.f * PI * f_m * std::cos(PI * r * 0.5f));
+        return (1.f - std::sin(PI * cz * 0.5f) + alpha * (1.f + rho_r)) /
+               (2.f * (1.f + alpha));
+    }
+};
+
+// Randomly placed metaballs with the compact (1 - d^2/R^2)^3 falloff. The balls are binned
+// into a grid of cells the size of the radius, so each voxel only visits the balls which
+// can reach it
+class MetaballField {
+    float radius;
+    float inv_cell_size;
+    glm::uvec3 cells;
+    std::vector<glm::vec3> centers;
+    // The balls overlapping each cell, stored as offsets into cell_balls
+    std::vector<uint32_t> cell_offsets;
+    std::vector<uint32_t> cell_balls;
+
+    template <typename F>
+    void for_each_cell(const glm::vec3 &center, const F &fn) const
+    {
+        const glm::ivec3 max_cell = glm::ivec3(cells) - 1;
+        const glm::ivec3 lo(glm::floor((center - radius) * inv_cell_size));
+        const glm::ivec3 hi(glm::floor((center + radius) * inv_cell_size));
+        const glm::ivec3 first = glm::clamp(lo, glm::ivec3(0), max_cell);
+        const glm::ivec3 last = glm::clamp(hi, glm::ivec3(0), max_cell);
+        for (int z = first.z; z <= last.z; ++z) {
+            for (int y = first.y; y <= last.y; ++y) {
+                for (int x = first.x; x <= last.x; ++x) {
+                    fn(x + cells.x * (y + cells.y * size_t(z)));
+                }
+            }
+        }
+    }
+
+public:
+    MetaballField(const glm::uvec3 &dims, uint64_t seed, size_t count)
+        : radius(std::max(8.f, std::max(dims.x, std::max(dims.y, dims.z)) / 16.f)),
+          inv_cell_size(1.f / radius),
+          cells(glm::max(glm::uvec3(glm::ceil(glm::vec3(dims) / radius)), glm::uvec3(1))),
+          centers(count)
+    {
+        for (size_t i = 0; i < count; ++i) {
+            centers[i] = glm::vec3(hash_to_unit(hash_counter(seed, 3 * i)),
+                                   hash_to_unit(hash_counter(seed, 3 * i + 1)),
+                                   hash_to_unit(hash_counter(seed, 3 * i + 2))) *
+                         glm::vec3(dims);
+        }
+        const size_t num_cells = size_t(cells.x) * cells.y * cells.z;
+        cell_offsets.resize(num_cells + 1, 0);
+        for (const auto &c : centers) {
+            for_each_cell(c, [&](const size_t cell) { ++cell_offsets[cell + 1]; });
+        }
+        for (size_t i = 0; i < num_cells; ++i) {
+            cell_offsets[i + 1] += cell_offsets[i];
+        }
+        cell_balls.resize(cell_offsets.back());
+        std::vector<uint32_t> next(cell_offsets.begin(), cell_offsets.end() - 1);
+        for (size_t i = 0; i < count; ++i) {
+            for_each_cell(centers[i],
+                          [&](const size_t cell) { cell_balls[next[cell]++] = uint32_t(i); });
+        }
+    }
+
+    float operator()(float x, float y, float z) const
+    {
+        const glm::vec3 p(x, y, z);
+        const glm::uvec3 c = glm::min(glm::uvec3(p * inv_cell_size), cells - glm::uvec3(1));
+        const size_t cell = c.x + cells.x * (c.y + cells.y * size_t(c.z));
+        const float inv_radius_sq = inv_cell_size * inv_cell_size;
+        float sum = 0.f;
+        for (uint32_t i = cell_offsets[cell]; i < cell_offsets[cell + 1]; ++i) {
+            const glm::vec3 d = p - centers[cell_balls[i]];
+            const float t = 1.f - glm::dot(d, d) * inv_radius_sq;
+            if (t > 0.f) {
+                sum += t * t * t;
+            }
+        }
+        return sum;
+    }
+};
+
+// Blocks which each hold a small blob centered in the block with the given probability,
+// and are zero otherwise, a random checkerboard of block sized features
+class CheckerboardField {
+    glm::uvec3 block_dims;
+    uint64_t seed;
+    float probability;
+
+public:
+    CheckerboardField(const glm::uvec3 &dims, uint64_t seed, float probability)
+        : block_dims((dims + glm::uvec3(3)) / glm::uvec3(4)),
+          seed(seed),
+          probability(probability)
+    {
+    }
+
+    float operator()(float x, float y, float z) const
+    {
+        const glm::vec3 p(x, y, z);
+        const glm::uvec3 b = glm::uvec3(p) / glm::uvec3(4);
+        const size_t block = b.x + block_dims.x * (b.y + block_dims.y * size_t(b.z));
+        if (hash_to_unit(hash_counter(seed, block)) >= probability) {
+            return 0.f;
+        }
+        const glm::vec3 local = p - glm::vec3(b * glm::uvec3(4));
+        return std::max(0.f, 1.f - glm::length(local - glm::vec3(1.5f)) * 0.5f);
+    }
+};
+
+// A block is active if the range of its voxels and those of its +x/+y/+z neighbor blocks
+// contains the isovalue, matching the block selection of the reference marching cubes
+bool range_active(float lo, float hi)
+{
+    return lo <= SYNTHETIC_ISOVALUE && SYNTHETIC_ISOVALUE < hi;
+}
+
+template <typename Field>
+bool field_block_active(const Field &field, const glm::uvec3 &dims, const glm::uvec3 &block)
+{
+    const glm::uvec3 origin = block * glm::uvec3(4);
+    const glm::uvec3 end = glm::min(origin + glm::uvec3(8), dims);
+    float lo = std::numeric_limits<float>::infinity();
+    float hi = -lo;
+    for (uint32_t z = origin.z; z < end.z; ++z) {
+        for (uint32_t y = origin.y; y < end.y; ++y) {
+            for (uint32_t x = origin.x; x < end.x; ++x) {
+                const float v = field(float(x), float(y), float(z));
+                lo = std::min(lo, v);
+                hi = std::max(hi, v);
+            }
+        }
+        if (range_active(lo, hi)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename Field>
+double sampled_active_fraction(const Field &field,
+                               const glm::uvec3 &dims,
+                               const std::vector<glm::uvec3> &samples)
+{
+    std::atomic<size_t> num_active(0);
+    parallel_for(0, samples.size(), [&](const size_t begin, const size_t end) {
+        size_t count = 0;
+        for (size_t i = begin; i < end; ++i) {
+            count += field_block_active(field, dims, samples[i]) ? 1 : 0;
+        }
+        num_active += count;
+    });
+    return double(num_active) / samples.size();
+}
+
+// Find the exact fraction of active blocks in the generated volume
+double volume_active_fraction(const VolumeBuffer &data, const glm::uvec3 &dims)
+{
+    PROFILE_ZONE("volume_active_fraction");
+    const glm::uvec3 block_dims = (dims + glm::uvec3(3)) / glm::uvec3(4);
+    const size_t num_blocks = size_t(block_dims.x) * block_dims.y * block_dims.z;
+    std::vector<glm::vec2> ranges(num_blocks);
+    parallel_for(0, num_blocks, [&](const size_t begin, const size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const glm::uvec3 b(i % block_dims.x,
+                               (i / block_dims.x) % block_dims.y,
+                               i / (size_t(block_dims.x) * block_dims.y));
+            const glm::uvec3 origin = b * glm::uvec3(4);
+            const glm::uvec3 end = glm::min(origin + glm::uvec3(4), dims);
+            glm::vec2 range(std::numeric_limits<float>::infinity(),
+                            -std::numeric_limits<float>::infinity());
+            for (uint32_t z = origin.z; z < end.z; ++z) {
+                for (uint32_t y = origin.y; y < end.y; ++y) {
+                    for (uint32_t x = origin.x; x < end.x; ++x) {
+                        const float v = data[x + dims.x * (y + dims.y * size_t(z))];
+                        range.x = std::min(range.x, v);
+                        range.y = std::max(range.y, v);
+                    }
+                }
+            }
+            ranges[i] = range;
+        }
+    });
+    std::atomic<size_t> num_active(0);
+    parallel_for(0, num_blocks, [&](const size_t begin, const size_t end) {
+        size_t count = 0;
+        for (size_t i = begin; i < end; ++i) {
+            const glm::uvec3 b(i % block_dims.x,
+                               (i / block_dims.x) % block_dims.y,
+                               i / (size_t(block_dims.x) * block_dims.y));
+            const glm::uvec3 end_block = glm::min(b + glm::uvec3(2), block_dims);
+            glm::vec2 range = ranges[i];
+            for (uint32_t z = b.z; z < end_block.z; ++z) {
+                for (uint32_t y = b.y; y < end_block.y; ++y) {
+                    for (uint32_t x = b.x; x < end_block.x; ++x) {
+                        const glm::vec2 &r =
+                            ranges[x + block_dims.x * (y + block_dims.y * size_t(z))];
+                        range = glm::vec2(std::min(range.x, r.x), std::max(range.y, r.y));
+                    }
+                }
+            }
+            count += range_active(range.x, range.y) ? 1 : 0;
+        }
+        num_active += count;
+    });
+    return double(num_active) / num_blocks;
+}
+
+// Bisect the density parameter of the field made by make_field(t) for t in [lo, hi] on a log
+// scale, so the active fraction of the sampled blocks is closest to the target. The active
+// fraction increases with t, then fill the volume with the field. A parameter giving no active
+// blocks is never picked over one that gives some, since any target asks for some
+template <typename MakeField>
+void generate_calibrated(const MakeField &make_field,
+                         double lo,
+                         double hi,
+                         const glm::uvec3 &dims,
+                         const SyntheticVolumeOptions &options,
+                         const PaddingOptions &padding,
+                         VolumeBuffer &data)
+{
+    PROFILE_ZONE("generate_calibrated");
+    const glm::uvec3 block_dims = (dims + glm::uvec3(3)) / glm::uvec3(4);
+    const size_t num_blocks = size_t(block_dims.x) * block_dims.y * block_dims.z;
+    std::vector<glm::uvec3> samples;
+    if (num_blocks <= CALIBRATION_SAMPLES) {
+        samples.reserve(num_blocks);
+        for (size_t i = 0; i < num_blocks; ++i) {
+            samples.emplace_back(i % block_dims.x,
+                                 (i / block_dims.x) % block_dims.y,
+                                 i / (size_t(block_dims.x) * block_dims.y));
+        }
+    } else {
+        for (size_t i = 0; i < CALIBRATION_SAMPLES; ++i) {
+            const uint64_t h = hash_counter(options.seed ^ SAMPLE_STREAM, i);
+            samples.emplace_back(h % block_dims.x,
+                                 (h >> 21) % block_dims.y,
+                                 (h >> 42) % block_dims.z);
+        }
+    }
+
+    double lo_fraction = sampled_active_fraction(make_field(lo), dims, samples);
+    double hi_fraction = sampled_active_fraction(make_field(hi), dims, samples);
+    for (int i = 0; i < CALIBRATION_ITERATIONS; ++i) {
+        const double mid = std::sqrt(lo * hi);
+        const double fraction = sampled_active_fraction(make_field(mid), dims, samples);
+        if (fraction < options.active_fraction) {
+            lo = mid;
+            lo_fraction = fraction;
+        } else {
+            hi = mid;
+            hi_fraction = fraction;
+        }
+    }
+    const bool use_lo = lo_fraction > 0.0 &&
+                        std::abs(lo_fraction - options.active_fraction) <
+                            std::abs(hi_fraction - options.active_fraction);
+    const double param = use_lo ? lo : hi;
+    std::cout << "Density parameter " << param << " gives "
+              << (use_lo ? lo_fraction : hi_fraction) * 100.0 << "% active of "
+              << samples.size() << " sampled blocks\n";
+    generate_padded_field(make_field(param), dims, padding, data);
+}
+
+}
+
+bool is_synthetic_volume(const std::string &name)
+{
+    return name == "noise" || name == "marschner_lobb" || name == "metaballs" ||
+           name == "checkerboard";
+}
+
+std::string synthetic_volume_name(const std::string &name,
+                                  const SyntheticVolumeOptions &options)
+{
+    std::stringstream ss;
+    ss << name << "_a" << options.active_fraction << "_s" << options.seed;
+    return ss.str();
+}
+
+bool generate_synthetic_volume(const std::string &name,
+                               const glm::uvec3 &dims,
+                               const SyntheticVolumeOptions &options,
+                               VolumeBuffer &data,
+                               const PaddingOptions &padding)
+{
+    PROFILE_ZONE("generate_synthetic_volume");
+    if (options.active_fraction <= 0.0 || options.active_fraction > 1.0) {
+        std::cout << "The active fraction must be in (0, 1]\n";
+        return false;
+    }
+    if (glm::any(glm::equal(dims, glm::uvec3(0)))) {
+        std::cout << "Synthetic volumes need non-zero -dims\n";
+        return false;
+    }
+    std::cout << "Generating " << name << " volume, size: " << glm::to_string(dims)
+              << ", targeting " << options.active_fraction * 100.0 << "% active blocks at "
+              << "isovalue " << SYNTHETIC_ISOVALUE << "\n";
+    const double max_dim = std::max(dims.x, std::max(dims.y, dims.z));
+    if (name == "noise") {
+        generate_calibrated(
+            [&](const double frequency) {
+                return GradientNoiseField(options.seed, frequency);
+            },
+            0.5 / max_dim,
+            1.0,
+            dims,
+            options,
+            padding,
+            data);
+    } else if (name == "marschner_lobb") {
+        generate_calibrated(
+            [&](const double tiles) {
+                return MarschnerLobbField(dims, uint32_t(std::round(tiles)));
+            },
+            1.0,
+            std::max(2.0, max_dim / 4.0),
+            dims,
+            options,
+            padding,
+            data);
+    } else if (name == "metaballs") {
+        const glm::uvec3 block_dims = (dims + glm::uvec3(3)) / glm::uvec3(4);
+        const double num_blocks = double(block_dims.x) * block_dims.y * block_dims.z;
+        generate_calibrated(
+            [&](const double count) {
+                return MetaballField(dims, options.seed, size_t(std::round(count)));
+            },
+            1.0,
+            std::max(2.0, std::min(num_blocks, MAX_METABALLS)),
+            dims,
+            options,
+            padding,
+            data);
+    } else if (name == "checkerboard") {
+        generate_calibrated(
+            [&](const double probability) {
+                return CheckerboardField(dims, options.seed, probability);
+            },
+            1e-6,
+            1.0,
+            dims,
+            options,
+            padding,
+            data);
+    } else {
+        std::cout << "Unrecognized synthetic volume " << name << "\n";
+        return false;
+    }
+    // Padding is part of the compressed volume, so its blocks are counted too
+    const double active_fraction = volume_active_fraction(data, padding.padded_dims(dims));
+    std::cout << "Generated volume has " << active_fraction * 100.0 << "% active blocks\n";
+    if (active_fraction == 0.0) {
+        std::cout << "Error: " << name << " has no active blocks at these dims, the target of "
+                  << options.active_fraction * 100.0 << "% can't be reached\n";
+        return false;
+    }
+    if (std::abs(active_fraction - options.active_fraction) >
+        ACTIVE_FRACTION_TOLERANCE * options.active_fraction) {
+        std::cout << "Warning: " << name << " can't get closer to the target of "
+                  << options.active_fraction * 100.0 << "% active blocks at these dims\n";
+    }
+    return true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <glm/glm.hpp>
+#include "large_buffer.h"
+#include "padding.h"
+
+// The isovalue the synthetic volumes are tuned for
+constexpr float SYNTHETIC_ISOVALUE = 0.5f;
+
+struct SyntheticVolumeOptions {
+    // The fraction of blocks which should be active at SYNTHETIC_ISOVALUE
+    double active_fraction = 0.1;
+    uint64_t seed = 0;
+};
+
+// Check if the name is one of the synthetic load testing volumes: noise, marschner_lobb,
+// metaballs or checkerboard
+bool is_synthetic_volume(const std::string &name);
+
+// Get a name for the volume including its parameters, e.g. noise_a0.1_s0
+std::string synthetic_volume_name(const std::string &name,
+                                  const SyntheticVolumeOptions &options);
+
+// Generate a synthetic volume whose fraction of active blocks at SYNTHETIC_ISOVALUE, as BCMC
+// counts them, is close to the requested fraction. Each field has a density parameter (the
+// noise frequency, the Marschner-Lobb tiling, the number of metaballs or the fraction of
+// blocks holding a feature), which is found by bisecting on the active fraction of a sample
+// of blocks. Random values come from a counter-based hash of the seed and the block, lattice
+// point or ball index, so volumes depend only on the options and dims, not the thread count.
+// The exact active fraction of the generated volume is reported. With padding, the field is
+// generated over the padded dims and data holds the padded volume.
+bool generate_synthetic_volume(const std::string &name,
+                               const glm::uvec3 &dims,
+                               const SyntheticVolumeOptions &options,
+                               VolumeBuffer &data,
+                               const PaddingOptions &padding = PaddingOptions());
@@ -0,0 +1,144 @@
+#include "time_series.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <zfp.h>
+#include <glm/gtx/string_cast.hpp>
+#include "bcmc_file.h"
+#include "compress.h"
+#include "large_buffer.h"
+#include "profiler.h"
+
+namespace {
+
+constexpr size_t TIMESTEPS_PER_GROUP = 4;
+
+}
+
+bool compress_time_series(const std::vector<std::string> &raw_files,
+                          int compression_rate,
+                          const NormalizeOptions &normalize,
+                          std::string &out_name)
+{
+    using namespace std::chrono;
+    if (raw_files.empty()) {
+        std::cout << "Time series mode requires at least one raw volume\n";
+        return false;
+    }
+    if (normalize.mode == NormalizeOptions::AUTO) {
+        // Normalizing each timestep to its own range would break the coherence between them
+        std::cout << "-normalize auto is not supported for time series, pass a value range\n";
+        return false;
+    }
+
+    std::vector<RawVolumeInfo> infos(raw_files.size());
+    for (size_t i = 0; i < raw_files.size(); ++i) {
+        if (!read_volume_info(raw_files[i], infos[i])) {
+            return false;
+        }
+        if (infos[i].dims != infos[0].dims) {
+            std::cout << "Time series volumes must have the same dimensions, but "
+                      << raw_files[i] << " is " << glm::to_string(infos[i].dims)
+                      << " while the first timestep is " << glm::to_string(infos[0].dims)
+                      << "\n";
+            return false;
+        }
+    }
+    const glm::uvec3 dims = infos[0].dims;
+    const size_t num_voxels = size_t(dims.x) * size_t(dims.y) * size_t(dims.z);
+    const size_t num_timesteps = raw_files.size();
+    const size_t num_groups = (num_timesteps + TIMESTEPS_PER_GROUP - 1) / TIMESTEPS_PER_GROUP;
+    std::cout << "Compressing time series of " << num_timesteps << " timesteps, size: "
+              << glm::to_string(dims) << ", in " << num_groups << " 4D groups\n";
+
+    const int used_compression_rate = fixed_compression_rate(compression_rate, 4);
+    if (used_compression_rate < 0) {
+        return false;
+    }
+    std::cout << "Used compression rate: " << used_compression_rate << "\n";
+    zfp_stream *zfp = zfp_stream_open(nullptr);
+    zfp_stream_set_rate(zfp, used_compression_rate, zfp_type_float, 4, 0);
+
+    out_name = volume_output_name(raw_files[0], infos[0]) + ".t" +
+               std::to_string(num_timesteps) + ".crate" +
+               std::to_string(used_compression_rate) + ".bcmc";
+    BCMCFileWriter writer;
+    const uint32_t file_dims[3] = {dims.x, dims.y, dims.z};
+    if (!writer.open(out_name, file_dims, num_groups, num_timesteps)) {
+        zfp_stream_close(zfp);
+        return false;
+    }
+
+    // The group buffer holds the 4 timesteps with w as the slowest varying dimension
+    LargeVector<float> group_data;
+    group_data.resize(num_voxels * TIMESTEPS_PER_GROUP);
+    LargeVector<uint8_t> compressed_data;
+    {
+        zfp_field *field = zfp_field_4d(group_data.data(),
+                                        zfp_type_float,
+                                        dims.x,
+                                        dims.y,
+                                        dims.z,
+                                        TIMESTEPS_PER_GROUP);
+        compressed_data.resize(zfp_stream_maximum_size(zfp, field));
+        zfp_field_free(field);
+    }
+
+    size_t total_bytes = 0;
+    bool success = true;
+    for (size_t g = 0; g < num_groups && success; ++g) {
+        const size_t first_timestep = g * TIMESTEPS_PER_GROUP;
+        const size_t group_timesteps =
+            std::min(TIMESTEPS_PER_GROUP, num_timesteps - first_timestep);
+
+        auto start = steady_clock::now();
+        for (size_t w = 0; w < group_timesteps && success; ++w) {
+            success = load_raw_volume(raw_files[first_timestep + w],
+                                      infos[first_timestep + w],
+                                      group_data.data() + w * num_voxels,
+                                      normalize);
+        }
+        if (!success) {
+            std::cout << "Failed to read timestep " << raw_files[first_timestep] << "\n";
+            break;
+        }
+        auto loaded = steady_clock::now();
+
+        size_t group_bytes = 0;
+        {
+            PROFILE_ZONE("compress timestep group");
+            zfp_field *field = zfp_field_4d(
+                group_data.data(), zfp_type_float, dims.x, dims.y, dims.z, group_timesteps);
+            bitstream *stream = stream_open(compressed_data.data(), compressed_data.size());
+            zfp_stream_set_bit_stream(zfp, stream);
+            zfp_stream_rewind(zfp);
+            group_bytes = zfp_compress(zfp, field);
+            zfp_field_free(field);
+            stream_close(stream);
+        }
+        auto compressed = steady_clock::now();
+
+        BCMCStreamEntry entry;
+        entry.rate = used_compression_rate;
+        entry.zfp_dims = 4;
+        entry.first_timestep = first_timestep;
+        entry.num_timesteps = group_timesteps;
+        success = group_bytes != 0 &&
+                  writer.add_stream(entry, compressed_data.data(), group_bytes);
+        total_bytes += group_bytes;
+
+        std::cout << "Group " << g << " (timesteps " << first_timestep << "-"
+                  << first_timestep + group_timesteps - 1 << "): " << group_bytes
+                  << "B, loaded in " << duration_cast<milliseconds>(loaded - start).count()
+                  << "ms, compressed in "
+                  << duration_cast<milliseconds>(compressed - loaded).count() << "ms\n";
+    }
+    zfp_stream_close(zfp);
+
+    if (!success || !writer.finish()) {
+        std::cout << "Failed to write time series " << out_name << "\n";
+        return false;
+    }
+    std::cout << "Total compressed size: " << total_bytes << "B\n";
+    return true;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "raw_volume.h"
+
+// Compress a series of same size raw volumes, one per timestep, as 4D ZFP fields. Timesteps
+// are loaded and compressed in groups of 4 so each group fills the w dimension of ZFP's 4^4
+// blocks. Each group is written as its own fixed rate stream to a BCMC file, along with an
+// index mapping each timestep to its stream so players can seek to a frame.
+bool compress_time_series(const std::vector<std::string> &raw_files,
+                          int compression_rate,
+                          const NormalizeOptions &normalize,
+                          std::string &out_name);
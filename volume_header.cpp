@@ -0,0 +1,613 @@
+#include "volume_header.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <type_traits>
+#include <vector>
+#include <glm/gtx/string_cast.hpp>
+
+namespace {
+
+// Headers are text, stop looking for the end of one after this many bytes so a binary file
+// with a header extension isn't read as lines
+constexpr size_t MAX_HEADER_BYTES = size_t(1) << 20;
+
+struct TypeName {
+    const char *name;
+    DType dtype;
+};
+
+const TypeName NRRD_TYPES[] = {
+    {"uchar", DType::UINT8},
+    {"unsigned char", DType::UINT8},
+    {"uint8", DType::UINT8},
+    {"uint8_t", DType::UINT8},
+    {"signed char", DType::INT8},
+    {"int8", DType::INT8},
+    {"int8_t", DType::INT8},
+    {"short", DType::INT16},
+    {"short int", DType::INT16},
+    {"signed short", DType::INT16},
+    {"signed short int", DType::INT16},
+    {"int16", DType::INT16},
+    {"int16_t", DType::INT16},
+    {"ushort", DType::UINT16},
+    {"unsigned short", DType::UINT16},
+    {"unsigned short int", DType::UINT16},
+    {"uint16", DType::UINT16},
+    {"uint16_t", DType::UINT16},
+    {"int", DType::INT32},
+    {"signed int", DType::INT32},
+    {"int32", DType::INT32},
+    {"int32_t", DType::INT32},
+    {"uint", DType::UINT32},
+    {"unsigned int", DType::UINT32},
+    {"uint32", DType::UINT32},
+    {"uint32_t", DType::UINT32},
+    {"float", DType::FLOAT32},
+    {"double", DType::FLOAT64},
+};
+
+const TypeName METAIMAGE_TYPES[] = {
+    {"MET_UCHAR", DType::UINT8},
+    {"MET_CHAR", DType::INT8},
+    {"MET_USHORT", DType::UINT16},
+    {"MET_SHORT", DType::INT16},
+    {"MET_UINT", DType::UINT32},
+    {"MET_INT", DType::INT32},
+    {"MET_FLOAT", DType::FLOAT32},
+    {"MET_DOUBLE", DType::FLOAT64},
+};
+
+const TypeName VTK_TYPES[] = {
+    {"unsigned_char", DType::UINT8},
+    {"char", DType::INT8},
+    {"unsigned_short", DType::UINT16},
+    {"short", DType::INT16},
+    {"unsigned_int", DType::UINT32},
+    {"int", DType::INT32},
+    {"float", DType::FLOAT32},
+    {"double", DType::FLOAT64},
+};
+
+template <size_t N>
+bool find_type(const TypeName (&types)[N], const std::string &name, DType &dtype)
+{
+    for (const auto &t : types) {
+        if (name == t.name) {
+            dtype = t.dtype;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string trim(const std::string &str)
+{
+    const size_t begin = str.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos) {
+        return "";
+    }
+    const size_t end = str.find_last_not_of(" \t\r\n");
+    return str.substr(begin, end - begin + 1);
+}
+
+std::string to_lower(std::string str)
+{
+    std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c) {
+        return std::tolower(c);
+    });
+    return str;
+}
+
+std::string to_upper(std::string str)
+{
+    std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c) {
+        return std::toupper(c);
+    });
+    return str;
+}
+
+std::string file_extension(const std::string &file_name)
+{
+    const size_t slash = file_name.find_last_of("/\\");
+    const size_t dot = file_name.find_last_of('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return "";
+    }
+    return to_lower(file_name.substr(dot));
+}
+
+// Get the file name without its directory or extension
+std::string file_stem(const std::string &file_name)
+{
+    const size_t slash = file_name.find_last_of("/\\");
+    std::string stem = slash == std::string::npos ? file_name : file_name.substr(slash + 1);
+    const size_t dot = stem.find_last_of('.');
+    return dot == std::string::npos ? stem : stem.substr(0, dot);
+}
+
+// Data files named in a header are relative to the header's directory
+std::string resolve_data_file(const std::string &header_file, const std::string &data_file)
+{
+    if (!data_file.empty() && data_file[0] == '/') {
+        return data_file;
+    }
+    const size_t slash = header_file.find_last_of("/\\");
+    if (slash == std::string::npos) {
+        return data_file;
+    }
+    return header_file.substr(0, slash + 1) + data_file;
+}
+
+bool get_file_size(const std::string &file_name, size_t &size)
+{
+    std::ifstream file(file_name.c_str(), std::ios::binary | std::ios::ate);
+    if (!file) {
+        std::cerr << "Failed to open " << file_name << "\n";
+        return false;
+    }
+    size = size_t(file.tellg());
+    return true;
+}
+
+// Read the next header line, stripping any \r of Windows line endings. offset is set to the
+// byte just past the line's newline
+bool read_header_line(std::ifstream &file, std::string &line, size_t &offset)
+{
+    if (!std::getline(file, line)) {
+        return false;
+    }
+    if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+    }
+    offset = size_t(file.tellg());
+    return offset <= MAX_HEADER_BYTES;
+}
+
+// Parse n whitespace separated values
+template <typename T>
+bool parse_values(const std::string &str, size_t n, std::vector<T> &values)
+{
+    std::istringstream ss(str);
+    values.clear();
+    T v;
+    while (ss >> v) {
+        values.push_back(v);
+    }
+    return values.size() == n;
+}
+
+// Parse an integer header field, printing an error if the value isn't one that fits in T
+template <typename T>
+bool parse_header_int(const std::string &field, const std::string &value, T &result)
+{
+    errno = 0;
+    char *end = nullptr;
+    const long long v = std::strtoll(value.c_str(), &end, 10);
+    const bool fits = !(std::is_unsigned<T>::value && v < 0) &&
+                      static_cast<long long>(static_cast<T>(v)) == v;
+    if (value.empty() || *end != '\0' || errno == ERANGE || !fits) {
+        std::cerr << "Invalid header field " << field << " '" << value << "'\n";
+        return false;
+    }
+    result = static_cast<T>(v);
+    return true;
+}
+
+// Get the payload size in bytes of the volume described by info
+size_t payload_bytes(const RawVolumeInfo &info)
+{
+    return size_t(info.dims.x) * size_t(info.dims.y) * size_t(info.dims.z) *
+           info.num_components * dtype_size(info.voxel_type.dtype);
+}
+
+// Place the payload skip bytes into the data file past base_offset or, when skip is negative,
+// at the end of the data file. Skips only apply to uncompressed payloads
+bool set_payload_offset(int64_t skip, size_t base_offset, RawVolumeInfo &info)
+{
+    if (skip != 0 && info.compression != InputCompression::NONE) {
+        std::cerr << "Skipping bytes of compressed volume data is not supported\n";
+        return false;
+    }
+    if (skip >= 0) {
+        info.data_offset = base_offset + size_t(skip);
+        return true;
+    }
+    size_t size = 0;
+    if (!get_file_size(info.data_file, size)) {
+        return false;
+    }
+    if (size < base_offset + payload_bytes(info)) {
+        std::cerr << "Volume data file " << info.data_file << " is too small\n";
+        return false;
+    }
+    info.data_offset = size - payload_bytes(info);
+    return true;
+}
+
+// Set the compression of a payload given by a header, or detect it from the data file name
+void set_payload_compression(bool compressed, RawVolumeInfo &info)
+{
+    info.compression = compressed ? InputCompression::GZIP : InputCompression::NONE;
+    if (info.compression == InputCompression::NONE) {
+        info.compression = detect_input_compression(info.data_file);
+    }
+}
+
+// NRRD: a NRRD000X magic line and "field: value" lines up to a blank line, after which
+// attached data follows. See http://teem.sourceforge.net/nrrd/format.html
+bool parse_nrrd_header(const std::string &file_name, RawVolumeInfo &info)
+{
+    std::ifstream file(file_name.c_str(), std::ios::binary);
+    if (!file) {
+        std::cerr << "Failed to open " << file_name << "\n";
+        return false;
+    }
+    std::string line;
+    size_t offset = 0;
+    if (!read_header_line(file, line, offset) || line.compare(0, 7, "NRRD000") != 0) {
+        std::cerr << file_name << " is not an NRRD file\n";
+        return false;
+    }
+
+    int dimension = 0;
+    std::vector<uint32_t> sizes;
+    std::string type_name;
+    std::string encoding = "raw";
+    std::string data_file;
+    std::string spacings;
+    std::string space_directions;
+    bool big_endian = false;
+    int64_t byte_skip = 0;
+    size_t line_skip = 0;
+    bool header_ended = false;
+    while (read_header_line(file, line, offset)) {
+        if (line.empty()) {
+            header_ended = true;
+            break;
+        }
+        if (line[0] == '#' || line.find(":=") != std::string::npos) {
+            // Comments and key/value pairs
+            continue;
+        }
+        const size_t colon = line.find(": ");
+        if (colon == std::string::npos) {
+            std::cerr << "Invalid NRRD header line '" << line << "'\n";
+            return false;
+        }
+        const std::string field = line.substr(0, colon);
+        const std::string value = trim(line.substr(colon + 2));
+        if (field == "dimension") {
+            if (!parse_header_int(field, value, dimension)) {
+                return false;
+            }
+        } else if (field == "sizes") {
+            parse_values(value, dimension, sizes);
+        } else if (field == "type") {
+            type_name = value;
+        } else if (field == "endian") {
+            big_endian = value == "big";
+        } else if (field == "encoding") {
+            encoding = value;
+        } else if (field == "data file" || field == "datafile") {
+            data_file = value;
+        } else if (field == "spacings") {
+            spacings = value;
+        } else if (field == "space directions") {
+            space_directions = value;
+        } else if (field == "byte skip" || field == "byteskip") {
+            if (!parse_header_int(field, value, byte_skip)) {
+                return false;
+            }
+        } else if (field == "line skip" || field == "lineskip") {
+            if (!parse_header_int(field, value, line_skip)) {
+                return false;
+            }
+        }
+    }
+
+    // 4D volumes are taken to have the voxel components along the first axis
+    if ((dimension != 3 && dimension != 4) || sizes.size() != size_t(dimension)) {
+        std::cerr << "Only 3D NRRD volumes, or 4D volumes with components along the first "
+                  << "axis, are supported\n";
+        return false;
+    }
+    const size_t first_axis = dimension - 3;
+    info.num_components = dimension == 4 ? sizes[0] : 1;
+    info.dims = glm::uvec3(sizes[first_axis], sizes[first_axis + 1], sizes[first_axis + 2]);
+    if (!find_type(NRRD_TYPES, type_name, info.voxel_type.dtype)) {
+        std::cerr << "Unsupported NRRD type '" << type_name << "'\n";
+        return false;
+    }
+    info.voxel_type.big_endian = big_endian;
+    if (encoding != "raw" && encoding != "gzip" && encoding != "gz") {
+        std::cerr << "Unsupported NRRD encoding '" << encoding
+                  << "', only raw and gzip are supported\n";
+        return false;
+    }
+
+    // Spacing is given per axis, or as the length of the space direction of each axis
+    if (!spacings.empty()) {
+        std::istringstream ss(spacings);
+        std::vector<std::string> values;
+        std::string v;
+        while (ss >> v) {
+            values.push_back(v);
+        }
+        for (size_t i = 0; i < 3 && first_axis + i < values.size(); ++i) {
+            const float s = std::strtof(values[first_axis + i].c_str(), nullptr);
+            info.spacing[i] = std::isfinite(s) && s > 0.f ? s : 1.f;
+        }
+    } else if (!space_directions.empty()) {
+        std::vector<glm::vec3> directions;
+        size_t pos = 0;
+        while ((pos = space_directions.find('(', pos)) != std::string::npos) {
+            glm::vec3 d(0.f);
+            std::sscanf(space_directions.c_str() + pos, "(%f,%f,%f)", &d.x, &d.y, &d.z);
+            directions.push_back(d);
+            ++pos;
+        }
+        for (size_t i = 0; i < 3 && i < directions.size(); ++i) {
+            const float s = glm::length(directions[i]);
+            info.spacing[i] = s > 0.f ? s : 1.f;
+        }
+    }
+
+    size_t base_offset = 0;
+    if (data_file.empty()) {
+        if (!header_ended) {
+            std::cerr << "NRRD file " << file_name << " has no data\n";
+            return false;
+        }
+        info.data_file = file_name;
+        base_offset = offset;
+    } else {
+        if (data_file == "LIST" || data_file.find(' ') != std::string::npos) {
+            std::cerr << "NRRD volumes split over multiple data files are not supported\n";
+            return false;
+        }
+        info.data_file = resolve_data_file(file_name, data_file);
+    }
+    set_payload_compression(encoding != "raw", info);
+
+    if (line_skip != 0) {
+        if (info.compression != InputCompression::NONE) {
+            std::cerr << "Skipping lines of compressed volume data is not supported\n";
+            return false;
+        }
+        std::ifstream data(info.data_file.c_str(), std::ios::binary);
+        data.seekg(base_offset);
+        for (size_t i = 0; i < line_skip; ++i) {
+            if (!std::getline(data, line)) {
+                std::cerr << "NRRD data file " << info.data_file << " is too short\n";
+                return false;
+            }
+        }
+        base_offset = size_t(data.tellg());
+    }
+    return set_payload_offset(byte_skip, base_offset, info);
+}
+
+// MetaImage: "Key = Value" lines ending with ElementDataFile, which is LOCAL when the data
+// follows the header in the same file. See https://itk.org/Wiki/ITK/MetaIO/Documentation
+bool parse_metaimage_header(const std::string &file_name, RawVolumeInfo &info)
+{
+    std::ifstream file(file_name.c_str(), std::ios::binary);
+    if (!file) {
+        std::cerr << "Failed to open " << file_name << "\n";
+        return false;
+    }
+    int ndims = 0;
+    std::vector<uint32_t> dim_size;
+    std::vector<float> spacing;
+    std::string type_name;
+    std::string data_file;
+    bool compressed = false;
+    int64_t header_size = 0;
+    std::string line;
+    size_t offset = 0;
+    while (read_header_line(file, line, offset)) {
+        const size_t equals = line.find('=');
+        if (equals == std::string::npos) {
+            continue;
+        }
+        const std::string key = trim(line.substr(0, equals));
+        const std::string value = trim(line.substr(equals + 1));
+        if (key == "NDims") {
+            if (!parse_header_int(key, value, ndims)) {
+                return false;
+            }
+        } else if (key == "DimSize") {
+            parse_values(value, 3, dim_size);
+        } else if (key == "ElementType") {
+            type_name = value;
+        } else if (key == "ElementNumberOfChannels") {
+            if (!parse_header_int(key, value, info.num_components)) {
+                return false;
+            }
+        } else if (key == "ElementSpacing" || (key == "ElementSize" && spacing.empty())) {
+            parse_values(value, 3, spacing);
+        } else if (key == "BinaryDataByteOrderMSB" || key == "ElementByteOrderMSB" ||
+                   key == "ByteOrderMSB") {
+            info.voxel_type.big_endian = to_lower(value) == "true";
+        } else if (key == "CompressedData") {
+            compressed = to_lower(value) == "true";
+        } else if (key == "HeaderSize") {
+            if (!parse_header_int(key, value, header_size)) {
+                return false;
+            }
+        } else if (key == "ElementDataFile") {
+            // The data file is always the last field
+            data_file = value;
+            break;
+        }
+    }
+
+    if (ndims != 3 || dim_size.size() != 3) {
+        std::cerr << "Only 3D MetaImage volumes are supported\n";
+        return false;
+    }
+    info.dims = glm::uvec3(dim_size[0], dim_size[1], dim_size[2]);
+    if (!find_type(METAIMAGE_TYPES, type_name, info.voxel_type.dtype)) {
+        std::cerr << "Unsupported MetaImage element type '" << type_name << "'\n";
+        return false;
+    }
+    if (info.num_components == 0) {
+        std::cerr << "MetaImage volume must have at least one channel\n";
+        return false;
+    }
+    if (spacing.size() == 3) {
+        info.spacing = glm::vec3(spacing[0], spacing[1], spacing[2]);
+    }
+
+    size_t base_offset = 0;
+    if (data_file.empty()) {
+        std::cerr << "MetaImage header " << file_name << " has no ElementDataFile\n";
+        return false;
+    } else if (data_file == "LOCAL") {
+        info.data_file = file_name;
+        base_offset = offset;
+    } else if (data_file.compare(0, 4, "LIST") == 0 ||
+               data_file.find('%') != std::string::npos) {
+        std::cerr << "MetaImage volumes split over multiple data files are not supported\n";
+        return false;
+    } else {
+        info.data_file = resolve_data_file(file_name, data_file);
+    }
+    // Compressed MetaImage data is a zlib stream, which the gzip decoder also reads
+    set_payload_compression(compressed, info);
+    return set_payload_offset(header_size, base_offset, info);
+}
+
+// Legacy VTK: a version line, a title, the BINARY keyword and a STRUCTURED_POINTS dataset with
+// point SCALARS, whose data follows the LOOKUP_TABLE line in big endian order. See
+// https://vtk.org/wp-content/uploads/2015/04/file-formats.pdf
+bool parse_vtk_header(const std::string &file_name, RawVolumeInfo &info)
+{
+    std::ifstream file(file_name.c_str(), std::ios::binary);
+    if (!file) {
+        std::cerr << "Failed to open " << file_name << "\n";
+        return false;
+    }
+    std::string line;
+    size_t offset = 0;
+    if (!read_header_line(file, line, offset) ||
+        line.find("vtk DataFile") == std::string::npos) {
+        std::cerr << file_name << " is not a legacy VTK file\n";
+        return false;
+    }
+    // Title
+    read_header_line(file, line, offset);
+    if (!read_header_line(file, line, offset) || to_upper(trim(line)) != "BINARY") {
+        std::cerr << "Only binary VTK files are supported\n";
+        return false;
+    }
+
+    bool structured_points = false;
+    bool found_dims = false;
+    bool found_scalars = false;
+    while (read_header_line(file, line, offset)) {
+        std::istringstream ss(line);
+        std::string keyword;
+        if (!(ss >> keyword)) {
+            continue;
+        }
+        keyword = to_upper(keyword);
+        if (keyword == "DATASET") {
+            std::string type;
+            ss >> type;
+            structured_points = to_upper(type) == "STRUCTURED_POINTS";
+        } else if (keyword == "DIMENSIONS") {
+            found_dims = bool(ss >> info.dims.x >> info.dims.y >> info.dims.z);
+        } else if (keyword == "SPACING" || keyword == "ASPECT_RATIO") {
+            ss >> info.spacing.x >> info.spacing.y >> info.spacing.z;
+        } else if (keyword == "CELL_DATA") {
+            std::cerr << "Only point data of VTK volumes is supported\n";
+            return false;
+        } else if (keyword == "SCALARS" || keyword == "VECTORS") {
+            std::string name;
+            std::string type_name;
+            ss >> name >> type_name;
+            if (!find_type(VTK_TYPES, type_name, info.voxel_type.dtype)) {
+                std::cerr << "Unsupported VTK data type '" << type_name << "'\n";
+                return false;
+            }
+            info.num_components = 1;
+            if (keyword == "VECTORS") {
+                info.num_components = 3;
+                found_scalars = true;
+                break;
+            }
+            uint32_t num_components = 0;
+            if (ss >> num_components) {
+                info.num_components = num_components;
+            }
+        } else if (keyword == "LOOKUP_TABLE") {
+            found_scalars = true;
+            break;
+        }
+    }
+    if (!structured_points || !found_dims || !found_scalars) {
+        std::cerr << "Only VTK STRUCTURED_POINTS volumes with point SCALARS are supported\n";
+        return false;
+    }
+    info.voxel_type.big_endian = true;
+    info.data_file = file_name;
+    info.compression = InputCompression::NONE;
+    info.data_offset = offset;
+    return true;
+}
+
+}
+
+bool is_volume_header_file(const std::string &file_name)
+{
+    const std::string ext = file_extension(file_name);
+    return ext == ".nrrd" || ext == ".nhdr" || ext == ".mha" || ext == ".mhd" || ext == ".vtk";
+}
+
+bool parse_volume_header(const std::string &file_name, RawVolumeInfo &info)
+{
+    info = RawVolumeInfo();
+    info.name = file_stem(file_name);
+    const std::string ext = file_extension(file_name);
+    bool success = false;
+    if (ext == ".nrrd" || ext == ".nhdr") {
+        success = parse_nrrd_header(file_name, info);
+    } else if (ext == ".mha" || ext == ".mhd") {
+        success = parse_metaimage_header(file_name, info);
+    } else if (ext == ".vtk") {
+        success = parse_vtk_header(file_name, info);
+    }
+    if (!success) {
+        std::cerr << "Failed to read volume header " << file_name << std::endl;
+        return false;
+    }
+    if (glm::any(glm::equal(info.dims, glm::uvec3(0))) || info.num_components == 0) {
+        std::cerr << "Volume " << file_name << " is empty\n";
+        return false;
+    }
+    return true;
+}
+
+void print_volume_header(const std::string &file_name, const RawVolumeInfo &info)
+{
+    std::cout << file_name << ": " << glm::to_string(info.dims) << " "
+              << voxel_type_name(info.voxel_type);
+    if (info.num_components > 1) {
+        std::cout << "x" << info.num_components;
+    }
+    std::cout << " volume, spacing " << glm::to_string(info.spacing) << ", data in "
+              << info.data_file << " at offset " << info.data_offset;
+    if (info.compression != InputCompression::NONE) {
+        std::cout << " (" << input_compression_name(info.compression) << " compressed)";
+    }
+    std::cout << "\n";
+}
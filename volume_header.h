@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string>
+#include "raw_volume.h"
+
+// Check if the file is a volume in one of the supported header formats, by its extension:
+// NRRD (.nrrd, .nhdr), MetaImage (.mha, .mhd) or legacy VTK structured points (.vtk)
+bool is_volume_header_file(const std::string &file_name);
+
+// Parse the header of an NRRD, MetaImage or VTK volume into info: its dims, voxel type,
+// endianness, component count and spacing, and where its voxels are. The voxels may follow
+// the header in the same file (.nrrd, .mha, .vtk) or be in a data file named by the header
+// (.nhdr, .mhd), stored raw or gzip compressed. The payload is then read by the same mapped
+// or streaming paths as raw volumes, at its offset in the data file.
+bool parse_volume_header(const std::string &file_name, RawVolumeInfo &info);
+
+// Print the volume info read from a header
+void print_volume_header(const std::string &file_name, const RawVolumeInfo &info);
@@ -1,12 +1,35 @@
+#include <algorithm>
 #include <chrono>
 #include <cmath>
 #include <fstream>
 #include <iostream>
-#include <regex>
 #include <string>
 #include <zfp.h>
 #include <glm/glm.hpp>
 #include <glm/gtx/string_cast.hpp>
+#include "adaptive_rate.h"
+#include "checkpoint.h"
+#include "compress.h"
+#include "decode_benchmark.h"
+#include "generate_volume.h"
+#include "hdf5_input.h"
+#include "http_server.h"
+#include "input_reader.h"
+#include "large_buffer.h"
+#include "mapped_file.h"
+#include "memory_plan.h"
+#include "multi_component.h"
+#include "padding.h"
+#include "parallel.h"
+#include "profiler.h"
+#include "rate_search.h"
+#include "raw_volume.h"
+#include "reference_marching_cubes.h"
+#include "resample.h"
+#include "shard.h"
+#include "synthetic_volumes.h"
+#include "time_series.h"
+#include "volume_header.h"
 
 const std::string USAGE = R"(Usage:
 To compress a raw volume:
@@ -15,6 +38,22 @@ To compress a raw volume:
 To generate a data set and compress it:
 ./zfp_make_test_data -gen (plane_x|quarter_sphere|sphere|wavelet) -dims (x y z) -crate (compression_rate)
 
+To generate a load testing volume with a given fraction of active blocks at isovalue 0.5:
+./zfp_make_test_data -gen (noise|marschner_lobb|metaballs|checkerboard) -dims (x y z) -active-fraction (f) -crate (compression_rate)
+
+To compress a time series of raw volumes as 4D blocks:
+./zfp_make_test_data -series (volume_t0.raw volume_t1.raw ...) -crate (compression_rate)
+
+To benchmark decoding blocks of compressed volumes:
+./zfp_make_test_data -bench-decode (volume.crate8.zfp volume.crate16.zfp ...)
+
+To serve compressed volumes to viewers over HTTP:
+./zfp_make_test_data -serve (output_dir|volume.crate8.zfp|volume.bcmc ...) -port (port)
+
+To compress a volume across several processes and merge the results:
+./zfp_make_test_data -raw (volume_XxYxZx_dtype.raw) -crate (compression_rate) -shard (i/N)
+./zfp_make_test_data -merge (volume.crate8.zfp.shard0of4 volume.crate8.zfp.shard1of4 ...)
+
 Shared Options:
 
     -crate (compression_rate)         Specify the compression rate to use for the volume. Must be an
@@ -22,6 +61,98 @@ Shared Options:
                                       in the output stream. 1 = one bit per value, 32 = 32 bits per value.
                                       All data sets are expanded to floats, so 32 means no compression. 
 
+    -threads (n)                      Specify the number of worker threads to use. Defaults to the
+                                      number of hardware threads.
+
+    -io (mmap|uring|pread)            How uncompressed inputs are read. mmap (the default) converts
+                                      straight from the mapped file. uring keeps -io-depth aligned
+                                      block reads in flight with io_uring and converts blocks on
+                                      the worker threads as they complete, falling back to pread
+                                      if io_uring is unavailable. pread reads blocks from a pool
+                                      of worker threads.
+
+    -direct-io                        Read uncompressed inputs and write the .zfp stream with
+                                      O_DIRECT, bypassing the page cache so large conversions
+                                      don't evict the working sets of other jobs on the node.
+                                      Inputs are read with -io uring unless pread is given. On
+                                      file systems without O_DIRECT the pages are written back
+                                      and dropped from the cache instead.
+
+    -io-depth (n)                     Number of io_uring reads and block buffers in flight.
+                                      Defaults to 32.
+
+    -io-block-mb (n)                  Size in MB of the blocks read by -io uring and pread.
+                                      Defaults to 4.
+
+    -trace (file.json)                Specify where to write the Chrome trace of the run when built
+                                      with BCMC_PROFILE. Defaults to zfp_make_test_data.trace.json.
+
+    -bcmc-ref (isovalue)              After compressing a single volume, run a CPU reference of
+                                      BCMC's marching cubes over the decoded blocks of the output
+                                      and report the active blocks, triangle count and time per
+                                      stage.
+
+    -mesh (file.stl)                  With -bcmc-ref, write the isosurface as a binary STL mesh.
+
+    -adaptive-rates (r0,r1,...)       Compress a single volume with a rate picked per region of
+                                      blocks from the list, e.g. 2,4,8,16, instead of -crate. Each
+                                      region gets the lowest rate keeping its error within
+                                      -adaptive-tolerance. The blocks of each rate are written as
+                                      their own stream to a .bcmc file, with a table of the stream
+                                      and first block of each region.
+
+    -adaptive-tolerance (t)           The largest error allowed in a region, relative to the value
+                                      range of the volume. Defaults to 0.01.
+
+    -region-blocks (n)                Size of the adaptive rate regions in ZFP blocks along each
+                                      axis. Defaults to 4, i.e. 16^3 voxel regions.
+
+    -target-psnr (dB)                 Instead of -crate, compress a single volume at the lowest rate
+    -target-maxerr (error)            whose PSNR or largest absolute error, estimated by compressing
+                                      a sample of the blocks at each rate, meets the target.
+
+    -target-bytes (n)                 Instead of -crate, compress a single volume at the highest rate
+                                      whose output fits in n bytes.
+
+    -target-sample (f)                Fraction of blocks sampled to estimate the error of a rate.
+                                      Defaults to 0.01, with at least 4096 blocks sampled.
+
+    -resume                           Continue compressing a single volume from the checkpoint
+                                      left by an earlier run that was killed. The stream is written
+                                      in slabs of block layers, with a <output>.zfp.ckpt journal of
+                                      the completed slabs and a hash of the input, so at most one
+                                      slab is compressed again.
+
+    -checkpoint-mb (n)                Approximate size in MB of the input compressed between
+                                      checkpoints. Defaults to 256.
+
+    -mmap-output                      Preallocate the .zfp stream at its exact fixed rate size,
+                                      map it and compress each slab straight into the mapping,
+                                      instead of into a buffer that's then written out. Can't be
+                                      combined with -direct-io.
+
+    -max-mem (size)                   Plan how to load and compress a single volume within a
+                                      memory budget, e.g. 16G or 512M. The peak memory of loading
+                                      the full volume, streaming it from the input in slabs, or
+                                      loading it for -adaptive-rates and rate targets is estimated
+                                      from the dims, type and rate, and the fastest plan that fits
+                                      is used and logged, shrinking slabs, read blocks and threads
+                                      as needed. Fails before loading anything if none fit.
+
+    -shard (i/N)                      Compress only shard i of N of a single volume, a contiguous
+                                      range of layers of blocks along z, to <output>.shard<i>of<N>.
+                                      Raw volumes only load the slices of the shard.
+
+    -pad (n)                          Pad a single volume's dims up to a multiple of n, which must
+                                      be a multiple of 4: 4 for whole ZFP blocks or a larger brick
+                                      size. The padding is written while the volume is converted or
+                                      generated. The output is named with the padded dims and
+                                      .logical<X>x<Y>x<Z> for the original dims, which adaptive
+                                      rate .bcmc files also record in their header.
+
+    -pad-fill (edge|value)            Fill the padding by replicating the edge voxels, or with a
+                                      value. Defaults to edge.
+
     -h                                Show this help.
 
 In raw volume compress mode:
@@ -29,27 +160,109 @@ In raw volume compress mode:
     -raw (volume_XxYxZx_dtype.raw)    Specify the raw volume to load and compress. Volumes must be
                                       named following the convention used on OpenSciVisData sets:
                                       <volume_name>_<X>x<Y>x<Z>_<data type>.raw.
+                                      Supported data types are uint8, int8, uint16, int16, uint32,
+                                      int32, float32 and float64. Append 'be' for big endian data,
+                                      e.g. volume_256x256x256_int16be.raw.
+                                      gzip (.raw.gz) and zstd (.raw.zst) compressed volumes are
+                                      decompressed while loading.
+                                      NRRD (.nrrd, .nhdr), MetaImage (.mha, .mhd) and binary legacy
+                                      VTK structured points (.vtk) volumes are read from their
+                                      header instead, with attached or detached raw or gzip data.
+                                      Their outputs are named <name>_<X>x<Y>x<Z>_<data type>.<ext>.
+                                      HDF5 datasets (file.h5:/path/to/dataset, or file.h5 for the
+                                      first 3D dataset) are read when built with HDF5. Chunked
+                                      datasets are read in parallel a z slab of chunks at a time.
+
+    -components (n)                   Specify the number of interleaved components per voxel, e.g. 4
+                                      for xyz velocity and pressure. The count can also be given in
+                                      the file name by appending it to the data type, e.g.
+                                      volume_256x256x256_float32x4.raw. Each component is compressed
+                                      as its own channel and written to a .bcmc file.
+
+    -magnitude                        For multi-component volumes, also compute the magnitude of the
+                                      vector formed by the first (up to 3) components while loading
+                                      and store it as an extra channel.
+
+    -normalize (min max|auto)         Normalize values to [0, 1] while loading, mapping the value
+                                      range [min, max] to [0, 1] and clamping values outside it.
+                                      auto finds the value range of the volume first.
+
+    -resample (x y z)                 Resample the volume to the given dims while it's loaded, e.g.
+                                      to compress a 2048^3 scan at 512^3. The input streams through
+                                      in slabs, so the full resolution volume is never held as
+                                      floats. The output is named with the resampled dims.
+
+    -resample-filter (box|trilinear|minmax)
+                                      Filter used by -resample. box averages the covered voxels,
+                                      trilinear interpolates at the output voxel centers and minmax
+                                      keeps the covered min or max, whichever is further from the
+                                      mean, preserving thin features. Defaults to box.
+
+In time series compress mode:
+
+    -series (volume_XxYxZx_dtype.raw ...)
+                                      Specify the raw volumes of each timestep, in order. All
+                                      timesteps must have the same dimensions. Timesteps are
+                                      compressed in groups of 4 as 4D ZFP fields and written to a
+                                      .bcmc file with an index of the stream holding each timestep.
+                                      -normalize must be given a fixed range in this mode.
+
+In decode benchmark mode:
+
+    -bench-decode (volume_XxYxZ_dtype.raw.crateN.zfp ...)
+                                      Specify the compressed volumes to benchmark. Subsets of
+                                      blocks are decoded by seeking to each block, as BCMC does,
+                                      at increasing thread counts up to -threads. The dims and
+                                      rate are taken from the file name, or from -dims and -crate.
+
+    -bench-fraction (f)               Decode a random fraction f of the blocks. Defaults to 0.1.
+
+    -bench-isovalue (value)           Decode the blocks whose value range contains the isovalue
+                                      instead of a random subset.
+
+    -bench-iters (n)                  Number of timed runs per thread count, the fastest is
+                                      reported. Defaults to 5.
+
+In serve mode:
+
+    -serve (paths ...)                Serve the .zfp and .bcmc files, or the ones in the given
+                                      directories, on localhost by file name. Byte Range requests
+                                      are supported, and parts of a file can be selected with
+                                      ?blocks=first-last for .zfp streams, ?stream=i for .bcmc
+                                      files or ?stream=i&blocks=first-last for blocks of a .bcmc
+                                      stream. Each connection worker uses one of -threads.
+
+    -port (port)                      Specify the port to listen on. Defaults to 8080.
+
+In merge mode:
+
+    -merge (shard outputs ...)        Concatenate the outputs of all shards of a conversion into
+                                      the final stream, without recompressing. The result is
+                                      identical to compressing the volume in one run.
 
 In generated volume compress mode:
 
-    -gen (plane_x|quarter_sphere|sphere|wavelet)
-                                      Specify the type of volume field to generate.
+    -gen (plane_x|quarter_sphere|sphere|wavelet|noise|marschner_lobb|metaballs|checkerboard)
+                                      Specify the type of volume field to generate. The noise,
+                                      marschner_lobb, metaballs and checkerboard fields are tuned
+                                      so the given fraction of blocks is active at isovalue 0.5.
 
     -dims (x y z)                     Specify the grid dimensions of the generated volume.
-)";
 
-bool read_raw_volume(const std::string &raw_file_name,
-                     std::vector<float> &data,
-                     glm::uvec3 &dims);
+    -active-fraction (f)              Fraction of blocks active at isovalue 0.5 in the tunable
+                                      generated volumes. Defaults to 0.1.
 
-bool generate_volume(const std::string &gen_mode_name,
-                     const glm::uvec3 &gen_dims,
-                     std::vector<float> &data);
+    -seed (n)                         Seed for the tunable generated volumes. Volumes are the same
+                                      for any number of threads. Defaults to 0.
+)";
 
 int main(int argc, char **argv)
 {
     using namespace std::chrono;
     std::vector<std::string> args(argv + 1, argv + argc);
+    profiler_set_thread_name("main");
+    ProfileTraceWriter trace_writer("zfp_make_test_data.trace.json");
+    PROFILE_ZONE("main");
 
     if (std::find(args.begin(), args.end(), std::string("-h")) != args.end()) {
         std::cout << USAGE << "\n";
@@ -58,16 +271,63 @@ int main(int argc, char **argv)
 
     bool raw_volume_mode = false;
     bool gen_volume_mode = false;
+    bool series_mode = false;
+    bool bench_decode_mode = false;
+    bool serve_mode = false;
     int compression_rate = -1;
     std::string raw_file_name;
+    std::vector<std::string> series_files;
+    std::vector<std::string> bench_files;
+    DecodeBenchmarkOptions bench_options;
+    std::vector<std::string> serve_paths;
+    ServeOptions serve_options;
     std::string gen_mode_name;
     glm::uvec3 gen_dims(0);
+    SyntheticVolumeOptions synthetic_options;
+    NormalizeOptions normalize;
+    ResampleOptions resample;
+    PaddingOptions padding;
+    ComponentOptions component_options;
+    bool run_reference_mc = false;
+    ReferenceMCOptions reference_mc_options;
+    AdaptiveRateOptions adaptive_options;
+    RateTarget rate_target;
+    CheckpointOptions checkpoint_options;
+    ShardOptions shard;
+    bool merge_mode = false;
+    std::vector<std::string> merge_files;
+    int num_rate_targets = 0;
+    size_t max_memory = 0;
     for (size_t i = 0; i < args.size(); ++i) {
         if (args[i] == "-crate") {
             compression_rate = std::stoi(args[++i]);
         } else if (args[i] == "-raw") {
             raw_volume_mode = true;
             raw_file_name = args[++i];
+        } else if (args[i] == "-series") {
+            series_mode = true;
+            for (; i + 1 < args.size() && args[i + 1][0] != '-'; ++i) {
+                series_files.push_back(args[i + 1]);
+            }
+        } else if (args[i] == "-bench-decode") {
+            bench_decode_mode = true;
+            for (; i + 1 < args.size() && args[i + 1][0] != '-'; ++i) {
+                bench_files.push_back(args[i + 1]);
+            }
+        } else if (args[i] == "-bench-fraction") {
+            bench_options.fraction = std::stod(args[++i]);
+        } else if (args[i] == "-bench-isovalue") {
+            bench_options.use_isovalue = true;
+            bench_options.isovalue = std::stof(args[++i]);
+        } else if (args[i] == "-bench-iters") {
+            bench_options.iterations = std::max(size_t(1), size_t(std::stoul(args[++i])));
+        } else if (args[i] == "-serve") {
+            serve_mode = true;
+            for (; i + 1 < args.size() && args[i + 1][0] != '-'; ++i) {
+                serve_paths.push_back(args[i + 1]);
+            }
+        } else if (args[i] == "-port") {
+            serve_options.port = std::stoul(args[++i]);
         } else if (args[i] == "-gen") {
             gen_volume_mode = true;
             gen_mode_name = args[++i];
@@ -75,18 +335,201 @@ int main(int argc, char **argv)
             gen_dims.x = std::stoul(args[++i]);
             gen_dims.y = std::stoul(args[++i]);
             gen_dims.z = std::stoul(args[++i]);
+        } else if (args[i] == "-active-fraction") {
+            synthetic_options.active_fraction = std::stod(args[++i]);
+        } else if (args[i] == "-seed") {
+            synthetic_options.seed = std::stoull(args[++i]);
+        } else if (args[i] == "-components") {
+            component_options.num_components = std::stoul(args[++i]);
+        } else if (args[i] == "-magnitude") {
+            component_options.magnitude = true;
+        } else if (args[i] == "-normalize") {
+            if (i + 1 < args.size() && args[i + 1] == "auto") {
+                normalize.mode = NormalizeOptions::AUTO;
+                ++i;
+            } else if (i + 2 < args.size()) {
+                normalize.mode = NormalizeOptions::RANGE;
+                normalize.min = std::stod(args[++i]);
+                normalize.max = std::stod(args[++i]);
+            } else {
+                std::cout << "-normalize requires a value range (min max) or auto\n";
+                return 1;
+            }
+        } else if (args[i] == "-resample") {
+            resample.dims.x = std::stoul(args[++i]);
+            resample.dims.y = std::stoul(args[++i]);
+            resample.dims.z = std::stoul(args[++i]);
+        } else if (args[i] == "-resample-filter") {
+            if (!parse_resample_filter(args[++i], resample.filter)) {
+                return 1;
+            }
+        } else if (args[i] == "-pad") {
+            if (!parse_padding_multiple(args[++i], padding)) {
+                return 1;
+            }
+        } else if (args[i] == "-pad-fill") {
+            if (!parse_padding_fill(args[++i], padding)) {
+                return 1;
+            }
+        } else if (args[i] == "-bcmc-ref") {
+            run_reference_mc = true;
+            reference_mc_options.isovalue = std::stof(args[++i]);
+        } else if (args[i] == "-mesh") {
+            reference_mc_options.mesh_file = args[++i];
+        } else if (args[i] == "-adaptive-rates") {
+            if (!parse_adaptive_rates(args[++i], adaptive_options.rates)) {
+                return 1;
+            }
+        } else if (args[i] == "-adaptive-tolerance") {
+            adaptive_options.tolerance = std::stod(args[++i]);
+        } else if (args[i] == "-region-blocks") {
+            adaptive_options.region_blocks = std::stoul(args[++i]);
+        } else if (args[i] == "-target-psnr") {
+            rate_target.kind = RateTarget::PSNR;
+            rate_target.value = std::stod(args[++i]);
+            ++num_rate_targets;
+        } else if (args[i] == "-target-maxerr") {
+            rate_target.kind = RateTarget::MAX_ERROR;
+            rate_target.value = std::stod(args[++i]);
+            ++num_rate_targets;
+        } else if (args[i] == "-target-bytes") {
+            rate_target.kind = RateTarget::BYTES;
+            rate_target.value = std::stod(args[++i]);
+            ++num_rate_targets;
+        } else if (args[i] == "-target-sample") {
+            rate_target.sample_fraction = std::stod(args[++i]);
+        } else if (args[i] == "-shard") {
+            if (!parse_shard(args[++i], shard)) {
+                return 1;
+            }
+        } else if (args[i] == "-merge") {
+            merge_mode = true;
+            for (; i + 1 < args.size() && args[i + 1][0] != '-'; ++i) {
+                merge_files.push_back(args[i + 1]);
+            }
+        } else if (args[i] == "-resume") {
+            checkpoint_options.resume = true;
+        } else if (args[i] == "-checkpoint-mb") {
+            checkpoint_options.slab_bytes = std::stoull(args[++i]) << 20;
+        } else if (args[i] == "-max-mem") {
+            if (!parse_memory_size(args[++i], max_memory)) {
+                return 1;
+            }
+        } else if (args[i] == "-mmap-output") {
+            checkpoint_options.mmap_output = true;
+        } else if (args[i] == "-threads") {
+            set_worker_thread_count(std::stoul(args[++i]));
+        } else if (args[i] == "-io") {
+            if (!parse_read_backend(args[++i], input_read_options().backend)) {
+                return 1;
+            }
+        } else if (args[i] == "-direct-io") {
+            input_read_options().direct = true;
+            checkpoint_options.direct_io = true;
+        } else if (args[i] == "-io-depth") {
+            input_read_options().queue_depth = std::max(1, std::stoi(args[++i]));
+        } else if (args[i] == "-io-block-mb") {
+            input_read_options().block_bytes = std::stoull(args[++i]) << 20;
+        } else if (args[i] == "-trace") {
+            trace_writer.set_file_name(args[++i]);
+#ifndef BCMC_PROFILE
+            std::cout << "Warning: -trace has no effect, profiling was not enabled in this "
+                         "build (BCMC_PROFILE)\n";
+#endif
         } else {
             std::cout << "Unrecognized argument " << args[i] << "\n";
             return 1;
         }
     }
 
-    if (!raw_volume_mode && !gen_volume_mode) {
-        std::cout << "A mode -raw or -gen is required.\n" << USAGE << "\n";
+    const int num_modes = int(raw_volume_mode) + int(gen_volume_mode) + int(series_mode) +
+                          int(bench_decode_mode) + int(serve_mode) + int(merge_mode);
+    if (num_modes == 0) {
+        std::cout << "A mode -raw, -gen, -series, -bench-decode, -serve or -merge is "
+                     "required.\n"
+                  << USAGE << "\n";
+        return 1;
+    }
+    if (num_modes > 1) {
+        std::cout << "Only one mode -raw, -gen, -series, -bench-decode, -serve or -merge may "
+                     "be passed\n"
+                  << USAGE << "\n";
+        return 1;
+    }
+
+    if (merge_mode) {
+        std::string merged_name;
+        if (!merge_shards(merge_files, merged_name)) {
+            return 1;
+        }
+        std::cout << "Wrote merged stream to " << merged_name << "\n";
+        return 0;
+    }
+    if (serve_mode) {
+        return serve_files(serve_paths, serve_options) ? 0 : 1;
+    }
+    if (bench_decode_mode) {
+        bench_options.dims = gen_dims;
+        bench_options.rate = compression_rate;
+        return run_decode_benchmark(bench_files, bench_options) ? 0 : 1;
+    }
+    if (gen_volume_mode && normalize.mode != NormalizeOptions::NONE) {
+        std::cout << "-normalize is only supported in raw volume mode\n";
+        return 1;
+    }
+    if (run_reference_mc && !raw_volume_mode && !gen_volume_mode) {
+        std::cout << "-bcmc-ref is only supported in raw and generated volume modes\n";
         return 1;
     }
-    if (raw_volume_mode && gen_volume_mode) {
-        std::cout << "Only one mode -raw or -gen may be passed\n" << USAGE << "\n";
+    if (!adaptive_options.rates.empty() &&
+        ((!raw_volume_mode && !gen_volume_mode) || run_reference_mc)) {
+        std::cout << "-adaptive-rates is only supported in raw and generated volume modes, "
+                     "without -bcmc-ref\n";
+        return 1;
+    }
+    if (num_rate_targets > 1 ||
+        (num_rate_targets == 1 &&
+         (compression_rate != -1 || !adaptive_options.rates.empty()))) {
+        std::cout << "Only one of -crate, -adaptive-rates, -target-psnr, -target-maxerr or "
+                     "-target-bytes may be passed\n";
+        return 1;
+    }
+    if (num_rate_targets == 1 && !raw_volume_mode && !gen_volume_mode) {
+        std::cout << "Rate targets are only supported in raw and generated volume modes\n";
+        return 1;
+    }
+    if (shard.enabled() &&
+        ((!raw_volume_mode && !gen_volume_mode) || run_reference_mc ||
+         !adaptive_options.rates.empty() || num_rate_targets != 0)) {
+        // Each shard only sees part of the volume, so it can't pick a rate for all of it
+        std::cout << "-shard is only supported in raw and generated volume modes with -crate, "
+                     "and without -bcmc-ref\n";
+        return 1;
+    }
+    if (resample.enabled() && (!raw_volume_mode || shard.enabled())) {
+        std::cout << "-resample is only supported in raw volume mode, without -shard\n";
+        return 1;
+    }
+    if (max_memory > 0 && !raw_volume_mode && !gen_volume_mode) {
+        std::cout << "-max-mem is only supported in raw and generated volume modes\n";
+        return 1;
+    }
+    if (checkpoint_options.mmap_output && checkpoint_options.direct_io) {
+        std::cout << "-mmap-output writes through the page cache, it can't be combined with "
+                     "-direct-io\n";
+        return 1;
+    }
+    if (input_read_options().direct && input_read_options().backend == ReadBackend::MMAP) {
+        // Mapped inputs go through the page cache, read them in blocks instead
+        input_read_options().backend = ReadBackend::URING;
+    }
+    if (padding.enabled() && ((!raw_volume_mode && !gen_volume_mode) || shard.enabled())) {
+        std::cout << "-pad is only supported in raw and generated volume modes, without "
+                     "-shard\n";
+        return 1;
+    }
+    if (!reference_mc_options.mesh_file.empty() && !run_reference_mc) {
+        std::cout << "-mesh requires -bcmc-ref\n";
         return 1;
     }
     if (gen_volume_mode && gen_dims == glm::uvec3(0)) {
@@ -95,16 +538,167 @@ int main(int argc, char **argv)
     }
 
     std::string out_name;
-    std::vector<float> volume_data;
-    glm::uvec3 volume_dims(0);
+    if (series_mode) {
+        if (!compress_time_series(series_files, compression_rate, normalize, out_name)) {
+            return 1;
+        }
+        std::cout << "Wrote time series to " << out_name << "\n";
+        return 0;
+    }
+
+    // Raw volumes are named by their file, or for header formats by their name with the dims
+    // and type added
+    RawVolumeInfo info;
+    std::string raw_out_name;
     if (raw_volume_mode) {
-        if (!read_raw_volume(raw_file_name, volume_data, volume_dims)) {
+        if (!read_volume_info(raw_file_name, info)) {
+            return 1;
+        }
+        if (is_volume_header_file(raw_file_name)) {
+            print_volume_header(raw_file_name, info);
+        } else if (is_hdf5_volume(raw_file_name)) {
+            print_hdf5_volume(raw_file_name, info);
+        }
+        raw_out_name = volume_output_name(raw_file_name, info);
+        if (component_options.num_components > 1 ||
+            (component_options.num_components == 0 && info.num_components > 1)) {
+            if (normalize.mode != NormalizeOptions::NONE || run_reference_mc ||
+                !adaptive_options.rates.empty() || num_rate_targets != 0 || shard.enabled() ||
+                resample.enabled() || padding.enabled() || max_memory > 0) {
+                std::cout << "-normalize, -bcmc-ref, -adaptive-rates, -shard, -resample, "
+                             "-pad, -max-mem and rate targets are not supported for "
+                             "multi-component volumes\n";
+                return 1;
+            }
+            if (!compress_multi_component_volume(
+                    raw_file_name, info, component_options, compression_rate, out_name)) {
+                std::cout << "Failed to compress multi-component volume " << raw_file_name
+                          << "\n";
+                return 1;
+            }
+            std::cout << "Wrote channels to " << out_name << "\n";
+            return 0;
+        }
+        if (component_options.magnitude) {
+            std::cout << "-magnitude requires a multi-component volume\n";
+            return 1;
+        }
+    }
+
+    // With -max-mem, pick how to load the volume from estimates of each strategy's peak
+    // memory, before allocating anything large
+    if (max_memory > 0) {
+        MemoryPlanInput plan_input;
+        plan_input.volume_dims = gen_dims;
+        if (raw_volume_mode) {
+            plan_input.input = &info;
+            plan_input.volume_dims = info.dims;
+            if (shard.enabled()) {
+                uint32_t z_begin = 0;
+                uint32_t z_end = 0;
+                shard_z_range(info.dims, shard, z_begin, z_end);
+                plan_input.volume_dims.z = z_end - z_begin;
+            } else if (resample.enabled()) {
+                plan_input.volume_dims = resample.dims;
+                plan_input.resample = true;
+            }
+        }
+        plan_input.volume_dims = padding.padded_dims(plan_input.volume_dims);
+        plan_input.multi_rate = !adaptive_options.rates.empty() || num_rate_targets != 0;
+        if (!adaptive_options.rates.empty()) {
+            plan_input.compression_rate = *std::max_element(adaptive_options.rates.begin(),
+                                                            adaptive_options.rates.end());
+        } else if (num_rate_targets == 0) {
+            plan_input.compression_rate = glm::clamp(compression_rate, 1, 32);
+        }
+        // Streamed volumes are never held in full, so they can't be hashed for a checkpoint
+        plan_input.can_stream = raw_volume_mode && !shard.enabled() && !resample.enabled() &&
+                                !padding.enabled() && !run_reference_mc &&
+                                !checkpoint_options.resume;
+        MemoryPlan plan;
+        if (!plan_memory(plan_input, max_memory, checkpoint_options, plan)) {
+            return 1;
+        }
+        print_memory_plan(plan, max_memory);
+        checkpoint_options.slab_bytes = plan.slab_bytes;
+        resample.slab_bytes = plan.slab_bytes;
+        if (plan.io_block_bytes > 0) {
+            input_read_options().block_bytes = plan.io_block_bytes;
+        }
+        set_worker_thread_count(plan.num_threads);
+
+        if (plan.strategy == LoadStrategy::SLAB_STREAM) {
+            const int used_compression_rate = fixed_compression_rate(compression_rate);
+            if (used_compression_rate < 0) {
+                return 1;
+            }
+            out_name =
+                raw_out_name + ".crate" + std::to_string(used_compression_rate) + ".zfp";
+            size_t compressed_size = 0;
+            if (!compress_raw_volume_streamed(raw_file_name,
+                                              info,
+                                              normalize,
+                                              used_compression_rate,
+                                              out_name,
+                                              checkpoint_options,
+                                              compressed_size)) {
+                std::cout << "Failed to compress volume\n";
+                return 1;
+            }
+            std::cout << "Total compressed size: " << compressed_size << "B\n";
+            return 0;
+        }
+    }
+
+    VolumeBuffer volume_data;
+    glm::uvec3 volume_dims(0);
+    // The z slices compressed by this shard. Sharded raw volumes only load these slices
+    uint32_t shard_z_begin = 0;
+    uint32_t shard_z_end = 0;
+    if (raw_volume_mode && shard.enabled()) {
+        volume_dims = info.dims;
+        shard_z_range(volume_dims, shard, shard_z_begin, shard_z_end);
+        volume_data.resize(size_t(volume_dims.x) * volume_dims.y *
+                           (shard_z_end - shard_z_begin));
+        if (!volume_data.empty() &&
+            !load_raw_volume(raw_file_name,
+                             info,
+                             volume_data.data(),
+                             normalize,
+                             shard_z_begin,
+                             shard_z_end)) {
+            std::cout << "Failed to read raw volume " << raw_file_name << "\n";
+            return 1;
+        }
+        out_name = raw_out_name;
+    } else if (raw_volume_mode && resample.enabled()) {
+        if (!read_raw_volume_resampled(
+                raw_file_name, resample, normalize, volume_data, padding)) {
+            std::cout << "Failed to read raw volume " << raw_file_name << "\n";
+            return 1;
+        }
+        volume_dims = resample.dims;
+        out_name =
+            replace_volume_name_dims(volume_output_name(raw_file_name, info, volume_dims),
+                                     volume_dims);
+    } else if (raw_volume_mode) {
+        if (!read_raw_volume(raw_file_name, volume_data, volume_dims, normalize, padding)) {
             std::cout << "Failed to read raw volume " << raw_file_name << "\n";
             return 1;
         }
-        out_name = raw_file_name;
+        out_name = raw_out_name;
+    } else if (is_synthetic_volume(gen_mode_name)) {
+        if (!generate_synthetic_volume(
+                gen_mode_name, gen_dims, synthetic_options, volume_data, padding)) {
+            std::cout << "Failed to generate volume\n";
+            return 1;
+        }
+        volume_dims = gen_dims;
+        out_name = synthetic_volume_name(gen_mode_name, synthetic_options) + "_" +
+                   std::to_string(volume_dims.x) + "x" + std::to_string(volume_dims.y) + "x" +
+                   std::to_string(volume_dims.z) + "_float32.gen";
     } else {
-        if (!generate_volume(gen_mode_name, gen_dims, volume_data)) {
+        if (!generate_volume(gen_mode_name, gen_dims, volume_data, padding)) {
             std::cout << "Failed to generate volume\n";
             return 1;
         }
@@ -113,178 +707,100 @@ int main(int argc, char **argv)
                    std::to_string(volume_dims.y) + "x" + std::to_string(volume_dims.z) +
                    "_float32.gen";
     }
+    // Volumes are loaded or generated straight into the padded buffer, from here on they're
+    // compressed at the padded dims
+    const glm::uvec3 logical_dims = volume_dims;
+    volume_dims = padding.padded_dims(logical_dims);
+    if (volume_dims != logical_dims) {
+        out_name = padded_volume_name(out_name, logical_dims, volume_dims);
+        std::cout << "Padded " << glm::to_string(logical_dims) << " to "
+                  << glm::to_string(volume_dims) << " with "
+                  << (padding.replicate_edge ? std::string("the edge voxels")
+                                             : std::to_string(padding.fill_value))
+                  << "\n";
+    }
 
     std::cout << "Uncompressed size: " << volume_data.size() * sizeof(float) << "b\n";
-
-    zfp_stream *zfp = zfp_stream_open(nullptr);
-    float used_compression_rate =
-        zfp_stream_set_rate(zfp, compression_rate, zfp_type_float, 3, 0);
-    std::cout << "Used compression rate: " << used_compression_rate << "\n";
-    if (std::floor(used_compression_rate) != used_compression_rate) {
-        std::cout << "Error: non-integer compression rate\n";
-        return 1;
+    {
+        const LargeBufferStats alloc_stats = large_buffer_stats();
+        std::cout << "Volume allocation time: " << alloc_stats.alloc_ms << "ms ("
+                  << alloc_stats.bytes_allocated << "b in " << alloc_stats.num_allocations
+                  << " allocations)\n";
     }
 
-    // Just compress the first block. This is also not really the first proper
-    // block of 4^3 voxels but just the first 64 voxels in the data, but ok for testing
-    zfp_field *field = zfp_field_3d(
-        volume_data.data(), zfp_type_float, volume_dims.x, volume_dims.y, volume_dims.z);
-
-    const size_t bufsize = zfp_stream_maximum_size(zfp, field);
-
-    std::vector<uint8_t> compressed_data(bufsize, 0);
-    bitstream *stream = stream_open(compressed_data.data(), compressed_data.size());
-    zfp_stream_set_bit_stream(zfp, stream);
-    zfp_stream_rewind(zfp);
-
-    size_t total_bytes = zfp_compress(zfp, field);
-    zfp_field_free(field);
+    if (!adaptive_options.rates.empty()) {
+        if (!compress_adaptive_volume(volume_data.data(),
+                                      volume_dims,
+                                      adaptive_options,
+                                      out_name,
+                                      out_name,
+                                      logical_dims)) {
+            std::cout << "Failed to compress volume\n";
+            return 1;
+        }
+        std::cout << "Wrote adaptive rate volume to " << out_name << "\n";
+        return 0;
+    }
 
-    compressed_data.resize(total_bytes);
-    std::cout << "Total compressed size: " << compressed_data.size() << "B\n";
+    if (rate_target.kind != RateTarget::NONE) {
+        compression_rate =
+            search_compression_rate(volume_data.data(), volume_dims, rate_target);
+        if (compression_rate < 0) {
+            return 1;
+        }
+    }
 
-    stream_close(stream);
-    zfp_stream_close(zfp);
+    const int used_compression_rate = fixed_compression_rate(compression_rate);
+    if (used_compression_rate < 0) {
+        return 1;
+    }
+    std::cout << "Used compression rate: " << used_compression_rate << "\n";
 
-    // Save out the compressed file
+    // Compress and save out the stream slab by slab, so long runs can be resumed
+    const LargeBufferStats stats_before_stream = large_buffer_stats();
     out_name = out_name + ".crate" + std::to_string(int(used_compression_rate)) + ".zfp";
-    std::ofstream out_file(out_name.c_str(), std::ios::binary);
-    out_file.write(reinterpret_cast<const char *>(compressed_data.data()),
-                   compressed_data.size());
-
-    return 0;
-}
-
-bool read_raw_volume(const std::string &raw_file_name,
-                     std::vector<float> &data,
-                     glm::uvec3 &dims)
-{
-    const std::regex match_filename("(\\w+)_(\\d+)x(\\d+)x(\\d+)_(.+)\\.raw");
-    auto matches =
-        std::sregex_iterator(raw_file_name.begin(), raw_file_name.end(), match_filename);
-    if (matches == std::sregex_iterator() || matches->size() != 6) {
-        std::cerr << "Unrecognized raw volume naming scheme, expected a format like: "
-                  << "'<name>_<X>x<Y>x<Z>_<data type>.raw' but '" << raw_file_name
-                  << "' did not match" << std::endl;
-        return false;
-    }
-
-    dims = glm::uvec3(
-        std::stoi((*matches)[2]), std::stoi((*matches)[3]), std::stoi((*matches)[4]));
-    const std::string volume_type = (*matches)[5];
-
-    size_t voxel_size = 0;
-    if (volume_type == "uint8") {
-        voxel_size = 1;
-    } else if (volume_type == "uint16") {
-        voxel_size = 2;
-    } else if (volume_type == "float32") {
-        voxel_size = 4;
-    }
-
-    const size_t num_voxels = size_t(dims.x) * size_t(dims.y) * size_t(dims.z);
-    data.resize(num_voxels, 0.f);
-    {
-        std::ifstream fin(raw_file_name.c_str(), std::ios::binary);
-        if (volume_type != "float32") {
-            std::vector<uint8_t> read_data(num_voxels * voxel_size, 0);
-            fin.read(reinterpret_cast<char *>(read_data.data()), read_data.size());
-            if (volume_type == "uint8") {
-                for (size_t i = 0; i < num_voxels; ++i) {
-                    data[i] = read_data[i];
-                }
-            } else if (volume_type == "uint16") {
-                uint16_t *d = reinterpret_cast<uint16_t *>(read_data.data());
-                for (size_t i = 0; i < num_voxels; ++i) {
-                    data[i] = d[i];
-                }
-            }
-        } else {
-            fin.read(reinterpret_cast<char *>(data.data()), data.size());
+    const float *stream_data = volume_data.data();
+    glm::uvec3 stream_dims = volume_dims;
+    if (shard.enabled()) {
+        // Generated volumes are generated in full, sharded raw volumes only hold the shard
+        if (gen_volume_mode) {
+            shard_z_range(volume_dims, shard, shard_z_begin, shard_z_end);
+            stream_data += size_t(volume_dims.x) * volume_dims.y * shard_z_begin;
         }
+        stream_dims.z = shard_z_end - shard_z_begin;
+        out_name = shard_file_name(out_name, shard);
+        std::cout << "Compressing shard " << shard.index << " of " << shard.count
+                  << ", z slices [" << shard_z_begin << ", " << shard_z_end << ")\n";
     }
-    return true;
-}
+    size_t compressed_size = 0;
+    if (!compress_volume_checkpointed(stream_data,
+                                      stream_dims,
+                                      used_compression_rate,
+                                      out_name,
+                                      checkpoint_options,
+                                      compressed_size)) {
+        std::cout << "Failed to compress volume\n";
+        return 1;
+    }
+    std::cout << "Stream allocation time: "
+              << large_buffer_stats().alloc_ms - stats_before_stream.alloc_ms << "ms\n";
+    std::cout << "Total compressed size: " << compressed_size << "B\n";
 
-bool generate_volume(const std::string &gen_mode_name,
-                     const glm::uvec3 &gen_dims,
-                     std::vector<float> &data)
-{
-    data.resize(size_t(gen_dims.x) * size_t(gen_dims.y) * size_t(gen_dims.z), 0.f);
-    if (gen_mode_name == "plane_x") {
-        // Generate a plane field increasing along x by just filling voxels with their
-        // normalized x coordinate
-        std::cout << "Generating plane_x volume, size: " << glm::to_string(gen_dims) << "\n";
-        for (size_t z = 0; z < gen_dims.z; ++z) {
-            for (size_t y = 0; y < gen_dims.y; ++y) {
-                for (size_t x = 0; x < gen_dims.x; ++x) {
-                    const size_t voxel = x + gen_dims.x * (y + gen_dims.y * z);
-                    data[voxel] = static_cast<float>(x) / gen_dims.x;
-                }
-            }
-        }
-        return true;
-    } else if (gen_mode_name == "quarter_sphere") {
-        // Generate a quarter sphere field by just looking at distance from the origin of the
-        // volume
-        std::cout << "Generating sphere volume, size: " << glm::to_string(gen_dims) << "\n";
-        const float max_dist = glm::length(glm::vec3(gen_dims));
-        for (size_t z = 0; z < gen_dims.z; ++z) {
-            for (size_t y = 0; y < gen_dims.y; ++y) {
-                for (size_t x = 0; x < gen_dims.x; ++x) {
-                    const size_t voxel = x + gen_dims.x * (y + gen_dims.y * z);
-                    const float dist = glm::length(glm::vec3(x, y, z));
-                    data[voxel] = dist / max_dist;
-                }
-            }
-        }
-        return true;
-    } else if (gen_mode_name == "sphere") {
-        // Generate a sphere field with the origin of the sphere in the middle of the volume
-        std::cout << "Generating sphere volume, size: " << glm::to_string(gen_dims) << "\n";
-        const glm::vec3 sphere_origin(gen_dims.x / 2.f, gen_dims.y / 2.f, gen_dims.z / 2.f);
-        const float max_dist = gen_dims.x / 2.f;
-        for (size_t z = 0; z < gen_dims.z; ++z) {
-            for (size_t y = 0; y < gen_dims.y; ++y) {
-                for (size_t x = 0; x < gen_dims.x; ++x) {
-                    const size_t voxel = x + gen_dims.x * (y + gen_dims.y * z);
-                    const float dist = glm::length(glm::vec3(x, y, z) - sphere_origin);
-                    data[voxel] = dist / max_dist;
-                }
-            }
+    if (run_reference_mc) {
+        MappedFile compressed_file;
+        if (!compressed_file.open(out_name)) {
+            return 1;
         }
-        return true;
-
-    } else if (gen_mode_name == "wavelet") {
-        // Generate the wavelet test volume, borrowed from OpenVKL
-        // https://github.com/openvkl/openvkl/blob/ec551ea08cbceab187326e2358fdc1ceeffaf1d6/testing/volume/procedural_functions.h#L39-L61
-        std::cout << "Generating wavelet volume, size: " << glm::to_string(gen_dims) << "\n";
-        // wavelet parameters
-        constexpr float M = 1.f;
-        constexpr float G = 1.f;
-        constexpr float XM = 1.f;
-        constexpr float YM = 1.f;
-        constexpr float ZM = 1.f;
-        constexpr float XF = 3.f;
-        constexpr float YF = 3.f;
-        constexpr float ZF = 3.f;
-
-        for (size_t z = 0; z < gen_dims.z; ++z) {
-            for (size_t y = 0; y < gen_dims.y; ++y) {
-                for (size_t x = 0; x < gen_dims.x; ++x) {
-                    const size_t voxel = x + gen_dims.x * (y + gen_dims.y * z);
-                    const glm::vec3 coords =
-                        2.f * (glm::vec3(x, y, z) / glm::vec3(gen_dims)) - glm::vec3(1.f);
-                    const float value =
-                        M * G *
-                        (XM * std::sin(XF * coords.x) + YM * std::sin(YF * coords.y) +
-                         ZM * std::cos(ZF * coords.z));
-                    data[voxel] = value;
-                }
-            }
+        CompressedVolumeInfo compressed_info;
+        compressed_info.dims = volume_dims;
+        compressed_info.rate = used_compression_rate;
+        if (!run_reference_marching_cubes(compressed_file.data(),
+                                          compressed_file.size(),
+                                          compressed_info,
+                                          reference_mc_options)) {
+            return 1;
         }
-        return true;
     }
-    std::cout << "Unrecognized/unimplemented generation mode " << gen_mode_name << "\n";
-    return false;
+
+    return 0;
 }